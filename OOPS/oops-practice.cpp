@@ -1,17 +1,855 @@
 #include<bits/stdc++.h>
 #include<iostream>
+#include<fcntl.h>
+#include<poll.h>
+#include<sys/mman.h>
+#include<sys/socket.h>
+#include<sys/stat.h>
+#include<sys/uio.h>
+#include<sys/un.h>
+#include<sys/wait.h>
+#include<unistd.h>
+#ifdef __linux__
+#include<linux/fs.h>
+#include<linux/io_uring.h>
+#include<linux/perf_event.h>
+#include<sys/epoll.h>
+#include<sys/ioctl.h>
+#include<sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include<x86intrin.h>
+#endif
 using namespace std;
 
+struct Footprint;
+
 class IPerson{
 public:
     virtual void getInfo() const = 0; // only the presence still makes class abstract
+    virtual void addFootprint(Footprint &total) const = 0; // this object's memory, added into total
+    Footprint footprint() const; // just this object
     virtual ~IPerson() = 0; // it's pure now so should be implemented below
     // virtual ~IPerson() = default; - virtual, but NOT pure = whole class - mix of pure and impure virtual func!
 };
 
-IPerson::~IPerson() {}  // must still define it (body can be empty)
+void forgetPerson(const IPerson *person); // change feed, below
+
+IPerson::~IPerson() { forgetPerson(this); }  // must still define it (body could be empty)
 // can also be written as IPerson::~IPerson() = default;
 
+class Teacher;
+class Student;
+
+// ======= LATENCY INSTRUMENTATION =======
+// Opt-in: build with -DOOPS_INSTRUMENT and the constructors, operator=, getInfo, HR::raise and waiveFees time
+// themselves with OOPS_TIMED. Without it the macro is empty and costs nothing.
+// Each thread records into its own HdrHistogram-style histograms (log-linear buckets, ~3% precision, 1 tick to
+// 2^64) so recording is a couple of timestamp reads and one uncontended counter bump - no locks, no shared cache
+// lines. latencyReport() merges every thread's histograms on demand, including threads that have since exited.
+// The tick reads dominate the cost (a few ns each on bare metal, far more where the hypervisor traps them), so
+// LatencyRecorder::sampleShift can time only 1 call in 2^shift and count it 2^shift times.
+class LatencyHistogram{
+public:
+    static const int subBits = 6; // values below 64 exact, then 32 linear sub-buckets per power of two (~3%)
+    static const int half = 1 << (subBits - 1);
+    static const int bucketCount = (64 - subBits + 2) * half;
+
+    static int indexOf(uint64_t v){
+        if(v < (1u << subBits))
+            return (int)v;
+        int msb = 63 - __builtin_clzll(v);
+        return (msb - subBits + 2) * half + (int)(v >> (msb - subBits + 1)) - half;
+    }
+
+    static uint64_t lowestOf(int index){
+        if(index < (1 << subBits))
+            return index;
+        int msb = index / half + subBits - 2;
+        return (uint64_t)(index % half + half) << (msb - subBits + 1);
+    }
+
+    static uint64_t highestOf(int index){
+        return index < (1 << subBits) ? index : lowestOf(index) + ((uint64_t)1 << (index / half - 1)) - 1;
+    }
+
+    // Owner thread only: a plain load + store, which stays atomic for readers without a locked instruction
+    void record(uint64_t v, uint64_t weight = 1){
+        atomic<uint64_t> &c = counts[indexOf(v)];
+        c.store(c.load(memory_order_relaxed) + weight, memory_order_relaxed);
+    }
+
+    void addTo(vector<uint64_t> &merged) const{
+        merged.resize(bucketCount);
+        for(int i = 0; i < bucketCount; ++i)
+            merged[i] += counts[i].load(memory_order_relaxed);
+    }
+
+private:
+    atomic<uint64_t> counts[bucketCount] = {};
+};
+
+// Value at quantile q (0..1] of merged bucket counts: the top of the bucket it lands in, as HdrHistogram reports it
+uint64_t quantileOf(const vector<uint64_t> &counts, double q){
+    uint64_t total = accumulate(counts.begin(), counts.end(), (uint64_t)0);
+    if(total == 0)
+        return 0;
+    uint64_t rank = max<uint64_t>(1, (uint64_t)ceil(q * total)), seen = 0;
+    for(size_t i = 0; i < counts.size(); ++i)
+        if((seen += counts[i]) >= rank)
+            return LatencyHistogram::highestOf((int)i);
+    return 0;
+}
+
+enum class TimedOp { TeacherCtor, StudentCtor, StudentCopy, StudentAssign, GetInfo, Raise, WaiveFees, Count };
+
+class LatencyRecorder{
+    struct ThreadHistograms{
+        LatencyHistogram ops[(int)TimedOp::Count];
+    };
+
+    static mutex& registryLock(){
+        static mutex lock;
+        return lock;
+    }
+
+    static vector<unique_ptr<ThreadHistograms>>& registry(){ // never shrinks: exited threads' counts stay mergeable
+        static vector<unique_ptr<ThreadHistograms>> all;
+        return all;
+    }
+
+    static ThreadHistograms& local(){
+        thread_local ThreadHistograms *mine = []{
+            lock_guard<mutex> guard(registryLock());
+            registry().emplace_back(new ThreadHistograms());
+            return registry().back().get();
+        }();
+        return *mine;
+    }
+public:
+    static atomic<unsigned> sampleShift; // may change while other threads record
+
+    // How many calls this one stands for if it should be timed, else 0. The shift is read once, so the weight
+    // always matches the rate the call was picked at. A plain thread_local counter: no TLS guard on the fast path.
+    static uint64_t sampled(){
+        static thread_local uint32_t calls = 0;
+        unsigned shift = sampleShift.load(memory_order_relaxed);
+        return (calls++ & ((1u << shift) - 1)) == 0 ? (uint64_t)1 << shift : 0;
+    }
+
+    // Cheapest monotonic tick the CPU offers: the TSC on x86, the virtual counter on ARM64, steady_clock elsewhere
+    static uint64_t now(){
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t ticks;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        return chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    static double nsPerTick(){ // measured once against steady_clock
+        static const double ratio = []{
+            auto start = chrono::steady_clock::now();
+            uint64_t first = now();
+            while(chrono::steady_clock::now() - start < chrono::milliseconds(5)) {}
+            double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+            return ns / max<uint64_t>(1, now() - first);
+        }();
+        return ratio;
+    }
+
+    static void record(TimedOp op, uint64_t ticks, uint64_t weight){
+        local().ops[(int)op].record(ticks, weight);
+    }
+
+    static vector<uint64_t> merged(TimedOp op){
+        vector<uint64_t> counts(LatencyHistogram::bucketCount);
+        lock_guard<mutex> guard(registryLock());
+        for(auto &thread : registry())
+            thread->ops[(int)op].addTo(counts);
+        return counts;
+    }
+
+    static const char* name(TimedOp op){
+        static const char *names[] = {"Teacher()", "Student()", "Student(const Student&)", "Student::operator=",
+                                      "getInfo", "HR::raise", "waiveFees"};
+        return names[(int)op];
+    }
+};
+
+atomic<unsigned> LatencyRecorder::sampleShift{0};
+
+class ScopedLatency{
+    TimedOp op;
+    uint64_t weight; // 0 when this call isn't sampled
+    uint64_t start;
+public:
+    explicit ScopedLatency(TimedOp op):
+        op(op), weight(LatencyRecorder::sampled()), start(weight ? LatencyRecorder::now() : 0) {}
+
+    ~ScopedLatency(){
+        if(weight)
+            LatencyRecorder::record(op, LatencyRecorder::now() - start, weight);
+    }
+};
+
+#ifdef OOPS_INSTRUMENT
+#define OOPS_TIMED(op) ScopedLatency oopsTimed_(TimedOp::op)
+#else
+#define OOPS_TIMED(op) ((void)0)
+#endif
+
+// Count and p50/p90/p99/p99.9/max in ns for every operation that was recorded at least once
+void latencyReport(ostream &out){
+    double scale = LatencyRecorder::nsPerTick();
+    for(int i = 0; i < (int)TimedOp::Count; ++i){
+        vector<uint64_t> counts = LatencyRecorder::merged((TimedOp)i);
+        uint64_t total = accumulate(counts.begin(), counts.end(), (uint64_t)0);
+        if(total == 0)
+            continue;
+        out<<LatencyRecorder::name((TimedOp)i)<<": n="<<total;
+        for(double q : {0.5, 0.9, 0.99, 0.999, 1.0})
+            out<<(q == 1.0 ? " max " : " p" + to_string(q * 100).substr(0, q < 0.995 ? 2 : 4) + " ")<<(uint64_t)(quantileOf(counts, q) * scale)<<"ns";
+        out<<endl;
+    }
+}
+
+// ======= METRICS =======
+// Process-wide registry of counters, gauges and histograms, rendered in the Prometheus text format by
+// MetricsRegistry::exposition (served by MetricsEndpoint and written by writeMetricsFile further down). Registering
+// takes a lock, but that happens once per series; updates are relaxed atomics only, so the hot paths that bump them
+// (constructors, setters, matrix allocation) never block. Families computed at scrape time register a collector.
+class MetricCounter{
+    atomic<uint64_t> count{0};
+public:
+    void inc(uint64_t n = 1){
+        count.fetch_add(n, memory_order_relaxed);
+    }
+
+    uint64_t value() const{
+        return count.load(memory_order_relaxed);
+    }
+};
+
+class MetricGauge{
+    atomic<int64_t> current{0};
+public:
+    void add(int64_t n){
+        current.fetch_add(n, memory_order_relaxed);
+    }
+
+    void set(int64_t v){
+        current.store(v, memory_order_relaxed);
+    }
+
+    int64_t value() const{
+        return current.load(memory_order_relaxed);
+    }
+};
+
+// Label set in exposition syntax: name="value",... with the value escaped
+string metricLabels(initializer_list<pair<string, string>> labels){
+    string out;
+    for(auto &[name, value] : labels){
+        if(!out.empty())
+            out += ',';
+        out += name + "=\"";
+        for(char c : value){
+            if(c == '\\' || c == '"')
+                out += '\\';
+            out += c == '\n' ? 'n' : c;
+        }
+        out += '"';
+    }
+    return out;
+}
+
+// Series line: name{labels} value, with extra labels (le="...") merged in
+void writeSample(ostream &out, const string &name, const string &labels, double value, const string &extra = ""){
+    out<<name;
+    if(!labels.empty() || !extra.empty())
+        out<<'{'<<labels<<(labels.empty() || extra.empty() ? "" : ",")<<extra<<'}';
+    if(isnan(value))
+        out<<" NaN\n";
+    else if(isinf(value))
+        out<<(value > 0 ? " +Inf\n" : " -Inf\n");
+    else if(value >= -0x1p63 && value < 0x1p63 && value == (double)(int64_t)value)
+        out<<' '<<(int64_t)value<<'\n'; // counters stay exact instead of going 1.21276e+07
+    else
+        out<<' '<<setprecision(17)<<value<<setprecision(6)<<'\n';
+}
+
+string boundLabel(double bound){
+    if(isinf(bound))
+        return metricLabels({{"le", "+Inf"}});
+    ostringstream text;
+    text<<bound;
+    return metricLabels({{"le", text.str()}});
+}
+
+class MetricHistogram{
+    vector<double> bounds;                 // bucket upper bounds, ascending; +Inf is implicit
+    unique_ptr<atomic<uint64_t>[]> counts; // per bucket, not cumulative; the last one is +Inf
+    atomic<uint64_t> total{0};
+    atomic<double> sum{0};
+public:
+    explicit MetricHistogram(vector<double> bounds): bounds(move(bounds)), counts(new atomic<uint64_t>[this->bounds.size() + 1]){
+        for(size_t i = 0; i <= this->bounds.size(); ++i)
+            counts[i] = 0;
+    }
+
+    const vector<double>& upperBounds() const{
+        return bounds;
+    }
+
+    void observe(double v, uint64_t times = 1){
+        counts[lower_bound(bounds.begin(), bounds.end(), v) - bounds.begin()].fetch_add(times, memory_order_relaxed);
+        total.fetch_add(times, memory_order_relaxed);
+        double s = sum.load(memory_order_relaxed);
+        while(!sum.compare_exchange_weak(s, s + v * times, memory_order_relaxed)) {}
+    }
+
+    void render(ostream &out, const string &name, const string &labels) const{
+        uint64_t cumulative = 0;
+        for(size_t i = 0; i <= bounds.size(); ++i){
+            cumulative += counts[i].load(memory_order_relaxed);
+            writeSample(out, name + "_bucket", labels, cumulative, boundLabel(i < bounds.size() ? bounds[i] : INFINITY));
+        }
+        writeSample(out, name + "_sum", labels, sum.load(memory_order_relaxed));
+        writeSample(out, name + "_count", labels, total.load(memory_order_relaxed));
+    }
+};
+
+class MetricsRegistry{
+    struct Series{
+        string labels;
+        MetricCounter *counter = nullptr;
+        MetricGauge *gauge = nullptr;
+        MetricHistogram *histogram = nullptr;
+    };
+
+    struct Family{
+        string name, help, type;
+        vector<Series> series;
+    };
+
+    mutex lock;
+    vector<Family> families;
+    deque<MetricCounter> counters; // deques: growing never moves what references already point at
+    deque<MetricGauge> gauges;
+    deque<MetricHistogram> histograms;
+    vector<function<void(ostream&)>> collectors;
+
+    Family& family(const string &name, const string &help, const string &type){
+        for(Family &f : families)
+            if(f.name == name){
+                if(f.type != type)
+                    throw runtime_error("metric " + name + " is already a " + f.type);
+                return f;
+            }
+        families.push_back({name, help, type, {}});
+        return families.back();
+    }
+
+    // Registering a series twice hands back the first one rather than exposing the name and labels twice
+    static Series* find(Family &f, const string &labels){
+        for(Series &s : f.series)
+            if(s.labels == labels)
+                return &s;
+        return nullptr;
+    }
+public:
+    static MetricsRegistry& global(){
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    MetricCounter& counter(const string &name, const string &help, const string &labels = ""){
+        lock_guard<mutex> guard(lock);
+        Family &f = family(name, help, "counter");
+        if(Series *existing = find(f, labels))
+            return *existing->counter;
+        counters.emplace_back();
+        Series series;
+        series.labels = labels;
+        series.counter = &counters.back();
+        f.series.push_back(series);
+        return counters.back();
+    }
+
+    MetricGauge& gauge(const string &name, const string &help, const string &labels = ""){
+        lock_guard<mutex> guard(lock);
+        Family &f = family(name, help, "gauge");
+        if(Series *existing = find(f, labels))
+            return *existing->gauge;
+        gauges.emplace_back();
+        Series series;
+        series.labels = labels;
+        series.gauge = &gauges.back();
+        f.series.push_back(series);
+        return gauges.back();
+    }
+
+    MetricHistogram& histogram(const string &name, const string &help, vector<double> bounds, const string &labels = ""){
+        lock_guard<mutex> guard(lock);
+        Family &f = family(name, help, "histogram");
+        if(Series *existing = find(f, labels)){
+            if(existing->histogram->upperBounds() != bounds)
+                throw runtime_error("metric " + name + "{" + labels + "} is already registered with other buckets");
+            return *existing->histogram;
+        }
+        histograms.emplace_back(move(bounds));
+        Series series;
+        series.labels = labels;
+        series.histogram = &histograms.back();
+        f.series.push_back(series);
+        return histograms.back();
+    }
+
+    // fn writes whole families (HELP/TYPE lines included) at scrape time
+    void collect(function<void(ostream&)> fn){
+        lock_guard<mutex> guard(lock);
+        collectors.push_back(move(fn));
+    }
+
+    void exposition(ostream &out){
+        lock_guard<mutex> guard(lock);
+        for(const Family &f : families){
+            out<<"# HELP "<<f.name<<' '<<f.help<<'\n'<<"# TYPE "<<f.name<<' '<<f.type<<'\n';
+            for(const Series &s : f.series){
+                if(s.counter)
+                    writeSample(out, f.name, s.labels, s.counter->value());
+                else if(s.gauge)
+                    writeSample(out, f.name, s.labels, s.gauge->value());
+                else
+                    s.histogram->render(out, f.name, s.labels);
+            }
+        }
+        for(auto &collector : collectors)
+            collector(out);
+    }
+};
+
+// The series the classes below update directly. Teacher has had its own count (teacherCount) all along.
+struct CoreMetrics{
+    MetricGauge &studentParts, &gradStudents, &tas; // live objects with that part; a TA is also a Student part
+    MetricGauge &matrixHeapBytes, &matrixMappedBytes;
+    MetricCounter &salarySets, &feeSets, &raises, &waivers, &assignments, &copies;
+
+    static CoreMetrics& get(){
+        static CoreMetrics metrics = []{
+            MetricsRegistry &r = MetricsRegistry::global();
+            const char *parts = "Live objects containing each part (a TA contains a Student and a Teacher)";
+            const char *bytes = "Bytes held by Student matrices";
+            const char *mutations = "Roster mutations by operation";
+            return CoreMetrics{
+                r.gauge("oops_live_parts", parts, metricLabels({{"part", "Student"}})),
+                r.gauge("oops_live_parts", parts, metricLabels({{"part", "GradStudent"}})),
+                r.gauge("oops_live_parts", parts, metricLabels({{"part", "TA"}})),
+                r.gauge("oops_matrix_bytes", bytes, metricLabels({{"backing", "heap"}})),
+                r.gauge("oops_matrix_bytes", bytes, metricLabels({{"backing", "mapped"}})),
+                r.counter("oops_mutations_total", mutations, metricLabels({{"op", "setSalary"}})),
+                r.counter("oops_mutations_total", mutations, metricLabels({{"op", "setFees"}})),
+                r.counter("oops_mutations_total", mutations, metricLabels({{"op", "raise"}})),
+                r.counter("oops_mutations_total", mutations, metricLabels({{"op", "waiveFees"}})),
+                r.counter("oops_mutations_total", mutations, metricLabels({{"op", "assign"}})),
+                r.counter("oops_mutations_total", mutations, metricLabels({{"op", "copy"}})),
+            };
+        }();
+        return metrics;
+    }
+};
+
+// ======= OPERATION TRACE HOOKS =======
+// Every public operation (constructors, copy, assignment, the setters, HR::raise, waiveFees, getInfo,
+// isVoteEligible, destructors) reports itself through OOPS_TRACE while a TraceRecorder is running; see TRACE
+// RECORD / REPLAY further down. Hooks pass the object's address; the recorder turns it into a serial number for that
+// object's lifetime. With no recorder running a hook is one relaxed load and a branch.
+enum class TraceOp : uint8_t { TeacherCtor, StudentCtor, GradStudentCtor, TACtor, TeacherCopy, StudentCopy,
+                               GradStudentCopy, TACopy, TeacherAssign, StudentAssign, SetSalary, SetSalaryDiscount,
+                               SetFees, Raise, WaiveFees, TeacherGetInfo, StudentGetInfo, IsVoteEligible, TeacherDtor,
+                               StudentDtor, Count };
+
+atomic<bool> traceActive{false};
+
+#define OOPS_TRACE(call) do{ if(traceActive.load(memory_order_relaxed)) call; } while(0)
+
+void traceOp(TraceOp op, const void *object, double x = 0, double y = 0, const void *other = nullptr);
+void traceTeacher(const void *teacher, int id, const string &name, const string &dept, double salary);
+void traceStudent(const void *student, int id, int age, const string &name, double fees, int size);
+void traceDerived(TraceOp op, const void *student, const void *teacher, bool doingResearch); // GradStudent, TA, copies
+
+// ======= FOOTPRINT =======
+// What a person really costs: sizeof split into declared fields, vptrs and padding, plus what the fields own on the
+// heap and what malloc adds on top of each of those allocations. Layout (offsets, vptrs, padding) is the same for
+// every object of a class, so it is worked out from the first object added to a Footprint only; after that an
+// object costs a few additions per field and no allocation, which keeps a report over a 10M-person roster cheap.
+// Heap sizes are computed, not measured: glibc's chunk rule (8-byte header, 16-byte granules, 32-byte minimum) for
+// the allocator overhead, and a string only owns heap once it outgrows the buffer inside the string object.
+size_t allocationBytes(size_t requested){
+    return max<size_t>(32, (requested + 8 + 15) & ~(size_t)15);
+}
+
+struct HeapUse{
+    size_t bytes = 0, allocations = 0, overhead = 0;
+
+    void add(size_t requested, size_t count = 1){
+        bytes += requested * count;
+        allocations += count;
+        overhead += (allocationBytes(requested) - requested) * count;
+    }
+};
+
+HeapUse heapUse(const string &s){
+    HeapUse use;
+    const char *inside = (const char*)&s;
+    if(s.data() < inside || s.data() >= inside + sizeof s) // not the small-string buffer
+        use.add(s.capacity() + 1);
+    return use;
+}
+
+struct FootprintField{
+    const char *name;
+    size_t offset, inlineBytes;     // per object
+    size_t heapBytes = 0, allocations = 0, overheadBytes = 0; // summed over every object
+};
+
+struct Footprint{
+    const char *type = "";
+    size_t objects = 0;
+    size_t objectBytes = 0, vptrBytes = 0, paddingBytes = 0; // per object: sizeof, and what isn't a declared field
+    size_t mappedBytes = 0;                                     // matrices in memory-mapped files, summed
+    vector<FootprintField> fields;
+
+    size_t heapBytes() const{
+        size_t total = 0;
+        for(auto &f : fields)
+            total += f.heapBytes;
+        return total;
+    }
+
+    size_t allocations() const{
+        size_t total = 0;
+        for(auto &f : fields)
+            total += f.allocations;
+        return total;
+    }
+
+    size_t overheadBytes() const{
+        size_t total = 0;
+        for(auto &f : fields)
+            total += f.overheadBytes;
+        return total;
+    }
+
+    size_t totalBytes() const{ // inline + heap + allocator overhead (mapped files not included)
+        return objects * objectBytes + heapBytes() + overheadBytes();
+    }
+
+    void print(ostream &out) const{
+        double n = max<size_t>(objects, 1);
+        out<<type<<" x"<<objects<<": "<<fixed<<setprecision(1)<<totalBytes() / n<<" B/object = "<<objectBytes
+           <<" inline (vptrs "<<vptrBytes<<", padding "<<paddingBytes<<") + "<<heapBytes() / n<<" heap in "
+           <<allocations() / n<<" allocations + "<<overheadBytes() / n<<" allocator overhead";
+        if(mappedBytes)
+            out<<"; "<<mappedBytes / n<<" B/object in mapped files";
+        out<<endl;
+        for(auto &f : fields)
+            out<<"    +"<<setw(3)<<f.offset<<' '<<left<<setw(28)<<f.name<<right<<setw(3)<<f.inlineBytes<<" inline, "
+               <<setw(8)<<f.heapBytes / n<<" heap, "<<setw(6)<<f.overheadBytes / n<<" overhead"<<endl;
+        out<<defaultfloat<<setprecision(6);
+    }
+};
+
+Footprint IPerson::footprint() const{
+    Footprint f;
+    addFootprint(f);
+    return f;
+}
+
+// Used by each class's addFootprint: name the polymorphic subobjects (each starts with a vptr under the Itanium ABI
+// that GCC and Clang use) and the fields, in any order, then finish(). A Footprint holds one class: later objects
+// fill the first one's fields by position, so another class, or fields named in a different order, throws
+class FootprintBuilder{
+    Footprint &total;
+    const char *base;
+    bool first;
+    size_t next = 0;
+    vector<size_t> subobjects;
+public:
+    FootprintBuilder(Footprint &total, const char *type, const void *object, size_t size):
+        total(total), base((const char*)object), first(total.objects == 0){
+        if(first){
+            total.type = type;
+            total.objectBytes = size;
+        }else if(strcmp(total.type, type) != 0 || total.objectBytes != size) // its fields are filled by position
+            throw runtime_error(string("footprint of ") + total.type + " can't take a " + type);
+        ++total.objects;
+    }
+
+    void subobject(const void *start){
+        if(first)
+            subobjects.push_back((const char*)start - base);
+    }
+
+    template<typename T>
+    void field(const char *name, const T &member, const HeapUse &heap = HeapUse()){
+        if(first)
+            total.fields.push_back({name, (size_t)((const char*)&member - base), sizeof(T)});
+        if(next == total.fields.size() || strcmp(total.fields[next].name, name) != 0)
+            throw runtime_error(string("footprint of ") + total.type + " has no field " + name + " here");
+        FootprintField &f = total.fields[next++];
+        f.heapBytes += heap.bytes;
+        f.allocations += heap.allocations;
+        f.overheadBytes += heap.overhead;
+    }
+
+    void field(const char *name, const string &member){
+        field<string>(name, member, heapUse(member));
+    }
+
+    void mapped(size_t bytes){
+        total.mappedBytes += bytes;
+    }
+
+    // Gaps between fields: a pointer-sized one where a subobject starts is its vptr, anything else is padding
+    void finish(){
+        if(!first)
+            return;
+        vector<pair<size_t, size_t>> taken;
+        for(auto &f : total.fields)
+            taken.push_back({f.offset, f.offset + f.inlineBytes});
+        taken.push_back({total.objectBytes, total.objectBytes});
+        sort(taken.begin(), taken.end()); // total.fields keeps call order: later objects fill it by position
+        size_t at = 0;
+        for(auto &[from, to] : taken){
+            if(from > at){
+                size_t vptr = count(subobjects.begin(), subobjects.end(), at) && from - at >= sizeof(void*) ? sizeof(void*) : 0;
+                total.vptrBytes += vptr;
+                total.paddingBytes += from - at - vptr;
+            }
+            at = max(at, to);
+        }
+    }
+};
+
+// ======= CHANGE FEED =======
+// Anything that keeps a derived view of the roster (histograms, indexes, logs...) subscribes here and is told about
+// every Teacher/Student that appears, disappears or changes. Defaults are empty so an observer overrides only what it needs.
+// Student::operator= is reported as the old state being removed followed by the new state being added.
+// Publishing is thread-safe: the observer list is copy-on-write, and each subscription has a lock, so one observer
+// gets one notification at a time whichever thread publishes, and unsubscribe() waits out a notification in flight.
+// A subscription can be scoped to a set of people (usually one roster's) so it only hears about them.
+class IRosterObserver{
+public:
+    virtual void teacherAdded(const Teacher &) {}
+    virtual void teacherRemoved(const Teacher &) {}
+    virtual void salaryChanged(const Teacher &, double /*oldSalary*/) {}
+    virtual void studentAdded(const Student &) {}
+    virtual void studentRemoved(const Student &) {}
+    virtual void feesChanged(const Student &, double /*oldFees*/) {}
+    virtual ~IRosterObserver() = default;
+};
+
+typedef unordered_set<const IPerson*> RosterScope; // the people a scoped subscription hears about
+
+class RosterFeed{
+    struct Subscription{
+        IRosterObserver *observer;
+        recursive_mutex lock; // recursive: an observer may publish, or unsubscribe itself, from inside a notification
+        bool active = true;
+        bool scoped = false;
+        RosterScope members;
+    };
+    typedef vector<shared_ptr<Subscription>> Subscriptions;
+
+    static mutex writing; // serialises changes to the list; publishers never take it
+    static shared_ptr<const Subscriptions> observers; // only through atomic_load / atomic_store
+    static atomic<int> scopedCount;
+    static atomic<int> subscriberCount; // lets publish() skip the list, and its locks, when nobody is listening
+
+    static shared_ptr<Subscription> add(IRosterObserver *o, bool scoped, RosterScope members){
+        auto subscription = make_shared<Subscription>();
+        subscription->observer = o;
+        subscription->scoped = scoped;
+        subscription->members = move(members);
+        lock_guard<mutex> guard(writing);
+        auto next = make_shared<Subscriptions>(*atomic_load(&observers));
+        next->push_back(subscription);
+        atomic_store(&observers, shared_ptr<const Subscriptions>(move(next)));
+        scopedCount += scoped;
+        ++subscriberCount;
+        return subscription;
+    }
+
+    static shared_ptr<Subscription> find(IRosterObserver *o){
+        for(auto &subscription : *atomic_load(&observers))
+            if(subscription->observer == o)
+                return subscription;
+        return nullptr;
+    }
+public:
+    // Everything, from every thread
+    static void subscribe(IRosterObserver *o){
+        add(o, false, {});
+    }
+
+    // Only what happens to these people; anyone else is filtered out before the observer is called
+    static void subscribe(IRosterObserver *o, RosterScope members){
+        add(o, true, move(members));
+    }
+
+    // Replaces the people a scoped subscription hears about (or scopes an unscoped one)
+    static void rescope(IRosterObserver *o, RosterScope members){
+        shared_ptr<Subscription> subscription = find(o);
+        if(!subscription)
+            return;
+        lock_guard<recursive_mutex> guard(subscription->lock);
+        if(!subscription->scoped)
+            ++scopedCount;
+        subscription->scoped = true;
+        subscription->members = move(members);
+    }
+
+    // Once this returns the observer is not being called and will not be called again, so it can be destroyed
+    static void unsubscribe(IRosterObserver *o){
+        shared_ptr<Subscription> gone;
+        {
+            lock_guard<mutex> guard(writing);
+            auto next = make_shared<Subscriptions>(*atomic_load(&observers));
+            for(auto it = next->begin(); it != next->end(); ++it)
+                if((*it)->observer == o){
+                    gone = *it;
+                    next->erase(it);
+                    break;
+                }
+            atomic_store(&observers, shared_ptr<const Subscriptions>(move(next)));
+        }
+        if(!gone)
+            return;
+        --subscriberCount;
+        lock_guard<recursive_mutex> guard(gone->lock); // a publisher holding the old list may be inside it right now
+        gone->active = false;
+        scopedCount -= gone->scoped;
+    }
+
+    template<typename Fn>
+    static void publish(const IPerson &subject, Fn notify){
+        if(subscriberCount.load(memory_order_relaxed) == 0)
+            return;
+        shared_ptr<const Subscriptions> list = atomic_load(&observers);
+        for(const shared_ptr<Subscription> &subscription : *list){
+            lock_guard<recursive_mutex> guard(subscription->lock);
+            if(subscription->active && (!subscription->scoped || subscription->members.count(&subject)))
+                notify(*subscription->observer);
+        }
+    }
+
+    // A person is gone: drop it from every scope so whoever reuses the address is not mistaken for it
+    static void forget(const IPerson *person){
+        if(scopedCount.load(memory_order_relaxed) == 0)
+            return;
+        for(auto &subscription : *atomic_load(&observers)){
+            lock_guard<recursive_mutex> guard(subscription->lock);
+            subscription->members.erase(person);
+        }
+    }
+};
+
+mutex RosterFeed::writing;
+shared_ptr<const RosterFeed::Subscriptions> RosterFeed::observers = make_shared<RosterFeed::Subscriptions>();
+atomic<int> RosterFeed::scopedCount{0};
+atomic<int> RosterFeed::subscriberCount{0};
+
+void forgetPerson(const IPerson *person){
+    RosterFeed::forget(person);
+}
+
+// ======= MEMORY-MAPPED MATRICES =======
+// Backing store for matrices too big for the heap: an unlinked temp file mapped MAP_SHARED, so the kernel pages rows
+// in and out and only the pages being touched need RAM. The file vanishes with the mapping.
+class MappedMatrix{
+    int fd = -1;
+    void *base = MAP_FAILED;
+    size_t length;
+
+    // Copies src's file into ours: reflink (shares the blocks), then copy_file_range (in-kernel), then plain pread/pwrite
+    void cloneFrom(const MappedMatrix &src){
+#ifdef __linux__
+#ifdef FICLONE
+        if(::ioctl(fd, FICLONE, src.fd) == 0)
+            return;
+#endif
+        loff_t in = 0, out = 0;
+        while((size_t)in < length){
+            ssize_t n = ::copy_file_range(src.fd, &in, fd, &out, length - in, 0);
+            if(n <= 0)
+                break;
+        }
+        if((size_t)in == length)
+            return;
+#endif
+        vector<char> chunk(1 << 20);
+        for(size_t at = 0; at < length;){
+            ssize_t n = ::pread(src.fd, chunk.data(), min(chunk.size(), length - at), at);
+            if(n <= 0 || ::pwrite(fd, chunk.data(), n, at) != n)
+                throw runtime_error(string("cannot copy mapped matrix: ") + strerror(errno));
+            at += n;
+        }
+    }
+public:
+    static string directory; // should be on disk, not tmpfs, or nothing is gained
+
+    explicit MappedMatrix(size_t bytes, const MappedMatrix *copyOf = nullptr): length(bytes){
+        string path = directory + "/oops-matrix-XXXXXX";
+        fd = ::mkstemp(&path[0]);
+        if(fd < 0)
+            throw runtime_error("cannot create " + path + ": " + strerror(errno));
+        ::unlink(path.c_str());
+        if(::ftruncate(fd, length) != 0){ // sparse: reads as zeros until written
+            ::close(fd);
+            throw runtime_error(string("cannot size mapped matrix: ") + strerror(errno));
+        }
+        if(copyOf)
+            cloneFrom(*copyOf);
+        base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(base == MAP_FAILED){
+            ::close(fd);
+            throw runtime_error(string("cannot map matrix: ") + strerror(errno));
+        }
+    }
+
+    MappedMatrix(const MappedMatrix &) = delete;
+    MappedMatrix& operator=(const MappedMatrix &) = delete;
+
+    ~MappedMatrix(){
+        ::munmap(base, length);
+        ::close(fd);
+    }
+
+    int* data() const{
+        return (int*)base;
+    }
+
+    size_t bytes() const{
+        return length;
+    }
+
+    // Hints for the kernel's readahead: whole-matrix passes vs. scattered element access
+    void adviseSequential() const{
+        ::madvise(base, length, MADV_SEQUENTIAL);
+    }
+
+    void adviseRandom() const{
+        ::madvise(base, length, MADV_RANDOM);
+    }
+};
+
+string MappedMatrix::directory = getenv("OOPS_MATRIX_DIR") ? getenv("OOPS_MATRIX_DIR") : "/var/tmp";
+
 // virtually inheriting IPerson to avoid diamond inheritance problem!
 class Teacher: virtual public IPerson{
 protected:
@@ -29,230 +867,7964 @@ public:
     // }
 
     Teacher(){ // Non-parameterized Constructor
+        OOPS_TIMED(TeacherCtor);
         id = 0; name = ""; dept = ""; salary = 0.0;
         ++teacherCount;
+        OOPS_TRACE(traceTeacher(this, id, name, dept, salary));
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.teacherAdded(*this); });
+    }
+
+    // Good practice to write const in parameter's and use address saves time copying here again for pass by value.
+    Teacher(const int id,const string &name,const string &dept,const double salary){
+        OOPS_TIMED(TeacherCtor);
+        this->id = id;
+        this->name = name;
+        this->dept = dept;
+        this->salary = salary; // not setSalary(): nobody has been told about this teacher yet
+        ++teacherCount;
+        OOPS_TRACE(traceTeacher(this, id, name, dept, salary));
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.teacherAdded(*this); });
+    }
+
+    // Written out rather than implicit so a copy is counted, announced and traced like any other new Teacher
+    Teacher(const Teacher &t): IPerson(t), salary(t.salary), id(t.id), name(t.name), dept(t.dept){
+        OOPS_TIMED(TeacherCtor);
+        ++teacherCount;
+        OOPS_TRACE(traceOp(TraceOp::TeacherCopy, this, 0, 0, &t));
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.teacherAdded(*this); });
+    }
+
+    // Copies everything, id included, like the implicit one did; observers see the old Teacher go and the new one come
+    Teacher& operator=(const Teacher &t){
+        if(this == &t)
+            return *this;
+        OOPS_TRACE(traceOp(TraceOp::TeacherAssign, this, 0, 0, &t));
+        string newName = t.name, newDept = t.dept; // the copies that can throw, before anything changes
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.teacherRemoved(*this); });
+        id = t.id;
+        name = move(newName);
+        dept = move(newDept);
+        salary = t.salary;
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.teacherAdded(*this); });
+        return *this;
     }
 
-    // Good practice to write const in parameter's and use address saves time copying here again for pass by value.
-    Teacher(const int id,const string &name,const string &dept,const double salary){
-        this->id = id;
-        this->name = name;
-        this->dept = dept;
-        setSalary(salary);
-        ++teacherCount;
-    }
+    // Setter
+    void setSalary(const double salary){
+        CoreMetrics::get().salarySets.inc();
+        OOPS_TRACE(traceOp(TraceOp::SetSalary, this, salary));
+        double old = this->salary;
+        this->salary = salary;
+        RosterFeed::publish(*this, [&](IRosterObserver &o){ o.salaryChanged(*this, old); });
+    }
+
+    void setSalary(const double salary, double discount){ // Function overloading
+        CoreMetrics::get().salarySets.inc();
+        OOPS_TRACE(traceOp(TraceOp::SetSalaryDiscount, this, salary, discount));
+        double old = this->salary;
+        this->salary = salary * (1-discount)/100;
+        RosterFeed::publish(*this, [&](IRosterObserver &o){ o.salaryChanged(*this, old); });
+    }
+
+    // Getter
+    double getSalary() const{
+        return salary;
+    }
+
+    static int getTeacherCount(){ // NEW: can be called as Teacher::getTeacherCount()
+        return teacherCount;
+    }
+
+    // virtual void getInfo () const override { - writing virtual here is redundant! as already written in interface.
+    void getInfo () const override {
+        OOPS_TIMED(GetInfo);
+        OOPS_TRACE(traceOp(TraceOp::TeacherGetInfo, this));
+        cout<<"#"<<id<<": "<<name<<" from "<<dept<<" dept, earns "<<"$"<<getSalary()<<"/yr!"<<endl;
+        cout<<"Total Teachers = "<<teacherCount<<endl;
+    }
+
+    void addFootprint(Footprint &total) const override{
+        FootprintBuilder b(total, "Teacher", this, sizeof(Teacher));
+        footprintFields(b);
+        b.finish();
+    }
+
+protected:
+    void footprintFields(FootprintBuilder &b) const{ // TA adds these to its own
+        b.subobject(this);
+        b.subobject(static_cast<const IPerson*>(this));
+        b.field("Teacher::salary", salary);
+        b.field("Teacher::id", id);
+        b.field("Teacher::name", name);
+        b.field("Teacher::dept", dept);
+    }
+
+public:
+    // ~Teacher() override = default; // if you don't want to write anything in the destructor keep it as default!
+    ~Teacher() override {
+        OOPS_TRACE(traceOp(TraceOp::TeacherDtor, this));
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.teacherRemoved(*this); });
+        --teacherCount;
+    }
+};
+
+int Teacher::teacherCount = 0; // IMPORTANT TO DEFINE STATIC VARIABLE IN CLASS!
+
+class Student: virtual public IPerson{
+private:
+    double fees;
+public:
+    const int id;
+    int age;
+    string name;
+    int **matrix;
+    int size;
+    static bool logLifecycle; // bulk loads and benchmarks switch the destructor messages off
+    static size_t mappedMatrixBytes; // matrices bigger than this live in a memory-mapped file instead of the heap
+    static const int maxMatrixSize = 8192; // the largest size a file may ask for (256 MB of cells)
+
+private:
+    unique_ptr<MappedMatrix> mapped; // set when the rows point into a mapped file
+
+    // A matrix built off to the side - row pointers always on the heap, the rows themselves either on the heap or in
+    // a mapped file - so a throw part way (bad_alloc, a failed mmap) frees what was built and leaves the student as it was
+    struct MatrixStorage{
+        unique_ptr<int*[]> rows;
+        unique_ptr<MappedMatrix> mapped;
+        bool cloned = false; // values already copied from the source (only possible file to file)
+        int heapRows = 0;    // rows[0..heapRows) are heap rows this still owns: freed here unless adoptMatrix took them
+
+        MatrixStorage() = default;
+        MatrixStorage(MatrixStorage &&m) noexcept{
+            *this = move(m);
+        }
+        MatrixStorage& operator=(MatrixStorage &&m) noexcept{ // what this held goes to m, which frees it
+            swap(rows, m.rows);
+            swap(mapped, m.mapped);
+            swap(cloned, m.cloned);
+            swap(heapRows, m.heapRows);
+            return *this;
+        }
+        ~MatrixStorage(){
+            if(rows)
+                for(int i = 0; i < heapRows; ++i)
+                    delete[] rows[i];
+        }
+    };
+
+    static MatrixStorage buildMatrix(int size, const Student *source){
+        MatrixStorage m;
+        m.rows.reset(new int*[size]);
+        size_t bytes = (size_t)size * size * sizeof(int);
+        if(bytes <= mappedMatrixBytes){
+            for (; m.heapRows < size; ++m.heapRows) // a throw part way frees the rows built so far with m
+                m.rows[m.heapRows] = new int[size];
+            return m;
+        }
+        m.cloned = source && source->mapped && source->size == size;
+        m.mapped.reset(new MappedMatrix(bytes, m.cloned ? source->mapped.get() : nullptr));
+        for (int i = 0; i < size; ++i)
+            m.rows[i] = m.mapped->data() + (size_t)i * size;
+        return m;
+    }
+
+    // Takes over a matrix built for this->size; cannot throw. Returns true when the values were already cloned.
+    bool adoptMatrix(MatrixStorage built){
+        matrix = built.rows.release();
+        mapped = move(built.mapped);
+        (mapped ? CoreMetrics::get().matrixMappedBytes : CoreMetrics::get().matrixHeapBytes).add((size_t)size * size * sizeof(int));
+        return built.cloned;
+    }
+
+    bool allocateMatrix(const Student *source = nullptr){
+        return adoptMatrix(buildMatrix(size, source));
+    }
+
+    void initMatrix(){ // i + j, a row at a time so a mapped matrix streams through memory
+        if(mapped)
+            mapped->adviseSequential();
+        for (int i = 0; i < size; ++i)
+            for (int j = 0; j < size; ++j)
+                matrix[i][j] = i + j;
+        if(mapped)
+            mapped->adviseRandom();
+    }
+
+    void releaseMatrix(){
+        if(!matrix)
+            return;
+        (mapped ? CoreMetrics::get().matrixMappedBytes : CoreMetrics::get().matrixHeapBytes).add(-(int64_t)((size_t)size * size * sizeof(int)));
+        if(!mapped)
+            for(int i=0; i<size; ++i)
+                delete[] matrix[i];
+        delete[] matrix;
+        matrix = nullptr;
+        mapped.reset();
+    }
+
+public:
+
+    friend void waiveFees(Student &s, double amount);
+
+    Student():id(0){ // No need to write this as constructor with 0 args is already handled with the below constructor!
+        OOPS_TIMED(StudentCtor);
+        this->age = 18;
+        this->name = "";
+        this->size = 3;
+        this->fees = 0; // not setFees(): nobody has been told about this student yet
+
+        allocateMatrix();
+        CoreMetrics::get().studentParts.add(1);
+        initMatrix();
+        OOPS_TRACE(traceStudent(this, id, age, name, fees, size));
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.studentAdded(*this); });
+    }
+
+    // Constructor as Initialization List
+    Student(int id=0, int age=18, string name="", double fees=0.0, int size=3): id(id), age(age), name(name), size(size){
+        // this->id = id; - not allowed as declared constant!
+        OOPS_TIMED(StudentCtor);
+        this->fees = fees;
+
+        allocateMatrix();
+        CoreMetrics::get().studentParts.add(1);
+        initMatrix();
+        OOPS_TRACE(traceStudent(this, id, age, name, fees, size));
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.studentAdded(*this); });
+    }
+
+    // Shallow copy - is already handled by the default copy constructor!
+    Student(const Student &s):id(s.id), age(s.age), name(s.name), size(s.size){ //Deep Copy
+        OOPS_TIMED(StudentCopy);
+        CoreMetrics::get().copies.inc();
+        OOPS_TRACE(traceOp(TraceOp::StudentCopy, this, 0, 0, &s));
+        this->fees = s.getFees();
+        // Allocate New Matrix (a mapped one is cloned file to file, without reading it through memory)
+        bool cloned = allocateMatrix(&s);
+        CoreMetrics::get().studentParts.add(1);
+        if(!cloned)
+            // Copy Values
+            for (int i = 0; i < size; ++i)
+                for (int j = 0; j < size; ++j)
+                    matrix[i][j] = s.matrix[i][j];
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.studentAdded(*this); });
+    }
+
+    Student& operator=(const Student &s){
+        if (this == &s) {
+            // self-assignment: s1 = s1;
+            return *this;
+        }
+        OOPS_TIMED(StudentAssign);
+        CoreMetrics::get().assignments.inc();
+        OOPS_TRACE(traceOp(TraceOp::StudentAssign, this, 0, 0, &s));
+
+        // If, logically, a Student’s id should also change on assignment, 
+        // then id probably shouldn’t be const, or you should delete operator=:
+        // Student& operator=(const Student&) = delete;
+
+        // id is const, so we CANNOT assign to it.
+        // You might want to assert that ids are equal if that's a logical requirement:
+        // if (id != s.id) { /* maybe throw or log error */ }
+        // Note: I'm just copying the content of s2, keeping the original id of s3;
+
+        // Everything that can throw happens before anything changes: the new matrix and the name copy
+        bool resize = size != s.size;
+        MatrixStorage fresh;
+        if (resize)
+            fresh = buildMatrix(s.size, &s);
+        string newName = s.name;
+
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.studentRemoved(*this); });
+        this->age = s.age;
+        this->name = move(newName);
+        this->fees = s.getFees();
+
+        // If sizes differ, swap in the new matrix
+        bool cloned = false;
+        if (resize) {
+            releaseMatrix(); // free old matrix
+            size = s.size;
+            cloned = adoptMatrix(move(fresh));
+        }
+        // copy the matrix contents
+        if(!cloned)
+            for (int i = 0; i < size; ++i)
+                for (int j = 0; j < size; ++j)
+                    matrix[i][j] = s.matrix[i][j];
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.studentAdded(*this); });
+        return *this;   // return *this, NOT a local
+    }
+
+    void setFees(const double fees){ // const parameters: whose values aren't changed inside the function
+        CoreMetrics::get().feeSets.inc();
+        OOPS_TRACE(traceOp(TraceOp::SetFees, this, fees));
+        double old = this->fees;
+        this->fees = fees; // this function can't be constant
+        RosterFeed::publish(*this, [&](IRosterObserver &o){ o.feesChanged(*this, old); });
+    }
+
+    double getFees() const {
+        return fees;
+    }
+
+    // Overwrites every cell from size*size values, row by row; reported like assignment, as removed then added
+    void setMatrix(const vector<int> &cells){
+        if(cells.size() != (size_t)size * size)
+            throw runtime_error("matrix of #" + to_string(id) + " is not size x size");
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.studentRemoved(*this); });
+        for(int i = 0; i < size; ++i)
+            copy(cells.begin() + (size_t)i * size, cells.begin() + (size_t)(i + 1) * size, matrix[i]);
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.studentAdded(*this); });
+    }
+
+    // const function and parameter
+    bool isVoteEligible(const bool hasSSN) const {
+        OOPS_TRACE(traceOp(TraceOp::IsVoteEligible, this, hasSSN));
+        return hasSSN && age >= 18;
+    }
+
+    virtual void getInfo() const override { // const functions: functions that don't change the data members values of the class
+        OOPS_TIMED(GetInfo);
+        OOPS_TRACE(traceOp(TraceOp::StudentGetInfo, this));
+        cout<<"#"<<id<<": "<<name<<", Age: "<<age<<", pays="<<getFees()<<" & has matrix: "<<"size="<<size<<endl;
+        cout<<"Matrix"<<endl;
+        if(mapped)
+            mapped->adviseSequential();
+        for(int i=0; i<size; ++i){
+            for(int j=0; j<size; ++j)
+                cout<<matrix[i][j]<<" ";
+            cout<<endl;
+        }
+        if(mapped)
+            mapped->adviseRandom();
+    }
+
+    bool isMatrixMapped() const{
+        return mapped != nullptr;
+    }
+
+    void addFootprint(Footprint &total) const override{
+        FootprintBuilder b(total, "Student", this, sizeof(Student));
+        footprintFields(b);
+        b.finish();
+    }
+
+protected:
+    void footprintFields(FootprintBuilder &b) const{ // GradStudent and TA add these to their own
+        b.subobject(this);
+        b.subobject(static_cast<const IPerson*>(this));
+        b.field("Student::fees", fees);
+        b.field("Student::id", id);
+        b.field("Student::age", age);
+        b.field("Student::name", name);
+        HeapUse rows;
+        if(matrix){
+            rows.add(size * sizeof(int*)); // row pointers
+            if(!mapped)
+                rows.add(size * sizeof(int), size);
+        }
+        b.field("Student::matrix", matrix, rows);
+        b.field("Student::size", size);
+        HeapUse file;
+        if(mapped){
+            file.add(sizeof(MappedMatrix));
+            b.mapped((size_t)size * size * sizeof(int));
+        }
+        b.field("Student::mapped", mapped, file);
+    }
+
+public:
+
+    ~Student() override{
+        OOPS_TRACE(traceOp(TraceOp::StudentDtor, this));
+        RosterFeed::publish(*this, [this](IRosterObserver &o){ o.studentRemoved(*this); });
+        releaseMatrix();
+        CoreMetrics::get().studentParts.add(-1);
+        if(logLifecycle)
+            cout<<"#"<<id<<": "<<name<<", Age: "<<age<<", Matrix of size "<<size<<" is deleted!"<<endl;
+    }
+};
+
+bool Student::logLifecycle = true;
+size_t Student::mappedMatrixBytes = (size_t)256 << 20;
+
+class GradStudent : public Student{
+public:
+    bool doingResearch;
+    GradStudent(int id=0, int age=18, string name="", double fees=0.0, bool doingResearch=true, int size=3): 
+        Student(id, age, name, fees, size), doingResearch(doingResearch){
+        CoreMetrics::get().gradStudents.add(1);
+        OOPS_TRACE(traceDerived(TraceOp::GradStudentCtor, static_cast<Student*>(this), nullptr, doingResearch));
+    }
+
+    GradStudent(const GradStudent &g): IPerson(g), Student(g), doingResearch(g.doingResearch){
+        CoreMetrics::get().gradStudents.add(1);
+        OOPS_TRACE(traceDerived(TraceOp::GradStudentCopy, static_cast<Student*>(this), nullptr, doingResearch));
+    }
+
+    GradStudent& operator=(const GradStudent &) = default;
+
+    void addFootprint(Footprint &total) const override{
+        FootprintBuilder b(total, "GradStudent", this, sizeof(GradStudent));
+        footprintFields(b);
+        b.field("GradStudent::doingResearch", doingResearch);
+        b.finish();
+    }
+
+    ~GradStudent() override{
+        CoreMetrics::get().gradStudents.add(-1);
+    }
+};
+
+class TA : public Student, protected Teacher{
+public:
+    TA(int id=0, int age=18, string name="", double fees=0.0, string dept="", 
+        double salary=0.0, bool doingResearch=true, int size=3): 
+            Student(id, age, name, fees, size), Teacher(id, name, dept, salary){
+        CoreMetrics::get().tas.add(1);
+        OOPS_TRACE(traceDerived(TraceOp::TACtor, static_cast<Student*>(this), static_cast<Teacher*>(this), doingResearch));
+    }
+
+    TA(const TA &ta): IPerson(ta), Student(ta), Teacher(ta){
+        CoreMetrics::get().tas.add(1);
+        OOPS_TRACE(traceDerived(TraceOp::TACopy, static_cast<Student*>(this), static_cast<Teacher*>(this), false));
+    }
+
+    TA& operator=(const TA &) = default;
+
+    // Teacher is a protected base, so code outside TA can't make this conversion itself
+    const Teacher& asTeacher() const{
+        return *this;
+    }
+
+    Teacher& asTeacher(){
+        return *this;
+    }
+    
+    void getInfo() const override{
+        cout << "===== TA Info =====\n";
+        cout << "[As Student] ";
+        Student::getInfo();   // call Student version
+        cout << "[As Teacher] ";
+        Teacher::getInfo();   // call Teacher version
+    }
+
+    void addFootprint(Footprint &total) const override{
+        FootprintBuilder b(total, "TA", this, sizeof(TA));
+        Student::footprintFields(b);
+        Teacher::footprintFields(b);
+        b.finish();
+    }
+
+    ~TA() override{
+        CoreMetrics::get().tas.add(-1);
+        if(logLifecycle)
+            cout<<"Destructor from TA class says Hi!"<<endl;
+    }
+};
+
+void demoStaticVar(){
+    static int count = 0;
+    cout<<"[Static variable] count, called "<<++count<<" times!"<<endl;
+}
+
+void demoStaticObj(){
+    // This is how singletons / caches / loggers are often implemented: static objects that live for the whole run.
+    static Student classRep(999, 22, "Static-Rep", 5178, 2);
+    cout<<"[demoStaticObject] Class Representative info:"<<endl;
+    classRep.getInfo();
+}
+
+void waiveFees(Student &s, double amount){
+    OOPS_TIMED(WaiveFees);
+    CoreMetrics::get().waivers.inc();
+    OOPS_TRACE(traceOp(TraceOp::WaiveFees, &s, amount));
+    cout<<"[Friend Func] Waiving $"<<amount<<" for "<<s.name<<endl;
+    double old = s.fees;
+    s.fees -= amount;
+    RosterFeed::publish(s, [&](IRosterObserver &o){ o.feesChanged(s, old); });
+}
+
+class HR{
+public:
+    void raise(Teacher &t, int percentage){
+        OOPS_TIMED(Raise);
+        CoreMetrics::get().raises.inc();
+        OOPS_TRACE(traceOp(TraceOp::Raise, &t, percentage));
+        cout<<"[HR] Teacher "<<t.name<<" old salary ="<<t.salary<<endl; 
+        double old = t.salary;
+        t.salary = t.salary* ((100 + percentage)*1.0)/100;
+        RosterFeed::publish(t, [&](IRosterObserver &o){ o.salaryChanged(t, old); });
+        cout<<"[HR] Teacher "<<t.name<<" new salary ="<<t.salary<<endl; 
+    }
+};
+
+// ======= TOP-K (BOUNDED HEAPS) =======
+// Keeps only the k largest (value, object) pairs seen so far, so a scan is O(n log k) with k entries of memory
+// instead of sorting everybody. Anything that sees people one at a time (a full scan, a change feed) can offer() to it.
+template<typename T>
+class TopK{
+    typedef pair<double, const T*> Entry;
+    size_t k;
+    vector<Entry> heap; // min-heap on value: heap.front() is the smallest entry we are still keeping
+
+    static bool keepsLarger(const Entry &a, const Entry &b){
+        return a.first > b.first;
+    }
+public:
+    explicit TopK(size_t k): k(k){
+        heap.reserve(k);
+    }
+
+    void offer(double value, const T *obj){
+        if(heap.size() < k){
+            heap.emplace_back(value, obj);
+            push_heap(heap.begin(), heap.end(), keepsLarger);
+        }
+        else if(k > 0 && value > heap.front().first){ // only evict when the newcomer beats the current minimum
+            pop_heap(heap.begin(), heap.end(), keepsLarger);
+            heap.back() = Entry(value, obj);
+            push_heap(heap.begin(), heap.end(), keepsLarger);
+        }
+    }
+
+    void merge(const TopK &other){
+        for(const Entry &e : other.heap)
+            offer(e.first, e.second);
+    }
+
+    // Largest first
+    vector<Entry> sorted() const{
+        vector<Entry> out(heap);
+        sort(out.begin(), out.end(), keepsLarger);
+        return out;
+    }
+};
+
+// Each thread fills its own bounded heap over a slice of the roster, then the heaps are merged (k entries each).
+template<typename T, typename ValueFn>
+TopK<T> parallelTopK(const vector<T*> &people, size_t k, ValueFn value, unsigned threads = thread::hardware_concurrency()){
+    const size_t minChunk = 1 << 14; // below this, starting a thread costs more than it saves
+    threads = (unsigned)max<size_t>(1, min<size_t>(max(threads, 1u), people.size() / minChunk + 1));
+    size_t chunk = (people.size() + threads - 1) / threads;
+
+    vector<TopK<T>> local(threads, TopK<T>(k));
+    auto scan = [&](unsigned t){
+        size_t end = min(people.size(), (t + 1) * chunk);
+        for(size_t i = t * chunk; i < end; ++i)
+            local[t].offer(value(*people[i]), people[i]);
+    };
+    vector<thread> workers;
+    for(unsigned t = 1; t < threads; ++t)
+        workers.emplace_back(scan, t);
+    scan(0); // calling thread takes the first slice
+    for(thread &w : workers)
+        w.join();
+    for(unsigned t = 1; t < threads; ++t)
+        local[0].merge(local[t]);
+    return local[0];
+}
+
+TopK<Teacher> topPaidTeachers(const vector<Teacher*> &teachers, size_t k){
+    return parallelTopK(teachers, k, [](const Teacher &t){ return t.getSalary(); });
+}
+
+TopK<Student> topOutstandingFees(const vector<Student*> &students, size_t k){
+    return parallelTopK(students, k, [](const Student &s){ return s.getFees(); });
+}
+
+// ======= RADIX-PARTITIONED HASH JOIN =======
+// Joining Student and Teacher rosters on id. Both sides are first scattered into 2^bits partitions by a hash of the
+// key, so that each partition's hash table stays cache resident while it is built and probed.
+template<typename P>
+struct JoinTuple{
+    int key;
+    P payload;
+};
+
+inline uint32_t joinHash(int key){ // Fibonacci hashing: the high bits are well mixed
+    return (uint32_t)key * 2654435769u;
+}
+
+template<typename P>
+void radixPartition(const vector<JoinTuple<P>> &in, int bits, vector<JoinTuple<P>> &out, vector<size_t> &start){
+    size_t parts = (size_t)1 << bits;
+    int shift = 32 - bits;
+    auto partOf = [&](int key){ return bits == 0 ? 0 : joinHash(key) >> shift; };
+
+    // 1st pass: histogram, prefix sum gives every partition its slice of the output
+    start.assign(parts + 1, 0);
+    for(const JoinTuple<P> &t : in)
+        ++start[partOf(t.key) + 1];
+    for(size_t p = 0; p < parts; ++p)
+        start[p + 1] += start[p];
+
+    // 2nd pass: scatter
+    out.resize(in.size());
+    vector<size_t> cursor(start.begin(), start.end() - 1);
+    for(const JoinTuple<P> &t : in)
+        out[cursor[partOf(t.key)]++] = t;
+}
+
+// Calls emit(probePayload, buildPayload) for every pair with equal keys, without materializing the result.
+// The build side should be the smaller one.
+template<typename B, typename Pr, typename Fn>
+void radixHashJoin(const vector<JoinTuple<B>> &build, const vector<JoinTuple<Pr>> &probe, Fn emit){
+    // Pick enough partitions that one partition of the build side is ~128KB (fits in L2 with room for its table)
+    size_t bytes = build.size() * (sizeof(JoinTuple<B>) + 2 * sizeof(uint32_t));
+    int bits = 0;
+    while(bits < 14 && (bytes >> bits) > (128u << 10))
+        ++bits;
+
+    vector<JoinTuple<B>> b;
+    vector<JoinTuple<Pr>> p;
+    vector<size_t> bStart, pStart;
+    radixPartition(build, bits, b, bStart);
+    radixPartition(probe, bits, p, pStart);
+
+    vector<uint32_t> head, next;
+    for(size_t part = 0; part + 1 < bStart.size(); ++part){
+        size_t bBegin = bStart[part], bCount = bStart[part + 1] - bBegin;
+        if(bCount == 0 || pStart[part + 1] == pStart[part])
+            continue;
+
+        // Bucket-chained table over this partition only: head[bucket] -> first tuple, next[i] -> following tuple
+        int tableBits = 1;
+        while(((size_t)1 << tableBits) < bCount)
+            ++tableBits;
+        uint32_t mask = ((uint32_t)1 << tableBits) - 1;
+        const uint32_t none = UINT32_MAX;
+        head.assign((size_t)1 << tableBits, none);
+        next.resize(bCount);
+        for(size_t i = 0; i < bCount; ++i){
+            uint32_t h = ((uint32_t)b[bBegin + i].key * 0x85EBCA6Bu >> 7) & mask; // different bits than the partitioning hash
+            next[i] = head[h];
+            head[h] = (uint32_t)i;
+        }
+        for(size_t j = pStart[part]; j < pStart[part + 1]; ++j){
+            uint32_t h = ((uint32_t)p[j].key * 0x85EBCA6Bu >> 7) & mask;
+            for(uint32_t i = head[h]; i != none; i = next[i])
+                if(b[bBegin + i].key == p[j].key)
+                    emit(p[j].payload, b[bBegin + i].payload);
+        }
+    }
+}
+
+// fn(const Student&, const Teacher&) is called for every student/teacher pair sharing an id
+template<typename Fn>
+void joinStudentsTeachers(const vector<Student*> &students, const vector<Teacher*> &teachers, Fn fn){
+    vector<JoinTuple<const Student*>> s;
+    vector<JoinTuple<const Teacher*>> t;
+    s.reserve(students.size());
+    t.reserve(teachers.size());
+    for(const Student *x : students)
+        s.push_back({x->id, x});
+    for(const Teacher *x : teachers)
+        t.push_back({x->id, x});
+    if(t.size() <= s.size())
+        radixHashJoin(t, s, [&](const Student *a, const Teacher *b){ fn(*a, *b); });
+    else
+        radixHashJoin(s, t, [&](const Teacher *b, const Student *a){ fn(*a, *b); });
+}
+
+// TA payroll: sum of (salary - fees) over everybody that is on both rosters
+double netPayroll(const vector<Student*> &students, const vector<Teacher*> &teachers){
+    double total = 0;
+    joinStudentsTeachers(students, teachers, [&](const Student &s, const Teacher &t){
+        total += t.getSalary() - s.getFees();
+    });
+    return total;
+}
+
+// ======= GROUP-BY AGGREGATION =======
+// sum/avg/min/max/count per key. Rows are hash-partitioned (not radix: the partition is the top bits of a mixed
+// std::hash), every thread aggregates its slice into its own small per-partition unordered_maps (no sharing, no
+// locks), then each partition is merged across threads independently. The result is a flat vector sorted once by
+// key at the end rather than a std::map built node by node.
+struct Aggregate{
+    double sum = 0;
+    double min = numeric_limits<double>::infinity();
+    double max = -numeric_limits<double>::infinity();
+    size_t count = 0;
+
+    void add(double v){
+        sum += v;
+        min = std::min(min, v);
+        max = std::max(max, v);
+        ++count;
+    }
+
+    void merge(const Aggregate &o){
+        sum += o.sum;
+        min = std::min(min, o.min);
+        max = std::max(max, o.max);
+        count += o.count;
+    }
+
+    double avg() const{
+        return count ? sum / count : 0.0;
+    }
+};
+
+template<typename Key>
+using Groups = vector<pair<Key, Aggregate>>; // sorted by key
+
+template<typename Key, typename T, typename KeyFn, typename ValueFn>
+Groups<Key> groupBy(const vector<T*> &rows, KeyFn key, ValueFn value, unsigned threads = thread::hardware_concurrency()){
+    const int bits = 6; // 64 partitions keeps each thread-local table small even for wide keys
+    const size_t parts = (size_t)1 << bits;
+    auto partOf = [&](const Key &k){ return (size_t)((hash<Key>{}(k) * 0x9E3779B97F4A7C15ull) >> (64 - bits)); };
+
+    const size_t minChunk = 1 << 14;
+    threads = (unsigned)max<size_t>(1, min<size_t>(max(threads, 1u), rows.size() / minChunk + 1));
+    size_t chunk = (rows.size() + threads - 1) / threads;
+    typedef unordered_map<Key, Aggregate> Table;
+    vector<vector<Table>> local(threads, vector<Table>(parts)); // local[thread][partition]
+
+    auto runThreads = [&](function<void(unsigned)> work){
+        vector<thread> workers;
+        for(unsigned t = 1; t < threads; ++t)
+            workers.emplace_back(work, t);
+        work(0);
+        for(thread &w : workers)
+            w.join();
+    };
+
+    // Phase 1: thread-local aggregation
+    runThreads([&](unsigned t){
+        size_t end = min(rows.size(), (t + 1) * chunk);
+        for(size_t i = t * chunk; i < end; ++i){
+            Key k = key(*rows[i]);
+            local[t][partOf(k)][k].add(value(*rows[i]));
+        }
+    });
+
+    // Phase 2: partition p of every thread is folded into local[0][p]; partitions are disjoint so no locking
+    runThreads([&](unsigned t){
+        for(size_t p = t; p < parts; p += threads)
+            for(unsigned other = 1; other < threads; ++other)
+                for(auto &kv : local[other][p])
+                    local[0][p][kv.first].merge(kv.second);
+    });
+
+    size_t total = 0;
+    for(Table &table : local[0])
+        total += table.size();
+    Groups<Key> result;
+    result.reserve(total);
+    for(Table &table : local[0])
+        result.insert(result.end(), make_move_iterator(table.begin()), make_move_iterator(table.end()));
+    sort(result.begin(), result.end(), [](const pair<Key, Aggregate> &a, const pair<Key, Aggregate> &b){ return a.first < b.first; });
+    return result;
+}
+
+// Reference implementation the engine is checked against
+template<typename Key, typename T, typename KeyFn, typename ValueFn>
+map<Key, Aggregate> naiveGroupBy(const vector<T*> &rows, KeyFn key, ValueFn value){
+    map<Key, Aggregate> result;
+    for(const T *row : rows)
+        result[key(*row)].add(value(*row));
+    return result;
+}
+
+// Both sides iterate in key order: a Groups vector or a std::map
+template<typename A, typename B>
+bool sameGroups(const A &a, const B &b){
+    if(a.size() != b.size())
+        return false;
+    for(auto i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j){
+        // sums are added in a different order, so allow for rounding
+        double tolerance = 1e-9 * max(1.0, fabs(j->second.sum));
+        if(i->first != j->first || i->second.count != j->second.count || fabs(i->second.sum - j->second.sum) > tolerance
+            || i->second.min != j->second.min || i->second.max != j->second.max)
+            return false;
+    }
+    return true;
+}
+
+Groups<int> feesByAge(const vector<Student*> &students){
+    return groupBy<int>(students, [](const Student &s){ return s.age; }, [](const Student &s){ return s.getFees(); });
+}
+
+Groups<bool> feesByResearch(const vector<GradStudent*> &grads){
+    return groupBy<bool>(grads, [](const GradStudent &g){ return g.doingResearch; }, [](const GradStudent &g){ return g.getFees(); });
+}
+
+// ======= FENWICK-TREE HISTOGRAMS =======
+// Binary indexed tree: point update and prefix sum in O(log n). tree[i] holds the sum of raw[j] for j in (i & (i+1)) .. i
+class Fenwick{
+    vector<double> tree;
+public:
+    explicit Fenwick(size_t n = 0): tree(n, 0.0) {}
+
+    // O(n) bulk build: every node pushes its total into the one parent that covers it
+    explicit Fenwick(const vector<double> &raw): tree(raw){
+        for(size_t i = 0; i < tree.size(); ++i){
+            size_t parent = i | (i + 1);
+            if(parent < tree.size())
+                tree[parent] += tree[i];
+        }
+    }
+
+    void add(size_t i, double delta){
+        for(; i < tree.size(); i |= i + 1)
+            tree[i] += delta;
+    }
+
+    double prefix(size_t i) const{ // sum of raw[0..i]
+        double total = 0;
+        for(long long j = (long long)min(i, tree.size() - 1); j >= 0; j = (j & (j + 1)) - 1)
+            total += tree[j];
+        return total;
+    }
+
+    double range(size_t lo, size_t hi) const{ // sum of raw[lo..hi]
+        if(tree.empty() || lo > hi)
+            return 0;
+        return prefix(hi) - (lo ? prefix(lo - 1) : 0);
+    }
+};
+
+// Count and sum of values falling in fixed-width buckets over [lo, hi]; values outside are clamped to the end buckets,
+// and ranges are answered at bucket granularity.
+class RangeHistogram{
+    double lo, width;
+    size_t buckets;
+    Fenwick counts, sums;
+public:
+    RangeHistogram(double lo, double hi, double width, const vector<double> &values = {})
+        : lo(lo), width(width), buckets((size_t)((hi - lo) / width) + 1){
+        vector<double> c(buckets, 0.0), s(buckets, 0.0);
+        for(double v : values){
+            c[bucketOf(v)] += 1;
+            s[bucketOf(v)] += v;
+        }
+        counts = Fenwick(c);
+        sums = Fenwick(s);
+    }
+
+    size_t bucketOf(double v) const{
+        if(v <= lo)
+            return 0;
+        return min(buckets - 1, (size_t)((v - lo) / width));
+    }
+
+    void add(double v){
+        counts.add(bucketOf(v), 1);
+        sums.add(bucketOf(v), v);
+    }
+
+    void remove(double v){
+        counts.add(bucketOf(v), -1);
+        sums.add(bucketOf(v), -v);
+    }
+
+    size_t countBetween(double a, double b) const{
+        return (size_t)llround(counts.range(bucketOf(a), bucketOf(b)));
+    }
+
+    double sumBetween(double a, double b) const{
+        return sums.range(bucketOf(a), bucketOf(b));
+    }
+};
+
+// Student ages (1 year buckets) and Teacher salaries ($1000 buckets up to $1M), kept current through the change feed.
+// Writing Student::age directly (it is a public field) bypasses the feed; assignment and construction don't.
+// Only people it has counted are ever subtracted: whoever else the feed reports leaving (another roster's people,
+// or ones that existed before it was built and weren't passed in) never touches the counts.
+class RosterHistograms : public IRosterObserver{
+    unordered_set<const Student*> countedStudents;
+    unordered_set<const Teacher*> countedTeachers;
+public:
+    RangeHistogram ages;
+    RangeHistogram salaries;
+
+    RosterHistograms(const vector<Student*> &students, const vector<Teacher*> &teachers)
+        : countedStudents(students.begin(), students.end()), countedTeachers(teachers.begin(), teachers.end()),
+          ages(0, 150, 1, valuesOf(students, [](const Student &s){ return (double)s.age; })),
+          salaries(0, 1000000, 1000, valuesOf(teachers, [](const Teacher &t){ return t.getSalary(); })){
+        RosterFeed::subscribe(this);
+    }
+
+    ~RosterHistograms() override{
+        RosterFeed::unsubscribe(this);
+    }
+
+    void studentAdded(const Student &s) override{
+        if(countedStudents.insert(&s).second)
+            ages.add(s.age);
+    }
+    void studentRemoved(const Student &s) override{
+        if(countedStudents.erase(&s))
+            ages.remove(s.age);
+    }
+    void teacherAdded(const Teacher &t) override{
+        if(countedTeachers.insert(&t).second)
+            salaries.add(t.getSalary());
+    }
+    void teacherRemoved(const Teacher &t) override{
+        if(countedTeachers.erase(&t))
+            salaries.remove(t.getSalary());
+    }
+    void salaryChanged(const Teacher &t, double oldSalary) override{
+        if(!countedTeachers.count(&t))
+            return;
+        salaries.remove(oldSalary);
+        salaries.add(t.getSalary());
+    }
+
+private:
+    template<typename T, typename Fn>
+    static vector<double> valuesOf(const vector<T*> &rows, Fn value){
+        vector<double> out;
+        out.reserve(rows.size());
+        for(const T *row : rows)
+            out.push_back(value(*row));
+        return out;
+    }
+};
+
+// ======= BLOOM FILTER FOR IDS =======
+// Blocked Bloom filter: every key lives in a single 64-byte block (one cache line) and sets one bit in each of the
+// block's 8 words, so a lookup is one cache miss and an 8-lane AND that compilers turn into SIMD.
+class BlockedBloom{
+    static const int wordsPerBlock = 8;
+    vector<uint64_t> words;
+    size_t blocks;
+
+    static uint64_t mix(uint64_t x){ // splitmix64 finalizer
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    const uint64_t* blockOf(uint64_t h) const{
+        return &words[(size_t)(((h >> 32) * blocks) >> 32) * wordsPerBlock];
+    }
+
+    static void masksOf(uint64_t h, uint64_t mask[wordsPerBlock]){
+        static const uint32_t salt[wordsPerBlock] = {0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+                                                     0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u};
+        for(int i = 0; i < wordsPerBlock; ++i)
+            mask[i] = 1ull << (((uint32_t)h * salt[i]) >> 26);
+    }
+public:
+    // Sized for `expected` keys at the requested false-positive rate
+    BlockedBloom(size_t expected, double falsePositiveRate = 0.01){
+        // With k = 8 bits per key: p = (1 - e^(-k/b))^k, solved for b bits per key
+        double bitsPerKey = -wordsPerBlock / log(1 - pow(falsePositiveRate, 1.0 / wordsPerBlock));
+        blocks = max<size_t>(1, (size_t)ceil(max<size_t>(expected, 1) * bitsPerKey / (64 * wordsPerBlock)));
+        words.assign(blocks * wordsPerBlock, 0);
+    }
+
+    // Safe to call from several threads at once: bits are only ever set, with an atomic OR
+    void insert(int key){
+        uint64_t h = mix((uint32_t)key), mask[wordsPerBlock];
+        masksOf(h, mask);
+        uint64_t *block = const_cast<uint64_t*>(blockOf(h));
+        for(int i = 0; i < wordsPerBlock; ++i)
+            __atomic_fetch_or(&block[i], mask[i], __ATOMIC_RELAXED);
+    }
+
+    // false = definitely absent, true = maybe present. Plain loads so the loop vectorises: it must not run
+    // alongside insert() (IdRegistry keeps them apart with its lock)
+    bool mayContain(int key) const{
+        uint64_t h = mix((uint32_t)key), mask[wordsPerBlock];
+        masksOf(h, mask);
+        const uint64_t *block = blockOf(h);
+        uint64_t missing = 0;
+        for(int i = 0; i < wordsPerBlock; ++i) // no early exit, so all 8 lanes are one vector AND
+            missing |= ~block[i] & mask[i];
+        return missing == 0;
+    }
+
+    // Appends the keys that may be present to `maybe`. Branch-free, so a batch of independent probes can all be
+    // in flight at once instead of each mispredicted branch flushing the ones behind it.
+    void filterBatch(const int *keys, size_t n, vector<int> &maybe) const{
+        size_t base = maybe.size(), kept = 0;
+        maybe.resize(base + n);
+        for(size_t i = 0; i < n; ++i){
+            maybe[base + kept] = keys[i];
+            kept += mayContain(keys[i]);
+        }
+        maybe.resize(base + kept);
+    }
+
+    size_t bytes() const{
+        return words.size() * sizeof(uint64_t);
+    }
+};
+
+class Roster;
+
+// Ids of every live Teacher and Student. The exact index is only consulted when the filter says "maybe",
+// which for an ingest stream of mostly new ids is rarely. Bloom filters can't forget, so removed ids stay
+// in the filter until it is rebuilt when it outgrows its sizing. Lookups share a reader lock; the change feed's
+// adds and removes (from any thread) and the rebuild take it exclusively.
+// It starts from a roster's people (or from nobody) and then hears about everyone constructed; a removal only
+// takes out an id this registry added for that same person, so someone else leaving with the same id can't.
+class IdRegistry : public IRosterObserver{
+    double falsePositiveRate;
+    size_t capacity;
+    mutable shared_mutex lock; // guards filter, live, subjects and inserted
+    BlockedBloom filter;
+    unordered_multiset<int> live; // multiset: a TA shows up as both a Student and a Teacher with one id
+    unordered_set<const void*> subjects; // the Student/Teacher each id in live was added for
+    size_t inserted = 0;
+public:
+    atomic<size_t> lookups{0}, exactChecks{0};
+
+    explicit IdRegistry(size_t expected = 1024, double falsePositiveRate = 0.01)
+        : falsePositiveRate(falsePositiveRate), capacity(max<size_t>(expected, 1)), filter(capacity, falsePositiveRate){
+        RosterFeed::subscribe(this);
+    }
+
+    // Everyone already in the roster, then whoever is constructed later
+    explicit IdRegistry(const Roster &roster, size_t expected = 1024, double falsePositiveRate = 0.01);
+
+    ~IdRegistry() override{
+        RosterFeed::unsubscribe(this);
+    }
+
+    void add(const void *subject, int id){
+        unique_lock<shared_mutex> writing(lock);
+        if(!subjects.insert(subject).second)
+            return;
+        live.insert(id);
+        if(++inserted > capacity){
+            // Rebuild at twice the size from the ids that are still alive
+            capacity *= 2;
+            filter = BlockedBloom(capacity, falsePositiveRate);
+            for(int x : live)
+                filter.insert(x);
+            inserted = live.size();
+        }
+        else
+            filter.insert(id);
+    }
+
+    void remove(const void *subject, int id){
+        unique_lock<shared_mutex> writing(lock);
+        if(!subjects.erase(subject))
+            return;
+        auto it = live.find(id);
+        if(it != live.end())
+            live.erase(it);
+    }
+
+    bool exists(int id){
+        ++lookups;
+        shared_lock<shared_mutex> reading(lock);
+        if(!filter.mayContain(id))
+            return false;
+        ++exactChecks;
+        return live.count(id) > 0;
+    }
+
+    void teacherAdded(const Teacher &t) override { add(&t, t.id); }
+    void teacherRemoved(const Teacher &t) override { remove(&t, t.id); }
+    void studentAdded(const Student &s) override { add(&s, s.id); }
+    void studentRemoved(const Student &s) override { remove(&s, s.id); }
+};
+
+// ======= NAME SEARCH INDEX =======
+// Exact, prefix and substring lookups over Student::name and Teacher::name (a TA is indexed under both).
+// Exact: hash map. Prefix: sorted array plus a small sorted delta for incremental inserts. Substring: trigram
+// posting lists - the rarest trigram of the pattern gives the candidates, which are then verified with
+// string::find (memchr/memcmp underneath, which the C library runs with SIMD).
+class NameIndex : public IRosterObserver{
+public:
+    struct Entry{
+        string name;
+        const IPerson *who;
+        bool alive;
+    };
+
+    NameIndex(const vector<Student*> &students = {}, const vector<Teacher*> &teachers = {}){
+        entries.reserve(students.size() + teachers.size());
+        for(const Student *s : students)
+            append(s->name, s);
+        for(const Teacher *t : teachers)
+            append(t->name, t);
+        sorted.reserve(entries.size());
+        for(uint32_t doc = 0; doc < entries.size(); ++doc)
+            sorted.emplace_back(entries[doc].name, doc);
+        sort(sorted.begin(), sorted.end());
+        RosterFeed::subscribe(this);
+    }
+
+    ~NameIndex() override{
+        RosterFeed::unsubscribe(this);
+    }
+
+    void add(const string &name, const IPerson *who){
+        uint32_t doc = append(name, who);
+        pending.emplace(name, doc);
+        if(pending.size() > 1024 && pending.size() * 8 > sorted.size())
+            compact();
+    }
+
+    void remove(const string &name, const IPerson *who){
+        auto it = exact.find(name);
+        if(it == exact.end())
+            return;
+        for(uint32_t doc : it->second)
+            if(entries[doc].alive && entries[doc].who == who){
+                entries[doc].alive = false;
+                if(++dead > 256 && dead * 4 > entries.size())
+                    purge();
+                return;
+            }
+    }
+
+    vector<const Entry*> findExact(const string &name) const{
+        vector<const Entry*> out;
+        auto it = exact.find(name);
+        if(it != exact.end())
+            for(uint32_t doc : it->second)
+                keep(doc, out);
+        return out;
+    }
+
+    vector<const Entry*> findPrefix(const string &prefix) const{
+        vector<const Entry*> out;
+        auto startsWith = [&](const string &name){ return name.compare(0, prefix.size(), prefix) == 0; };
+        for(auto it = lower_bound(sorted.begin(), sorted.end(), make_pair(prefix, (uint32_t)0)); it != sorted.end() && startsWith(it->first); ++it)
+            keep(it->second, out);
+        for(auto it = pending.lower_bound(prefix); it != pending.end() && startsWith(it->first); ++it)
+            keep(it->second, out);
+        return out;
+    }
+
+    vector<const Entry*> findSubstring(const string &pattern) const{
+        vector<const Entry*> out;
+        if(pattern.size() < 3){ // no trigram to narrow it down with
+            for(uint32_t doc = 0; doc < entries.size(); ++doc)
+                if(entries[doc].name.find(pattern) != string::npos)
+                    keep(doc, out);
+            return out;
+        }
+        const vector<uint32_t> *rarest = nullptr;
+        for(size_t i = 0; i + 3 <= pattern.size(); ++i){
+            auto it = trigrams.find(trigramAt(pattern, i));
+            if(it == trigrams.end())
+                return out; // some trigram occurs in no name at all
+            if(!rarest || it->second.size() < rarest->size())
+                rarest = &it->second;
+        }
+        for(uint32_t doc : *rarest)
+            if(entries[doc].name.find(pattern) != string::npos)
+                keep(doc, out);
+        return out;
+    }
+
+    void studentAdded(const Student &s) override { add(s.name, &s); }
+    void studentRemoved(const Student &s) override { remove(s.name, &s); }
+    void teacherAdded(const Teacher &t) override { add(t.name, &t); }
+    void teacherRemoved(const Teacher &t) override { remove(t.name, &t); }
+
+private:
+    vector<Entry> entries;                              // doc id -> entry; removed entries are marked dead until purge()
+    unordered_map<string, vector<uint32_t>> exact;
+    vector<pair<string, uint32_t>> sorted;              // bulk-built prefix array
+    multimap<string, uint32_t> pending;                 // inserted since the last compaction
+    unordered_map<uint32_t, vector<uint32_t>> trigrams; // posting lists, ascending doc ids
+    size_t dead = 0;
+
+    static uint32_t trigramAt(const string &s, size_t i){
+        return (uint32_t)(unsigned char)s[i] << 16 | (uint32_t)(unsigned char)s[i + 1] << 8 | (unsigned char)s[i + 2];
+    }
+
+    uint32_t append(const string &name, const IPerson *who){
+        uint32_t doc = (uint32_t)entries.size();
+        entries.push_back({name, who, true});
+        exact[name].push_back(doc);
+        for(size_t i = 0; i + 3 <= name.size(); ++i){
+            vector<uint32_t> &posting = trigrams[trigramAt(name, i)];
+            if(posting.empty() || posting.back() != doc) // a trigram repeated within one name is posted once
+                posting.push_back(doc);
+        }
+        return doc;
+    }
+
+    // Folds the delta into the sorted array and drops dead entries from it
+    void compact(){
+        vector<pair<string, uint32_t>> fresh(pending.begin(), pending.end()); // already in order
+        vector<pair<string, uint32_t>> merged;
+        merged.reserve(sorted.size() + fresh.size());
+        std::merge(sorted.begin(), sorted.end(), fresh.begin(), fresh.end(), back_inserter(merged));
+        merged.erase(remove_if(merged.begin(), merged.end(), [&](const pair<string, uint32_t> &e){ return !entries[e.second].alive; }), merged.end());
+        sorted.swap(merged);
+        pending.clear();
+    }
+
+    // Once a quarter of the entries are dead: drops them and renumbers the live ones 0..n-1 everywhere a doc id is
+    // held. The renumbering keeps the order, so posting lists stay ascending and the prefix array stays sorted.
+    void purge(){
+        compact();
+        const uint32_t gone = UINT32_MAX;
+        vector<uint32_t> renumber(entries.size(), gone);
+        vector<Entry> alive;
+        alive.reserve(entries.size() - dead);
+        for(uint32_t doc = 0; doc < entries.size(); ++doc)
+            if(entries[doc].alive){
+                renumber[doc] = (uint32_t)alive.size();
+                alive.push_back(move(entries[doc]));
+            }
+        auto rewrite = [&](auto &lists){
+            for(auto it = lists.begin(); it != lists.end();){
+                vector<uint32_t> &docs = it->second;
+                size_t kept = 0;
+                for(uint32_t doc : docs)
+                    if(renumber[doc] != gone)
+                        docs[kept++] = renumber[doc];
+                docs.resize(kept);
+                it = kept ? next(it) : lists.erase(it);
+            }
+        };
+        rewrite(exact);
+        rewrite(trigrams);
+        for(auto &e : sorted) // compact() already dropped the dead ones
+            e.second = renumber[e.second];
+        entries.swap(alive);
+        dead = 0;
+    }
+
+    void keep(uint32_t doc, vector<const Entry*> &out) const{
+        if(entries[doc].alive)
+            out.push_back(&entries[doc]);
+    }
+};
+
+// ======= DEPARTMENT PERFECT HASHING =======
+// The known departments get a collision-free slot from a hash seed that is searched for at compile time, so a dept
+// lookup is one short hash, one table read and one compare. Departments outside the list are interned at runtime
+// and numbered after the known ones; either way a dept becomes a small dense id that can index an array.
+constexpr string_view knownDepts[] = {"CSE", "MAE", "MPAc", "ECE", "EE", "ME", "CE", "PHY", "MATH", "CHEM", "BIO", "ECON"};
+constexpr int knownDeptCount = sizeof(knownDepts) / sizeof(knownDepts[0]);
+constexpr uint32_t deptSlots = 32; // power of two, comfortably above knownDeptCount
+
+constexpr uint32_t deptHash(string_view s, uint32_t seed){ // FNV-1a, seeded
+    uint32_t h = 2166136261u ^ seed;
+    for(char c : s)
+        h = (h ^ (unsigned char)c) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+constexpr uint32_t findDeptSeed(){
+    for(uint32_t seed = 1; seed < 100000; ++seed){
+        bool used[deptSlots] = {};
+        bool perfect = true;
+        for(int i = 0; i < knownDeptCount && perfect; ++i){
+            uint32_t slot = deptHash(knownDepts[i], seed) & (deptSlots - 1);
+            perfect = !used[slot];
+            used[slot] = true;
+        }
+        if(perfect)
+            return seed;
+    }
+    return 0;
+}
+
+constexpr uint32_t deptSeed = findDeptSeed();
+static_assert(deptSeed != 0, "no perfect hash seed for knownDepts - grow deptSlots");
+
+struct DeptSlotTable{
+    int8_t slot[deptSlots];
+};
+
+constexpr DeptSlotTable buildDeptSlots(){
+    DeptSlotTable t = {};
+    for(uint32_t i = 0; i < deptSlots; ++i)
+        t.slot[i] = -1;
+    for(int i = 0; i < knownDeptCount; ++i)
+        t.slot[deptHash(knownDepts[i], deptSeed) & (deptSlots - 1)] = (int8_t)i;
+    return t;
+}
+
+constexpr DeptSlotTable deptSlotTable = buildDeptSlots();
+
+class DeptRegistry{
+    static shared_mutex lock;
+    static unordered_multimap<uint32_t, int> interned; // full hash of an unknown dept -> id >= knownDeptCount
+    static vector<string> internedNames;
+
+    static int findInterned(uint32_t h, string_view dept){
+        auto range = interned.equal_range(h);
+        for(auto it = range.first; it != range.second; ++it)
+            if(internedNames[it->second - knownDeptCount] == dept)
+                return it->second;
+        return -1;
+    }
+public:
+    static int id(string_view dept){
+        uint32_t h = deptHash(dept, deptSeed);
+        int known = deptSlotTable.slot[h & (deptSlots - 1)];
+        if(known >= 0 && knownDepts[known] == dept)
+            return known;
+        {
+            shared_lock<shared_mutex> reading(lock);
+            int found = findInterned(h, dept);
+            if(found >= 0)
+                return found;
+        }
+        unique_lock<shared_mutex> writing(lock);
+        int found = findInterned(h, dept); // someone may have interned it in between
+        if(found >= 0)
+            return found;
+        int fresh = knownDeptCount + (int)internedNames.size();
+        internedNames.emplace_back(dept);
+        interned.emplace(h, fresh);
+        return fresh;
+    }
+
+    // Like id(), but -1 for a dept nobody has used instead of interning it: for lookups driven by outside input
+    static int find(string_view dept){
+        uint32_t h = deptHash(dept, deptSeed);
+        int known = deptSlotTable.slot[h & (deptSlots - 1)];
+        if(known >= 0 && knownDepts[known] == dept)
+            return known;
+        shared_lock<shared_mutex> reading(lock);
+        return findInterned(h, dept);
+    }
+
+    static string name(int id){
+        if(id < knownDeptCount)
+            return string(knownDepts[id]);
+        shared_lock<shared_mutex> reading(lock);
+        return internedNames[id - knownDeptCount];
+    }
+};
+
+shared_mutex DeptRegistry::lock;
+unordered_multimap<uint32_t, int> DeptRegistry::interned;
+vector<string> DeptRegistry::internedNames;
+
+// Dept-keyed map backed by a plain array indexed by dept id
+template<typename V>
+class DeptMap{
+    vector<V> values;
+public:
+    DeptMap(): values(knownDeptCount) {}
+
+    V& operator[](string_view dept){
+        return at(DeptRegistry::id(dept));
+    }
+
+    V& at(int deptId){
+        if(deptId >= (int)values.size())
+            values.resize(deptId + 1);
+        return values[deptId];
+    }
+
+    // nullptr for a dept this map has no slot for yet
+    const V* find(string_view dept) const{
+        int deptId = DeptRegistry::find(dept);
+        return deptId >= 0 && deptId < (int)values.size() ? &values[deptId] : nullptr;
+    }
+
+    void clear(){
+        values.assign(knownDeptCount, V());
+    }
+
+    template<typename Fn>
+    void forEach(Fn fn) const{ // fn(deptName, value)
+        for(int i = 0; i < (int)values.size(); ++i)
+            fn(DeptRegistry::name(i), values[i]);
+    }
+};
+
+// Grouped on the dense dept id rather than the dept string: hashing an int, and no string copied per row
+DeptMap<Aggregate> salaryByDept(const vector<Teacher*> &teachers){
+    DeptMap<Aggregate> byDept;
+    for(auto &g : groupBy<int>(teachers, [](const Teacher &t){ return DeptRegistry::id(t.dept); }, [](const Teacher &t){ return t.getSalary(); }))
+        byDept.at(g.first) = g.second;
+    return byDept;
+}
+
+// ======= ROSTER =======
+// Owns a population of people, one list per concrete class.
+class Roster{
+public:
+    vector<unique_ptr<Teacher>> teachers;
+    vector<unique_ptr<Student>> students;
+    vector<unique_ptr<GradStudent>> gradStudents;
+    vector<unique_ptr<TA>> tas;
+
+    size_t size() const{
+        return teachers.size() + students.size() + gradStudents.size() + tas.size();
+    }
+
+    // Every Teacher, TAs included - the shape the query helpers above take
+    vector<Teacher*> allTeachers() const{
+        vector<Teacher*> out;
+        out.reserve(teachers.size() + tas.size());
+        for(auto &t : teachers)
+            out.push_back(t.get());
+        for(auto &ta : tas)
+            out.push_back(&ta->asTeacher());
+        return out;
+    }
+
+    // Every Student, GradStudents and TAs included
+    vector<Student*> allStudents() const{
+        vector<Student*> out;
+        out.reserve(students.size() + gradStudents.size() + tas.size());
+        for(auto &s : students)
+            out.push_back(s.get());
+        for(auto &g : gradStudents)
+            out.push_back(g.get());
+        for(auto &ta : tas)
+            out.push_back(ta.get());
+        return out;
+    }
+};
+
+IdRegistry::IdRegistry(const Roster &roster, size_t expected, double falsePositiveRate)
+    : IdRegistry(max(expected, roster.size()), falsePositiveRate){
+    for(Teacher *t : roster.allTeachers())
+        add(t, t->id);
+    for(Student *s : roster.allStudents())
+        add(s, s->id);
+}
+
+// Everyone in the roster, for a change feed subscription that should not hear about other rosters
+RosterScope rosterScope(const Roster &roster){
+    RosterScope members;
+    members.reserve(roster.size());
+    for(Teacher *t : roster.allTeachers())
+        members.insert(t);
+    for(Student *s : roster.allStudents())
+        members.insert(s);
+    return members;
+}
+
+// Memory per class across a roster, plus what holding them costs: every person is a heap allocation of its own
+// (make_unique) and the four vectors keep a pointer each
+struct RosterFootprint{
+    Footprint teachers, students, gradStudents, tas;
+    HeapUse holding; // the vectors' buffers, and malloc's overhead on each person's own allocation
+
+    size_t totalBytes() const{
+        return teachers.totalBytes() + students.totalBytes() + gradStudents.totalBytes() + tas.totalBytes()
+               + holding.bytes + holding.overhead;
+    }
+
+    void print(ostream &out) const{
+        for(const Footprint *f : {&teachers, &students, &gradStudents, &tas})
+            if(f->objects)
+                f->print(out);
+        size_t people = teachers.objects + students.objects + gradStudents.objects + tas.objects;
+        out<<"roster: "<<people<<" people, "<<totalBytes() / 1024<<" KB ("<<fixed<<setprecision(1)
+           <<(double)totalBytes() / max<size_t>(people, 1)<<" B/person), of which holding them "<<(holding.bytes + holding.overhead) / 1024
+           <<" KB"<<defaultfloat<<setprecision(6)<<endl;
+    }
+};
+
+RosterFootprint rosterFootprint(const Roster &roster){
+    RosterFootprint report;
+    auto add = [&](auto &people, Footprint &into){
+        for(auto &person : people)
+            person->addFootprint(into);
+        report.holding.bytes += people.capacity() * sizeof(people[0]);
+        report.holding.overhead += people.capacity() ? allocationBytes(people.capacity() * sizeof(people[0])) - people.capacity() * sizeof(people[0]) : 0;
+        report.holding.overhead += into.objects * (allocationBytes(into.objectBytes) - into.objectBytes);
+        report.holding.allocations += (people.capacity() > 0) + into.objects;
+    };
+    add(roster.teachers, report.teachers);
+    add(roster.students, report.students);
+    add(roster.gradStudents, report.gradStudents);
+    add(roster.tas, report.tas);
+    return report;
+}
+
+// ======= JSON EXPORT / IMPORT =======
+// Streaming in both directions: the writer fills a fixed buffer and flushes it to the stream, the reader pulls
+// fixed-size chunks and builds each person straight into the Roster. Neither ever holds a document tree.
+class JsonWriter{
+    ostream &out;
+    vector<char> buf;
+    size_t used = 0;
+
+    char* reserve(size_t n){ // n is small (a number, a short literal), always <= buf.size()
+        if(used + n > buf.size())
+            flush();
+        return &buf[used];
+    }
+public:
+    explicit JsonWriter(ostream &out, size_t bufferSize = 1 << 16): out(out), buf(max<size_t>(bufferSize, 64)) {}
+
+    ~JsonWriter(){
+        flush();
+    }
+
+    void flush(){
+        out.write(buf.data(), used);
+        used = 0;
+    }
+
+    void raw(const char *s, size_t n){
+        if(n > buf.size()){
+            flush();
+            out.write(s, n);
+            return;
+        }
+        memcpy(reserve(n), s, n);
+        used += n;
+    }
+
+    void raw(const char *s){
+        raw(s, strlen(s));
+    }
+
+    void number(long long v){
+        char *p = reserve(24);
+        used = to_chars(p, p + 24, v).ptr - buf.data();
+    }
+
+    void number(double v){
+        if(!isfinite(v)) // JSON has no NaN or Infinity; writing "nan" would give a file no reader accepts
+            throw runtime_error("JSON: cannot write non-finite number " + to_string(v));
+        char *p = reserve(32);
+        used = to_chars(p, p + 32, v).ptr - buf.data(); // shortest text that reads back to the same double
+    }
+
+    void boolean(bool v){
+        raw(v ? "true" : "false");
+    }
+
+    void str(const string &s){
+        raw("\"", 1);
+        size_t run = 0; // copy runs of plain characters in one go
+        for(size_t i = 0; i < s.size(); ++i){
+            unsigned char c = s[i];
+            if(c >= 0x20 && c != '"' && c != '\\')
+                continue;
+            raw(s.data() + run, i - run);
+            run = i + 1;
+            char esc[8];
+            int n = c == '"' ? snprintf(esc, sizeof esc, "\\\"") : c == '\\' ? snprintf(esc, sizeof esc, "\\\\")
+                  : c == '\n' ? snprintf(esc, sizeof esc, "\\n") : snprintf(esc, sizeof esc, "\\u%04x", c);
+            raw(esc, n);
+        }
+        raw(s.data() + run, s.size() - run);
+        raw("\"", 1);
+    }
+
+    void key(const char *k){ // ,"k": - every key after the first in an object
+        raw(",\"");
+        raw(k);
+        raw("\":");
+    }
+};
+
+void writeStudentFields(JsonWriter &w, const Student &s){
+    w.key("id"); w.number((long long)s.id);
+    w.key("age"); w.number((long long)s.age);
+    w.key("name"); w.str(s.name);
+    w.key("fees"); w.number(s.getFees());
+    w.key("size"); w.number((long long)s.size);
+    w.key("matrix");
+    w.raw("[");
+    for(int i = 0; i < s.size; ++i){
+        w.raw(i ? ",[" : "[");
+        for(int j = 0; j < s.size; ++j){
+            if(j)
+                w.raw(",", 1);
+            w.number((long long)s.matrix[i][j]);
+        }
+        w.raw("]");
+    }
+    w.raw("]");
+}
+
+void writeJson(ostream &out, const Roster &roster){
+    JsonWriter w(out);
+    bool first = true;
+    auto open = [&](const char *type){
+        w.raw(first ? "[\n{\"type\":\"" : ",\n{\"type\":\"");
+        w.raw(type);
+        w.raw("\"");
+        first = false;
+    };
+    for(auto &t : roster.teachers){
+        open("Teacher");
+        w.key("id"); w.number((long long)t->id);
+        w.key("name"); w.str(t->name);
+        w.key("dept"); w.str(t->dept);
+        w.key("salary"); w.number(t->getSalary());
+        w.raw("}");
+    }
+    for(auto &s : roster.students){
+        open("Student");
+        writeStudentFields(w, *s);
+        w.raw("}");
+    }
+    for(auto &g : roster.gradStudents){
+        open("GradStudent");
+        writeStudentFields(w, *g);
+        w.key("doingResearch"); w.boolean(g->doingResearch);
+        w.raw("}");
+    }
+    for(auto &ta : roster.tas){
+        open("TA");
+        writeStudentFields(w, *ta);
+        w.key("dept"); w.str(ta->asTeacher().dept);
+        w.key("salary"); w.number(ta->asTeacher().getSalary());
+        w.raw("}");
+    }
+    w.raw(first ? "[]\n" : "\n]\n");
+}
+
+class JsonReader{
+    istream &in;
+    vector<char> buf; // one spare byte: buf[end] is always 0, so scans stop there without bounds checks
+    size_t pos = 0, end = 0;
+    bool drained = false;
+
+    // At least n unread bytes, unless the input ends first. Numbers are parsed in place, so they get a full window.
+    void ensure(size_t n){
+        if(end - pos >= n || drained)
+            return;
+        memmove(buf.data(), buf.data() + pos, end - pos);
+        end -= pos;
+        pos = 0;
+        in.read(buf.data() + end, buf.size() - 1 - end);
+        size_t got = (size_t)in.gcount();
+        drained = got == 0;
+        end += got;
+        buf[end] = 0;
+    }
+
+    bool fill(){ // true while there is unread input
+        ensure(1);
+        return pos < end;
+    }
+
+    [[noreturn]] static void fail(const string &what){
+        throw runtime_error("JSON: " + what);
+    }
+public:
+    explicit JsonReader(istream &in, size_t bufferSize = 1 << 16): in(in), buf(max<size_t>(bufferSize, 256) + 1, 0) {}
+
+    int peek(){ // next non-blank character without consuming it, EOF at the end
+        for(;;){
+            if(!fill())
+                return EOF;
+            char c = buf[pos];
+            if(c != ' ' && c != '\n' && c != '\r' && c != '\t')
+                return (unsigned char)c;
+            ++pos;
+        }
+    }
+
+    char next(){
+        if(peek() == EOF)
+            fail("unexpected end of input");
+        return buf[pos++];
+    }
+
+    void expect(char c){
+        if(next() != c)
+            fail(string("expected '") + c + "'");
+    }
+
+    string readString(){
+        string out;
+        readString(out);
+        return out;
+    }
+
+    void readString(string &out){ // reuses out's storage
+        expect('"');
+        out.clear();
+        for(;;){
+            if(!fill())
+                fail("unterminated string");
+            // memchr finds the closing quote / next escape a vector register at a time
+            const char *start = &buf[pos];
+            size_t avail = end - pos;
+            const char *quote = (const char*)memchr(start, '"', avail);
+            size_t plain = quote ? quote - start : avail;
+            const char *slash = (const char*)memchr(start, '\\', plain);
+            if(slash)
+                plain = slash - start;
+            out.append(start, plain);
+            pos += plain;
+            if(slash){
+                ++pos;
+                out += unescape();
+            }
+            else if(quote){
+                ++pos;
+                return;
+            }
+        }
+    }
+
+    double readNumber(){
+        peek();
+        ensure(128);
+        char *start = &buf[pos], *stop = start + (*start == '-');
+        long long whole = 0; // whole numbers (most salaries and fees) don't need strtod
+        while(*stop >= '0' && *stop <= '9' && stop - start < 16)
+            whole = whole * 10 + (*stop++ - '0');
+        if(stop > start + (*start == '-') && *stop != '.' && *stop != 'e' && *stop != 'E' && !(*stop >= '0' && *stop <= '9')){
+            pos += stop - start;
+            return *start == '-' ? -(double)whole : (double)whole;
+        }
+        if(!(*start == '-' ? start[1] >= '0' && start[1] <= '9' : *start >= '0' && *start <= '9'))
+            fail("bad number"); // strtod alone would also take nan, inf and hex
+        double v = strtod(start, &stop);
+        if(stop == start || !isfinite(v))
+            fail("bad number");
+        pos += stop - start;
+        return v;
+    }
+
+    int readInt(){ // digits only, so it skips strtod
+        peek();
+        ensure(24);
+        bool negative = buf[pos] == '-';
+        pos += negative;
+        long long v = 0;
+        int digits = 0;
+        for(; buf[pos] >= '0' && buf[pos] <= '9' && digits <= 10; ++digits)
+            v = v * 10 + (buf[pos++] - '0');
+        if(negative)
+            v = -v;
+        if(digits == 0 || digits > 10 || v > INT_MAX || v < INT_MIN || buf[pos] == '.' || buf[pos] == 'e' || buf[pos] == 'E')
+            fail("expected an integer");
+        return (int)v;
+    }
+
+    bool readBool(){
+        return readLiteral() == "true";
+    }
+
+    void skipValue(){
+        int c = peek();
+        if(c == '"')
+            readString();
+        else if(c == '{' || c == '['){
+            char close = c == '{' ? '}' : ']';
+            next();
+            if(peek() == close){
+                next();
+                return;
+            }
+            do{
+                if(close == '}'){
+                    readString();
+                    expect(':');
+                }
+                skipValue();
+            } while(next() == ',');
+        }
+        else if(c == '-' || isdigit(c))
+            readNumber();
+        else
+            readLiteral();
+    }
+
+private:
+    string readLiteral(){ // true / false / null
+        string word;
+        peek();
+        while(fill() && isalpha((unsigned char)buf[pos]))
+            word += buf[pos++];
+        if(word != "true" && word != "false" && word != "null")
+            fail("unknown literal '" + word + "'");
+        return word;
+    }
+
+    string unescape(){
+        if(!fill())
+            fail("unterminated escape");
+        char c = buf[pos++];
+        switch(c){
+            case 'n': return "\n";
+            case 't': return "\t";
+            case 'r': return "\r";
+            case 'b': return "\b";
+            case 'f': return "\f";
+            case 'u': {
+                unsigned code = 0;
+                for(int i = 0; i < 4; ++i){
+                    if(!fill() || !isxdigit((unsigned char)buf[pos]))
+                        fail("bad \\u escape");
+                    char h = buf[pos++];
+                    code = code * 16 + (isdigit((unsigned char)h) ? h - '0' : (tolower(h) - 'a' + 10));
+                }
+                string utf8; // code points outside the BMP (surrogate pairs) are not combined
+                if(code < 0x80)
+                    utf8 += (char)code;
+                else if(code < 0x800)
+                    utf8 += {(char)(0xC0 | code >> 6), (char)(0x80 | (code & 0x3F))};
+                else
+                    utf8 += {(char)(0xE0 | code >> 12), (char)(0x80 | ((code >> 6) & 0x3F)), (char)(0x80 | (code & 0x3F))};
+                return utf8;
+            }
+            default: return string(1, c); // \" \\ \/
+        }
+    }
+};
+
+// Reads one person object and appends it to the roster
+void readPerson(JsonReader &r, Roster &roster){
+    string type, name, dept;
+    int id = 0, age = 18, size = 3;
+    double salary = 0, fees = 0;
+    bool doingResearch = true;
+    vector<int> matrix;
+
+    string key;
+    r.expect('{');
+    if(r.peek() != '}')
+        do{
+            r.readString(key);
+            r.expect(':');
+            if(key == "type") type = r.readString();
+            else if(key == "id") id = r.readInt();
+            else if(key == "age") age = r.readInt();
+            else if(key == "name") name = r.readString();
+            else if(key == "dept") dept = r.readString();
+            else if(key == "salary") salary = r.readNumber();
+            else if(key == "fees") fees = r.readNumber();
+            else if(key == "size"){
+                size = r.readInt();
+                if(size < 0 || size > Student::maxMatrixSize)
+                    throw runtime_error("JSON: matrix size " + to_string(size) + " of #" + to_string(id) + " is out of range");
+            }
+            else if(key == "doingResearch") doingResearch = r.readBool();
+            else if(key == "matrix"){
+                r.expect('[');
+                if(r.peek() != ']')
+                    do{
+                        r.expect('[');
+                        if(r.peek() != ']')
+                            do
+                                matrix.push_back(r.readInt());
+                            while(r.peek() == ',' && r.next());
+                        r.expect(']');
+                    } while(r.peek() == ',' && r.next());
+                r.expect(']');
+            }
+            else r.skipValue();
+        } while(r.peek() == ',' && r.next());
+    r.expect('}');
+
+    if(!matrix.empty() && matrix.size() != (size_t)size * size)
+        throw runtime_error("JSON: matrix of #" + to_string(id) + " is not size x size");
+    Student *student = nullptr;
+    if(type == "Teacher")
+        roster.teachers.push_back(make_unique<Teacher>(id, name, dept, salary));
+    else if(type == "Student"){
+        roster.students.push_back(make_unique<Student>(id, age, name, fees, size));
+        student = roster.students.back().get();
+    }
+    else if(type == "GradStudent"){
+        roster.gradStudents.push_back(make_unique<GradStudent>(id, age, name, fees, doingResearch, size));
+        student = roster.gradStudents.back().get();
+    }
+    else if(type == "TA"){
+        roster.tas.push_back(make_unique<TA>(id, age, name, fees, dept, salary, doingResearch, size));
+        student = roster.tas.back().get();
+    }
+    else
+        throw runtime_error("JSON: unknown type '" + type + "'");
+    if(student && !matrix.empty())
+        student->setMatrix(matrix);
+}
+
+void readJson(istream &in, Roster &roster){
+    JsonReader r(in);
+    r.expect('[');
+    if(r.peek() != ']')
+        do
+            readPerson(r, roster);
+        while(r.peek() == ',' && r.next());
+    r.expect(']');
+}
+
+// ======= ROSTER ROWS =======
+// One flat record per person for the analytic/binary formats below. kind: 'T'eacher, 'S'tudent, 'G'radStudent, T'A'.
+// Fields a class doesn't have are left at their defaults (Teachers have no age or fees, Students no dept or salary).
+struct RosterRow{
+    char kind = 'S';
+    int id = 0;
+    int age = 0;
+    string name;
+    string dept;
+    double salary = 0;
+    double fees = 0;
+    bool doingResearch = false;
+    int size = 0;
+    vector<int> matrix; // row-major; left empty while the matrix still follows the constructor's i + j pattern
+};
+
+RosterRow rowOf(const Teacher &t){
+    RosterRow r;
+    r.kind = 'T';
+    r.id = t.id;
+    r.name = t.name;
+    r.dept = t.dept;
+    r.salary = t.getSalary();
+    return r;
+}
+
+RosterRow rowOf(const Student &s, char kind = 'S'){
+    RosterRow r;
+    r.kind = kind;
+    r.id = s.id;
+    r.age = s.age;
+    r.name = s.name;
+    r.fees = s.getFees();
+    r.size = s.size;
+    bool standard = true;
+    for(int i = 0; i < s.size && standard; ++i)
+        for(int j = 0; j < s.size && standard; ++j)
+            standard = s.matrix[i][j] == i + j;
+    if(!standard)
+        for(int i = 0; i < s.size; ++i)
+            r.matrix.insert(r.matrix.end(), s.matrix[i], s.matrix[i] + s.size);
+    return r;
+}
+
+// fn(const RosterRow&, const Student*, const Teacher*) for every person with its parts (null where it has none),
+// one row built at a time - for writers that should not hold them all
+template<typename Fn>
+void forEachPerson(const Roster &roster, Fn fn){
+    for(auto &t : roster.teachers)
+        fn(rowOf(*t), nullptr, t.get());
+    for(auto &s : roster.students)
+        fn(rowOf(*s), s.get(), nullptr);
+    for(auto &g : roster.gradStudents){
+        RosterRow row = rowOf(*g, 'G');
+        row.doingResearch = g->doingResearch;
+        fn(row, g.get(), nullptr);
+    }
+    for(auto &ta : roster.tas){
+        RosterRow row = rowOf(*ta, 'A');
+        row.dept = ta->asTeacher().dept;
+        row.salary = ta->asTeacher().getSalary();
+        fn(row, ta.get(), &ta->asTeacher());
+    }
+}
+
+// fn(const RosterRow&) for every person
+template<typename Fn>
+void forEachRow(const Roster &roster, Fn fn){
+    forEachPerson(roster, [&](const RosterRow &row, const Student*, const Teacher*){ fn(row); });
+}
+
+vector<RosterRow> rosterRows(const Roster &roster){
+    vector<RosterRow> rows;
+    rows.reserve(roster.size());
+    forEachRow(roster, [&](const RosterRow &row){ rows.push_back(row); });
+    return rows;
+}
+
+// Builds the person a row describes and appends it to the roster
+void addRow(Roster &roster, const RosterRow &r){
+    Student *student = nullptr;
+    switch(r.kind){
+        case 'T':
+            roster.teachers.push_back(make_unique<Teacher>(r.id, r.name, r.dept, r.salary));
+            return;
+        case 'S':
+            roster.students.push_back(make_unique<Student>(r.id, r.age, r.name, r.fees, r.size));
+            student = roster.students.back().get();
+            break;
+        case 'G':
+            roster.gradStudents.push_back(make_unique<GradStudent>(r.id, r.age, r.name, r.fees, r.doingResearch, r.size));
+            student = roster.gradStudents.back().get();
+            break;
+        case 'A':
+            roster.tas.push_back(make_unique<TA>(r.id, r.age, r.name, r.fees, r.dept, r.salary, r.doingResearch, r.size));
+            student = roster.tas.back().get();
+            break;
+        default:
+            throw runtime_error(string("unknown roster row kind '") + r.kind + "'");
+    }
+    if(!r.matrix.empty())
+        student->setMatrix(r.matrix);
+}
+
+// Little helpers for building and parsing binary buffers (host byte order)
+class ByteWriter{
+public:
+    vector<uint8_t> bytes;
+
+    template<typename T>
+    void put(const T &v){
+        const uint8_t *p = (const uint8_t*)&v;
+        bytes.insert(bytes.end(), p, p + sizeof(T));
+    }
+
+    void varint(uint64_t v){ // 7 bits per byte, high bit = more to come
+        while(v >= 0x80){
+            bytes.push_back((uint8_t)(v | 0x80));
+            v >>= 7;
+        }
+        bytes.push_back((uint8_t)v);
+    }
+
+    void str(const string &s){
+        varint(s.size());
+        bytes.insert(bytes.end(), s.begin(), s.end());
+    }
+
+    // Every value in `width` bits, LSB first
+    void bits(const vector<uint32_t> &values, int width){
+        uint64_t acc = 0;
+        int filled = 0;
+        for(uint32_t v : values){
+            acc |= (uint64_t)v << filled;
+            filled += width;
+            while(filled >= 8){
+                bytes.push_back((uint8_t)acc);
+                acc >>= 8;
+                filled -= 8;
+            }
+        }
+        if(filled > 0)
+            bytes.push_back((uint8_t)acc);
+    }
+};
+
+class ByteReader{
+    const uint8_t *p, *end;
+public:
+    ByteReader(const uint8_t *data, size_t n): p(data), end(data + n) {}
+
+    void need(size_t n) const{
+        if((size_t)(end - p) < n)
+            throw runtime_error("truncated binary data");
+    }
+
+    template<typename T>
+    T get(){
+        need(sizeof(T));
+        T v;
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
+    }
+
+    uint64_t varint(){
+        uint64_t v = 0;
+        for(int shift = 0; shift < 64; shift += 7){
+            uint8_t b = get<uint8_t>();
+            v |= (uint64_t)(b & 0x7F) << shift;
+            if(!(b & 0x80))
+                return v;
+        }
+        throw runtime_error("bad varint");
+    }
+
+    string str(){
+        size_t n = varint();
+        need(n);
+        string s((const char*)p, n);
+        p += n;
+        return s;
+    }
+
+    vector<uint32_t> bits(size_t count, int width){
+        vector<uint32_t> out(count);
+        need((count * width + 7) / 8);
+        uint64_t acc = 0;
+        int filled = 0;
+        uint32_t mask = width >= 32 ? UINT32_MAX : (1u << width) - 1;
+        for(size_t i = 0; i < count; ++i){
+            while(filled < width){
+                acc |= (uint64_t)*p++ << filled;
+                filled += 8;
+            }
+            out[i] = (uint32_t)acc & mask;
+            acc >>= width;
+            filled -= width;
+        }
+        return out;
+    }
+
+    bool done() const{
+        return p == end;
+    }
+
+    size_t remaining() const{
+        return end - p;
+    }
+};
+
+inline uint64_t zigzag(int64_t v){ return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t unzigzag(uint64_t v){ return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+inline int bitWidth(uint32_t maxValue){
+    int w = 0;
+    while(w < 32 && (maxValue >> w))
+        ++w;
+    return w;
+}
+
+// ======= COLUMNAR EXPORT =======
+// File = "OOPSCOL1" | row group column chunks ... | footer | footer offset (uint64) | "OOPSCOL1"
+// The footer describes the schema and, per row group, the row count, min/max statistics and where each column
+// chunk is, so a reader can skip whole row groups and read only the columns a query touches.
+// Encodings: kind raw bytes, id delta+zigzag varint, age frame-of-reference bit-packed, name/dept dictionary with
+// bit-packed codes, salary/fees raw doubles, doingResearch 1 bit. Student matrices are not part of this export.
+enum RosterColumn { ColKind, ColId, ColAge, ColName, ColDept, ColSalary, ColFees, ColResearch, ColumnCount };
+const char *const rosterColumnNames[ColumnCount] = {"kind", "id", "age", "name", "dept", "salary", "fees", "doingResearch"};
+const char *const rosterColumnEncodings[ColumnCount] = {"plain", "delta-varint", "for-bitpacked", "dictionary",
+                                                         "dictionary", "plain", "plain", "bitpacked"};
+
+struct RowGroupStats{
+    uint64_t rows = 0;
+    int minId = INT_MAX, maxId = INT_MIN;
+    int minAge = INT_MAX, maxAge = INT_MIN;
+    double minSalary = numeric_limits<double>::infinity(), maxSalary = -numeric_limits<double>::infinity();
+    double minFees = numeric_limits<double>::infinity(), maxFees = -numeric_limits<double>::infinity();
+    uint64_t offset[ColumnCount] = {}, length[ColumnCount] = {};
+};
+
+// Predicate on the statistics-carrying columns; rows outside it are never returned
+struct RowFilter{
+    int minAge = INT_MIN, maxAge = INT_MAX;
+    double minSalary = -numeric_limits<double>::infinity(), maxSalary = numeric_limits<double>::infinity();
+
+    bool mayMatch(const RowGroupStats &g) const{
+        return g.maxAge >= minAge && g.minAge <= maxAge && g.maxSalary >= minSalary && g.minSalary <= maxSalary;
+    }
+
+    bool matches(const RosterRow &r) const{
+        return r.age >= minAge && r.age <= maxAge && r.salary >= minSalary && r.salary <= maxSalary;
+    }
+};
+
+vector<uint8_t> encodeDictionary(const vector<const string*> &values){
+    ByteWriter w;
+    unordered_map<string, uint32_t> codes;
+    vector<const string*> dict;
+    vector<uint32_t> coded;
+    coded.reserve(values.size());
+    for(const string *v : values){
+        auto it = codes.emplace(*v, (uint32_t)dict.size()).first;
+        if(it->second == dict.size())
+            dict.push_back(v);
+        coded.push_back(it->second);
+    }
+    w.varint(dict.size());
+    for(const string *d : dict)
+        w.str(*d);
+    int width = bitWidth(dict.empty() ? 0 : (uint32_t)dict.size() - 1);
+    w.put<uint8_t>((uint8_t)width);
+    w.bits(coded, width);
+    return w.bytes;
+}
+
+vector<string> decodeDictionary(ByteReader r, size_t rows){
+    vector<string> dict(r.varint());
+    for(string &d : dict)
+        d = r.str();
+    int width = r.get<uint8_t>();
+    vector<string> out;
+    out.reserve(rows);
+    for(uint32_t code : r.bits(rows, width)){
+        if(code >= dict.size())
+            throw runtime_error("dictionary code out of range");
+        out.push_back(dict[code]);
+    }
+    return out;
+}
+
+void writeColumnar(const string &path, const vector<RosterRow> &rows, size_t rowGroupSize = 1 << 16){
+    ofstream out(path, ios::binary);
+    if(!out)
+        throw runtime_error("cannot write " + path);
+    out.write("OOPSCOL1", 8);
+    uint64_t written = 8;
+    vector<RowGroupStats> groups;
+
+    for(size_t begin = 0; begin < rows.size(); begin += rowGroupSize){
+        size_t end = min(rows.size(), begin + rowGroupSize);
+        RowGroupStats g;
+        g.rows = end - begin;
+        for(size_t i = begin; i < end; ++i){
+            const RosterRow &r = rows[i];
+            g.minId = min(g.minId, r.id); g.maxId = max(g.maxId, r.id);
+            g.minAge = min(g.minAge, r.age); g.maxAge = max(g.maxAge, r.age);
+            g.minSalary = min(g.minSalary, r.salary); g.maxSalary = max(g.maxSalary, r.salary);
+            g.minFees = min(g.minFees, r.fees); g.maxFees = max(g.maxFees, r.fees);
+        }
+
+        vector<uint8_t> chunk[ColumnCount];
+        ByteWriter kind, id, age, salary, fees, research;
+        vector<uint32_t> ages, flags;
+        vector<const string*> names, depts;
+        int64_t previousId = 0;
+        for(size_t i = begin; i < end; ++i){
+            const RosterRow &r = rows[i];
+            kind.put<char>(r.kind);
+            id.varint(zigzag((int64_t)r.id - previousId));
+            previousId = r.id;
+            ages.push_back((uint32_t)((int64_t)r.age - g.minAge));
+            names.push_back(&r.name);
+            depts.push_back(&r.dept);
+            salary.put<double>(r.salary);
+            fees.put<double>(r.fees);
+            flags.push_back(r.doingResearch);
+        }
+        age.put<int32_t>(g.minAge); // frame of reference
+        int ageWidth = bitWidth((uint32_t)((int64_t)g.maxAge - g.minAge));
+        age.put<uint8_t>((uint8_t)ageWidth);
+        age.bits(ages, ageWidth);
+        research.bits(flags, 1);
+        chunk[ColKind] = kind.bytes;
+        chunk[ColId] = id.bytes;
+        chunk[ColAge] = age.bytes;
+        chunk[ColName] = encodeDictionary(names);
+        chunk[ColDept] = encodeDictionary(depts);
+        chunk[ColSalary] = salary.bytes;
+        chunk[ColFees] = fees.bytes;
+        chunk[ColResearch] = research.bytes;
+        for(int c = 0; c < ColumnCount; ++c){
+            g.offset[c] = written;
+            g.length[c] = chunk[c].size();
+            out.write((const char*)chunk[c].data(), chunk[c].size());
+            written += chunk[c].size();
+        }
+        groups.push_back(g);
+    }
+
+    ByteWriter footer;
+    footer.varint(ColumnCount);
+    for(int c = 0; c < ColumnCount; ++c){
+        footer.str(rosterColumnNames[c]);
+        footer.str(rosterColumnEncodings[c]);
+    }
+    footer.varint(groups.size());
+    for(const RowGroupStats &g : groups){
+        footer.varint(g.rows);
+        footer.put(g.minId); footer.put(g.maxId);
+        footer.put(g.minAge); footer.put(g.maxAge);
+        footer.put(g.minSalary); footer.put(g.maxSalary);
+        footer.put(g.minFees); footer.put(g.maxFees);
+        for(int c = 0; c < ColumnCount; ++c){
+            footer.varint(g.offset[c]);
+            footer.varint(g.length[c]);
+        }
+    }
+    out.write((const char*)footer.bytes.data(), footer.bytes.size());
+    out.write((const char*)&written, sizeof written);
+    out.write("OOPSCOL1", 8);
+    if(!out)
+        throw runtime_error("short write to " + path);
+}
+
+class ColumnarReader{
+    mutable ifstream in;
+public:
+    vector<RowGroupStats> groups;
+    mutable size_t groupsRead = 0, bytesRead = 0; // what the last scans actually touched
+
+    explicit ColumnarReader(const string &path): in(path, ios::binary){
+        char magic[8];
+        uint64_t footerOffset = 0;
+        in.seekg(-16, ios::end);
+        uint64_t footerEnd = (uint64_t)in.tellg();
+        in.read((char*)&footerOffset, sizeof footerOffset);
+        in.read(magic, 8);
+        if(!in || memcmp(magic, "OOPSCOL1", 8) != 0 || footerOffset > footerEnd)
+            throw runtime_error(path + " is not a columnar roster file");
+        vector<uint8_t> footer = readAt(footerOffset, footerEnd - footerOffset);
+        ByteReader r(footer.data(), footer.size());
+        size_t columns = r.varint();
+        for(size_t c = 0; c < columns; ++c){
+            string name = r.str(), encoding = r.str();
+            if(c >= ColumnCount || name != rosterColumnNames[c] || encoding != rosterColumnEncodings[c])
+                throw runtime_error(path + ": unsupported column " + name + "/" + encoding);
+        }
+        groups.resize(r.varint());
+        for(RowGroupStats &g : groups){
+            g.rows = r.varint();
+            g.minId = r.get<int>(); g.maxId = r.get<int>();
+            g.minAge = r.get<int>(); g.maxAge = r.get<int>();
+            g.minSalary = r.get<double>(); g.maxSalary = r.get<double>();
+            g.minFees = r.get<double>(); g.maxFees = r.get<double>();
+            for(int c = 0; c < ColumnCount; ++c){
+                g.offset[c] = r.varint();
+                g.length[c] = r.varint();
+            }
+        }
+        bytesRead = 0;
+    }
+
+    // fn(const RosterRow&) for every row matching the filter. Only the columns in `columns` (a bit per RosterColumn)
+    // are decoded - plus age and salary, which the filter needs; the rest are left at their defaults.
+    template<typename Fn>
+    void scan(const RowFilter &filter, uint32_t columns, Fn fn) const{
+        columns |= 1u << ColAge | 1u << ColSalary;
+        for(const RowGroupStats &g : groups){
+            if(!filter.mayMatch(g))
+                continue; // skipped on statistics alone
+            ++groupsRead;
+            vector<RosterRow> rows(g.rows);
+            for(int c = 0; c < ColumnCount; ++c)
+                if(columns >> c & 1)
+                    decodeColumn(g, (RosterColumn)c, rows);
+            for(const RosterRow &row : rows)
+                if(filter.matches(row))
+                    fn(row);
+        }
+    }
+
+private:
+    vector<uint8_t> readAt(uint64_t offset, uint64_t length) const{
+        vector<uint8_t> bytes(length);
+        in.clear();
+        in.seekg((streamoff)offset);
+        in.read((char*)bytes.data(), length);
+        if(!in)
+            throw runtime_error("truncated columnar file");
+        bytesRead += length;
+        return bytes;
+    }
+
+    void decodeColumn(const RowGroupStats &g, RosterColumn c, vector<RosterRow> &rows) const{
+        vector<uint8_t> bytes = readAt(g.offset[c], g.length[c]);
+        ByteReader r(bytes.data(), bytes.size());
+        size_t n = rows.size();
+        switch(c){
+            case ColKind:
+                for(RosterRow &row : rows) row.kind = r.get<char>();
+                break;
+            case ColId: {
+                int64_t id = 0;
+                for(RosterRow &row : rows) row.id = (int)(id += unzigzag(r.varint()));
+                break;
+            }
+            case ColAge: {
+                int base = r.get<int32_t>();
+                int width = r.get<uint8_t>();
+                vector<uint32_t> ages = r.bits(n, width);
+                for(size_t i = 0; i < n; ++i) rows[i].age = (int)(base + (int64_t)ages[i]);
+                break;
+            }
+            case ColName: {
+                vector<string> names = decodeDictionary(r, n);
+                for(size_t i = 0; i < n; ++i) rows[i].name = move(names[i]);
+                break;
+            }
+            case ColDept: {
+                vector<string> depts = decodeDictionary(r, n);
+                for(size_t i = 0; i < n; ++i) rows[i].dept = move(depts[i]);
+                break;
+            }
+            case ColSalary:
+                for(RosterRow &row : rows) row.salary = r.get<double>();
+                break;
+            case ColFees:
+                for(RosterRow &row : rows) row.fees = r.get<double>();
+                break;
+            case ColResearch: {
+                vector<uint32_t> flags = r.bits(n, 1);
+                for(size_t i = 0; i < n; ++i) rows[i].doingResearch = flags[i];
+                break;
+            }
+            default:
+                break;
+        }
+    }
+};
+
+// ======= FROZEN (COMPRESSED) ROSTER =======
+// Read-mostly form for cold cohorts. People are kept in kind order (teachers, students, grad students, TAs) and
+// every field lives in its own compact stream: ids as delta+zigzag varints, names and depts as dictionary codes,
+// ages frame-of-reference bit-packed, money as varint cents, and matrices as a single flag when they still follow
+// the constructor's i + j pattern (run-length encoded row deltas otherwise). Scans decode on the fly without
+// building objects; thaw() gives back an ordinary, mutable Roster.
+
+// Fixed-width bit-packed unsigned ints with O(1) random access
+class PackedInts{
+    vector<uint8_t> bytes;
+    int width = 0;
+public:
+    PackedInts() {}
+
+    PackedInts(const vector<uint32_t> &values, int width): width(width){
+        ByteWriter w;
+        w.bits(values, width);
+        bytes = move(w.bytes);
+        bytes.resize(bytes.size() + 8); // lets operator[] always load a whole 64-bit word
+        bytes.shrink_to_fit();
+    }
+
+    uint32_t operator[](size_t i) const{
+        if(width == 0)
+            return 0;
+        uint64_t bit = (uint64_t)i * width, word;
+        memcpy(&word, &bytes[bit >> 3], 8);
+        return (uint32_t)(word >> (bit & 7)) & (width >= 32 ? UINT32_MAX : (1u << width) - 1);
+    }
+
+    size_t memoryBytes() const{
+        return bytes.capacity();
+    }
+};
+
+// Distinct strings packed back to back in one buffer; code -> string_view
+class StringDict{
+    string blob;
+    vector<uint32_t> starts = {0};
+    unordered_map<string, uint32_t> codes; // only while building
+public:
+    uint32_t code(const string &s){
+        auto it = codes.emplace(s, (uint32_t)size()).first;
+        if(it->second == size()){
+            blob += s;
+            starts.push_back((uint32_t)blob.size());
+        }
+        return it->second;
+    }
+
+    void seal(){ // done adding: drop the lookup table and spare capacity
+        unordered_map<string, uint32_t>().swap(codes);
+        blob.shrink_to_fit();
+        starts.shrink_to_fit();
+    }
+
+    string_view operator[](uint32_t code) const{
+        return string_view(blob).substr(starts[code], starts[code + 1] - starts[code]);
+    }
+
+    uint32_t size() const{
+        return (uint32_t)starts.size() - 1;
+    }
+
+    size_t memoryBytes() const{
+        return blob.capacity() + starts.capacity() * sizeof(uint32_t);
+    }
+};
+
+// One person as seen by a scan over the frozen form; name/dept point into the dictionaries
+struct FrozenPerson{
+    char kind;
+    int id;
+    int age;
+    string_view name;
+    string_view dept;
+    double salary;
+    double fees;
+    bool doingResearch;
+    int size;
+};
+
+class FrozenRoster{
+    static constexpr char kinds[4] = {'T', 'S', 'G', 'A'};
+    size_t counts[4] = {};
+    StringDict nameDict, deptDict;
+    PackedInts nameCodes;   // every person
+    PackedInts deptCodes;   // teachers, then TAs
+    int ageBase = 0;
+    PackedInts ages;        // students, grad students, TAs
+    PackedInts research;    // grad students
+    vector<uint8_t> ids;    // every person, delta + zigzag varint
+    vector<uint8_t> money;  // T: salary, S/G: fees, A: fees then salary
+    vector<uint8_t> matrices; // students/grads/TAs: size, byte length, then 0 (i + j) or 1 + RLE rows
+
+    static void putMoney(ByteWriter &w, double v){
+        // zigzag(cents) << 1 must not lose the top bit: |cents| < 2^62. Anything bigger (or NaN) takes the escape.
+        long long cents = fabs(v) < 4e16 ? llround(v * 100) : 0;
+        if(fabs(v) < 4e16 && (double)cents / 100 == v)
+            w.varint(zigzag(cents) << 1);
+        else{ // not a whole number of cents, or too big for the tagged varint: escape and keep the exact double
+            w.varint(1);
+            w.put<double>(v);
+        }
+    }
+
+    static double getMoney(ByteReader &r){
+        uint64_t x = r.varint();
+        return x & 1 ? r.get<double>() : (double)unzigzag(x >> 1) / 100;
+    }
+
+    static void putMatrix(ByteWriter &w, const Student &s){
+        ByteWriter m;
+        bool standard = true;
+        for(int i = 0; i < s.size && standard; ++i)
+            for(int j = 0; j < s.size && standard; ++j)
+                standard = s.matrix[i][j] == i + j;
+        m.put<uint8_t>(!standard);
+        if(!standard)
+            for(int i = 0; i < s.size; ++i){ // first value, then (delta, run length) pairs
+                m.varint(zigzag(s.matrix[i][0]));
+                for(int j = 1; j < s.size;){
+                    int64_t delta = (int64_t)s.matrix[i][j] - s.matrix[i][j - 1];
+                    int run = 1;
+                    while(j + run < s.size && (int64_t)s.matrix[i][j + run] - s.matrix[i][j + run - 1] == delta)
+                        ++run;
+                    m.varint(zigzag(delta));
+                    m.varint(run);
+                    j += run;
+                }
+            }
+        w.varint(s.size);
+        w.varint(m.bytes.size());
+        w.bytes.insert(w.bytes.end(), m.bytes.begin(), m.bytes.end());
+    }
+
+    static void getMatrix(ByteReader &r, Student &s){ // s already holds an i + j matrix of the right size
+        if(r.get<uint8_t>() == 0)
+            return;
+        for(int i = 0; i < s.size; ++i){
+            s.matrix[i][0] = (int)unzigzag(r.varint());
+            for(int j = 1; j < s.size;){
+                int64_t delta = unzigzag(r.varint());
+                uint64_t run = r.varint();
+                if(run == 0 || run > (uint64_t)(s.size - j))
+                    throw runtime_error("corrupt frozen matrix");
+                for(; run > 0; --run, ++j)
+                    s.matrix[i][j] = (int)(s.matrix[i][j - 1] + delta);
+            }
+        }
+    }
+
+    // Calls fn(person, matrixPayload) for everyone in order. matrixPayload is positioned on the person's matrix
+    // encoding (only meaningful for students, grad students and TAs); scans simply ignore it.
+    template<typename Fn>
+    void walk(Fn fn) const{
+        ByteReader idReader(ids.data(), ids.size()), moneyReader(money.data(), money.size());
+        const uint8_t *matrixPos = matrices.data();
+        int64_t id = 0;
+        size_t person = 0, aged = 0, dept = 0, grad = 0;
+        for(int k = 0; k < 4; ++k)
+            for(size_t n = 0; n < counts[k]; ++n, ++person){
+                FrozenPerson p = {kinds[k], 0, 0, nameDict[nameCodes[person]], string_view(), 0, 0, false, 0};
+                p.id = (int)(id += unzigzag(idReader.varint()));
+                if(p.kind == 'T' || p.kind == 'A')
+                    p.dept = deptDict[deptCodes[dept++]];
+                ByteReader matrixPayload(matrixPos, 0);
+                if(p.kind == 'T')
+                    p.salary = getMoney(moneyReader);
+                else{
+                    p.age = ageBase + (int)ages[aged++];
+                    p.fees = getMoney(moneyReader);
+                    if(p.kind == 'A')
+                        p.salary = getMoney(moneyReader);
+                    if(p.kind == 'G')
+                        p.doingResearch = research[grad++];
+                    ByteReader header(matrixPos, matrices.data() + matrices.size() - matrixPos);
+                    uint64_t size = header.varint();
+                    if(size > (uint64_t)Student::maxMatrixSize)
+                        throw runtime_error("matrix of #" + to_string(p.id) + " has a bad size");
+                    p.size = (int)size;
+                    size_t length = header.varint();
+                    const uint8_t *payload = matrices.data() + matrices.size() - header.remaining();
+                    header.need(length);
+                    matrixPayload = ByteReader(payload, length);
+                    matrixPos = payload + length;
+                }
+                fn(p, matrixPayload);
+            }
+    }
+
+public:
+    explicit FrozenRoster(const Roster &roster){
+        counts[0] = roster.teachers.size();
+        counts[1] = roster.students.size();
+        counts[2] = roster.gradStudents.size();
+        counts[3] = roster.tas.size();
+
+        vector<uint32_t> names, depts, rawAges, flags;
+        vector<int> ageValues;
+        ByteWriter idWriter, moneyWriter, matrixWriter;
+        int64_t previousId = 0;
+        auto common = [&](int id, const string &name){
+            idWriter.varint(zigzag((int64_t)id - previousId));
+            previousId = id;
+            names.push_back(nameDict.code(name));
+        };
+        auto studentPart = [&](const Student &s){
+            ageValues.push_back(s.age);
+            putMoney(moneyWriter, s.getFees());
+            putMatrix(matrixWriter, s);
+        };
+        for(auto &t : roster.teachers){
+            common(t->id, t->name);
+            depts.push_back(deptDict.code(t->dept));
+            putMoney(moneyWriter, t->getSalary());
+        }
+        for(auto &s : roster.students){
+            common(s->id, s->name);
+            studentPart(*s);
+        }
+        for(auto &g : roster.gradStudents){
+            common(g->id, g->name);
+            studentPart(*g);
+            flags.push_back(g->doingResearch);
+        }
+        for(auto &ta : roster.tas){
+            common(ta->Student::id, ta->Student::name);
+            depts.push_back(deptDict.code(ta->asTeacher().dept));
+            studentPart(*ta);
+            putMoney(moneyWriter, ta->asTeacher().getSalary());
+        }
+
+        if(!ageValues.empty())
+            ageBase = *min_element(ageValues.begin(), ageValues.end());
+        for(int a : ageValues)
+            rawAges.push_back((uint32_t)((int64_t)a - ageBase));
+        nameDict.seal();
+        deptDict.seal();
+        nameCodes = PackedInts(names, bitWidth(nameDict.size() ? nameDict.size() - 1 : 0));
+        deptCodes = PackedInts(depts, bitWidth(deptDict.size() ? deptDict.size() - 1 : 0));
+        ages = PackedInts(rawAges, bitWidth(rawAges.empty() ? 0 : *max_element(rawAges.begin(), rawAges.end())));
+        research = PackedInts(flags, 1);
+        ids = move(idWriter.bytes);
+        money = move(moneyWriter.bytes);
+        matrices = move(matrixWriter.bytes);
+        ids.shrink_to_fit();
+        money.shrink_to_fit();
+        matrices.shrink_to_fit();
+    }
+
+    size_t size() const{
+        return counts[0] + counts[1] + counts[2] + counts[3];
+    }
+
+    template<typename Fn>
+    void forEach(Fn fn) const{ // fn(const FrozenPerson&)
+        walk([&](const FrozenPerson &p, ByteReader &){ fn(p); });
+    }
+
+    // Ages are bit-packed with random access, so this never touches the other streams
+    size_t countAgeBetween(int lo, int hi) const{
+        size_t n = 0, aged = counts[1] + counts[2] + counts[3];
+        for(size_t i = 0; i < aged; ++i){
+            int age = ageBase + (int)ages[i];
+            n += age >= lo && age <= hi;
+        }
+        return n;
+    }
+
+    Roster thaw() const{
+        Roster roster;
+        walk([&](const FrozenPerson &p, ByteReader &matrixPayload){
+            Student *student = nullptr;
+            switch(p.kind){
+                case 'T':
+                    roster.teachers.push_back(make_unique<Teacher>(p.id, string(p.name), string(p.dept), p.salary));
+                    break;
+                case 'S':
+                    roster.students.push_back(make_unique<Student>(p.id, p.age, string(p.name), p.fees, p.size));
+                    student = roster.students.back().get();
+                    break;
+                case 'G':
+                    roster.gradStudents.push_back(make_unique<GradStudent>(p.id, p.age, string(p.name), p.fees, p.doingResearch, p.size));
+                    student = roster.gradStudents.back().get();
+                    break;
+                default:
+                    roster.tas.push_back(make_unique<TA>(p.id, p.age, string(p.name), p.fees, string(p.dept), p.salary, true, p.size));
+                    student = roster.tas.back().get();
+                    break;
+            }
+            if(student)
+                getMatrix(matrixPayload, *student);
+        });
+        return roster;
+    }
+
+    size_t memoryBytes() const{
+        return sizeof(*this) + ids.capacity() + money.capacity() + matrices.capacity() + nameDict.memoryBytes()
+             + deptDict.memoryBytes() + nameCodes.memoryBytes() + deptCodes.memoryBytes() + ages.memoryBytes()
+             + research.memoryBytes();
+    }
+};
+
+constexpr char FrozenRoster::kinds[4];
+
+// Heap + object size of the expanded roster, for comparing against FrozenRoster::memoryBytes(): the footprint
+// report's figure, so the two never disagree about what a person costs
+size_t expandedBytes(const Roster &roster){
+    return rosterFootprint(roster).totalBytes();
+}
+
+// ======= BINARY SNAPSHOTS =======
+// Snapshot file = "OOPSSNP1" then one length-prefixed record per person (varint length, then encodeRow bytes), so a
+// reader can stream it record by record in bounded memory.
+void encodeRow(ByteWriter &w, const RosterRow &r){
+    w.put<char>(r.kind);
+    w.varint(zigzag(r.id));
+    w.varint(zigzag(r.age));
+    w.str(r.name);
+    w.str(r.dept);
+    w.put<double>(r.salary);
+    w.put<double>(r.fees);
+    w.put<uint8_t>(r.doingResearch);
+    w.varint(r.size);
+    w.varint(r.matrix.size());
+    for(int v : r.matrix)
+        w.varint(zigzag(v));
+}
+
+RosterRow decodeRow(ByteReader &in){
+    RosterRow r;
+    r.kind = in.get<char>();
+    r.id = (int)unzigzag(in.varint());
+    r.age = (int)unzigzag(in.varint());
+    r.name = in.str();
+    r.dept = in.str();
+    r.salary = in.get<double>();
+    r.fees = in.get<double>();
+    r.doingResearch = in.get<uint8_t>() != 0;
+    uint64_t size = in.varint(), cells = in.varint();
+    if(size > (uint64_t)Student::maxMatrixSize || (cells && cells != size * size))
+        throw runtime_error("matrix of #" + to_string(r.id) + " has a bad size");
+    r.size = (int)size;
+    r.matrix.resize(cells);
+    for(int &v : r.matrix)
+        v = (int)unzigzag(in.varint());
+    return r;
+}
+
+const char snapshotMagic[8] = {'O', 'O', 'P', 'S', 'S', 'N', 'P', '1'};
+
+void appendSnapshotRecord(ByteWriter &w, const RosterRow &r){
+    ByteWriter record;
+    encodeRow(record, r);
+    w.varint(record.bytes.size());
+    w.bytes.insert(w.bytes.end(), record.bytes.begin(), record.bytes.end());
+}
+
+// Length-prefixed record files (snapshots, deltas): an 8-byte magic, then varint length + body per record.
+// Both ends stream through a fixed buffer, so file size never shows up in memory use.
+class RecordFileWriter{
+    vector<char> buffer;
+    ofstream out;
+    string path;
+public:
+    RecordFileWriter(const string &path, const char *magic): buffer(1 << 16), path(path){
+        out.rdbuf()->pubsetbuf(buffer.data(), buffer.size()); // before open(), where it is guaranteed to take
+        out.open(path, ios::binary | ios::trunc);
+        out.write(magic, 8);
+        if(!out)
+            throw runtime_error("cannot write " + path);
+    }
+
+    void write(const ByteWriter &record){
+        uint8_t length[10];
+        size_t n = 0;
+        for(uint64_t v = record.bytes.size(); ; v >>= 7){
+            length[n++] = uint8_t(v & 0x7F) | (v >= 0x80 ? 0x80 : 0);
+            if(v < 0x80)
+                break;
+        }
+        out.write((const char*)length, n);
+        out.write((const char*)record.bytes.data(), record.bytes.size());
+    }
+
+    void close(){
+        out.close();
+        if(!out)
+            throw runtime_error("short write to " + path);
+    }
+};
+
+class RecordFileReader{
+    vector<char> buffer;
+    ifstream in;
+    vector<uint8_t> record;
+    string path;
+    uint64_t position = 8, start = 0; // file offsets: where reading continues, where the last record began
+
+    bool readVarint(uint64_t &v){
+        v = 0;
+        for(int shift = 0; shift < 64; shift += 7){
+            int c = in.get();
+            if(c == EOF){
+                if(shift == 0)
+                    return false;
+                throw runtime_error("truncated " + path);
+            }
+            ++position;
+            v |= (uint64_t)(c & 0x7F) << shift;
+            if(!(c & 0x80))
+                return true;
+        }
+        throw runtime_error("bad varint in " + path);
+    }
+public:
+    RecordFileReader(const string &path, const char *magic, const string &what): buffer(1 << 16), path(path){
+        in.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        in.open(path, ios::binary);
+        char header[8];
+        if(!in.read(header, 8) || memcmp(header, magic, 8) != 0)
+            throw runtime_error(path + " is not " + what);
+    }
+
+    // Points r at the next record; it stays valid until the next call
+    bool next(ByteReader &r){
+        start = position;
+        uint64_t length;
+        if(!readVarint(length))
+            return false;
+        record.resize(length);
+        if(!in.read((char*)record.data(), length))
+            throw runtime_error("truncated record in " + path);
+        position += length;
+        r = ByteReader(record.data(), record.size());
+        return true;
+    }
+
+    // File offset of the record next() returned last - what an index stores to find it again
+    uint64_t recordOffset() const{
+        return start;
+    }
+
+    void seek(uint64_t offset){
+        in.clear();
+        in.seekg(offset);
+        position = offset;
+    }
+};
+
+// Streams a snapshot file one row at a time
+class SnapshotReader{
+    RecordFileReader file;
+public:
+    explicit SnapshotReader(const string &path): file(path, snapshotMagic, "a roster snapshot") {}
+
+    bool next(RosterRow &row){
+        ByteReader r(nullptr, 0);
+        if(!file.next(r))
+            return false;
+        row = decodeRow(r);
+        return true;
+    }
+
+    uint64_t recordOffset() const{
+        return file.recordOffset();
+    }
+
+    void seek(uint64_t offset){
+        file.seek(offset);
+    }
+};
+
+// The row whose record starts at offset (as recordOffset() reported it)
+RosterRow readRowAt(const string &path, uint64_t offset){
+    SnapshotReader in(path);
+    in.seek(offset);
+    RosterRow row;
+    if(!in.next(row))
+        throw runtime_error("no record at offset " + to_string(offset) + " of " + path);
+    return row;
+}
+
+class SnapshotWriter{
+    RecordFileWriter file;
+    ByteWriter record;
+public:
+    explicit SnapshotWriter(const string &path): file(path, snapshotMagic) {}
+
+    void write(const RosterRow &row){
+        record.bytes.clear();
+        encodeRow(record, row);
+        file.write(record);
+    }
+
+    void close(){
+        file.close();
+    }
+};
+
+void writeSnapshot(const string &path, const vector<RosterRow> &rows){
+    SnapshotWriter out(path);
+    for(const RosterRow &r : rows)
+        out.write(r);
+    out.close();
+}
+
+// Snapshot order for diffing and merging: by id, then kind (a TA and a Teacher may share an id)
+bool rowKeyLess(const RosterRow &a, const RosterRow &b){
+    return a.id != b.id ? a.id < b.id : a.kind < b.kind;
+}
+
+vector<RosterRow> sortedRows(const Roster &roster){
+    vector<RosterRow> rows = rosterRows(roster);
+    sort(rows.begin(), rows.end(), rowKeyLess);
+    return rows;
+}
+
+Roster loadSnapshot(const string &path){
+    Roster roster;
+    SnapshotReader reader(path);
+    RosterRow row;
+    while(reader.next(row))
+        addRow(roster, row);
+    return roster;
+}
+
+// ======= DELTA SNAPSHOTS =======
+// Day-to-day changes between two snapshots sorted by (id, kind), e.g. written from sortedRows(). Both diff and merge
+// are a single merge-join pass over streams, one record per input in memory, so they run in linear time and bounded
+// memory however large the snapshots get. Delta file = "OOPSDLT1" then one record per difference, in key order:
+//   Added    the full row
+//   Removed  kind, id
+//   Changed  kind, id, mask of changed fields, then the new value of each of them
+// A key may repeat (copies of a Student keep its id). Such a group has no pairing to diff against, so the delta
+// replaces it whole: a Removed per old row, then an Added per new row in order. Only groups are held in memory.
+// Persons carry no marks; the matrix is the per-person payload that gets compared instead.
+const char deltaMagic[8] = {'O', 'O', 'P', 'S', 'D', 'L', 'T', '1'};
+
+enum class DeltaOp : uint8_t { Added = 1, Removed = 2, Changed = 3 };
+
+enum DeltaField : uint8_t {
+    FieldName = 1, FieldAge = 2, FieldDept = 4, FieldSalary = 8, FieldFees = 16, FieldResearch = 32, FieldMatrix = 64
+};
+
+struct DeltaRecord{
+    DeltaOp op = DeltaOp::Added;
+    uint8_t fields = 0; // Changed: DeltaField bits
+    RosterRow row;      // Added: everything; Removed: kind + id; Changed: kind + id + the changed fields
+};
+
+struct DeltaStats{
+    size_t added = 0, removed = 0, changed = 0, unchanged = 0;
+};
+
+uint8_t changedFields(const RosterRow &a, const RosterRow &b){
+    uint8_t mask = 0;
+    if(a.name != b.name) mask |= FieldName;
+    if(a.age != b.age) mask |= FieldAge;
+    if(a.dept != b.dept) mask |= FieldDept;
+    if(a.salary != b.salary) mask |= FieldSalary;
+    if(a.fees != b.fees) mask |= FieldFees;
+    if(a.doingResearch != b.doingResearch) mask |= FieldResearch;
+    if(a.size != b.size || a.matrix != b.matrix) mask |= FieldMatrix;
+    return mask;
+}
+
+void encodeDelta(ByteWriter &w, const DeltaRecord &d){
+    w.put<uint8_t>((uint8_t)d.op);
+    if(d.op == DeltaOp::Added)
+        return encodeRow(w, d.row);
+    w.put<char>(d.row.kind);
+    w.varint(zigzag(d.row.id));
+    if(d.op == DeltaOp::Removed)
+        return;
+    w.put<uint8_t>(d.fields);
+    if(d.fields & FieldName) w.str(d.row.name);
+    if(d.fields & FieldAge) w.varint(zigzag(d.row.age));
+    if(d.fields & FieldDept) w.str(d.row.dept);
+    if(d.fields & FieldSalary) w.put<double>(d.row.salary);
+    if(d.fields & FieldFees) w.put<double>(d.row.fees);
+    if(d.fields & FieldResearch) w.put<uint8_t>(d.row.doingResearch);
+    if(d.fields & FieldMatrix){
+        w.varint(d.row.size);
+        w.varint(d.row.matrix.size());
+        for(int v : d.row.matrix)
+            w.varint(zigzag(v));
+    }
+}
+
+DeltaRecord decodeDelta(ByteReader &r){
+    DeltaRecord d;
+    d.op = (DeltaOp)r.get<uint8_t>();
+    if(d.op == DeltaOp::Added){
+        d.row = decodeRow(r);
+        return d;
+    }
+    d.row.kind = r.get<char>();
+    d.row.id = (int)unzigzag(r.varint());
+    if(d.op == DeltaOp::Removed)
+        return d;
+    if(d.op != DeltaOp::Changed)
+        throw runtime_error("unknown delta op");
+    d.fields = r.get<uint8_t>();
+    if(d.fields & FieldName) d.row.name = r.str();
+    if(d.fields & FieldAge) d.row.age = (int)unzigzag(r.varint());
+    if(d.fields & FieldDept) d.row.dept = r.str();
+    if(d.fields & FieldSalary) d.row.salary = r.get<double>();
+    if(d.fields & FieldFees) d.row.fees = r.get<double>();
+    if(d.fields & FieldResearch) d.row.doingResearch = r.get<uint8_t>() != 0;
+    if(d.fields & FieldMatrix){
+        d.row.size = (int)r.varint();
+        d.row.matrix.resize(r.varint());
+        for(int &v : d.row.matrix)
+            v = (int)unzigzag(r.varint());
+    }
+    return d;
+}
+
+// Copies the fields a Changed record carries onto the base row
+void applyFields(RosterRow &base, const DeltaRecord &d){
+    const RosterRow &r = d.row;
+    if(d.fields & FieldName) base.name = r.name;
+    if(d.fields & FieldAge) base.age = r.age;
+    if(d.fields & FieldDept) base.dept = r.dept;
+    if(d.fields & FieldSalary) base.salary = r.salary;
+    if(d.fields & FieldFees) base.fees = r.fees;
+    if(d.fields & FieldResearch) base.doingResearch = r.doingResearch;
+    if(d.fields & FieldMatrix){
+        base.size = r.size;
+        base.matrix = r.matrix;
+    }
+}
+
+// Snapshot reader that insists on key order, which the single-pass join depends on. Equal keys may follow each
+// other; a key that goes backwards is an error.
+class SortedSnapshotReader{
+    SnapshotReader in;
+    string path;
+    bool started = false;
+    RosterRow last;
+public:
+    explicit SortedSnapshotReader(const string &path): in(path), path(path) {}
+
+    bool next(RosterRow &row){
+        if(!in.next(row))
+            return false;
+        if(started && rowKeyLess(row, last))
+            throw runtime_error(path + " is not sorted by (id, kind) at #" + to_string(row.id));
+        started = true;
+        last.id = row.id;
+        last.kind = row.kind;
+        return true;
+    }
+};
+
+DeltaStats diffSnapshots(const string &beforePath, const string &afterPath, const string &deltaPath){
+    SortedSnapshotReader before(beforePath), after(afterPath);
+    RecordFileWriter out(deltaPath, deltaMagic);
+    DeltaStats stats;
+    ByteWriter w;
+    auto emit = [&](const DeltaRecord &d){
+        w.bytes.clear();
+        encodeDelta(w, d);
+        out.write(w);
+    };
+    RosterRow a, b;
+    bool hasA = before.next(a), hasB = after.next(b);
+    vector<RosterRow> olds, news; // the rows of the current key on each side
+    auto takeGroup = [](SortedSnapshotReader &in, RosterRow &row, bool &has, const RosterRow &key, vector<RosterRow> &into){
+        into.clear();
+        while(has && !rowKeyLess(key, row)){
+            into.emplace_back();
+            swap(into.back(), row);
+            has = in.next(row);
+        }
+    };
+    DeltaRecord d;
+    while(hasA || hasB){
+        const RosterRow &first = hasA && (!hasB || rowKeyLess(a, b)) ? a : b;
+        RosterRow key;
+        key.kind = first.kind;
+        key.id = first.id;
+        takeGroup(before, a, hasA, key, olds);
+        takeGroup(after, b, hasB, key, news);
+        bool same = olds.size() == news.size();
+        for(size_t i = 0; same && i < olds.size(); ++i)
+            same = changedFields(olds[i], news[i]) == 0;
+        if(same){
+            stats.unchanged += olds.size();
+            continue;
+        }
+        if(olds.size() == 1 && news.size() == 1){
+            d.op = DeltaOp::Changed;
+            d.fields = changedFields(olds[0], news[0]);
+            d.row = move(news[0]); // encodeDelta only writes the fields in the mask
+            emit(d);
+            ++stats.changed;
+            continue;
+        }
+        d.op = DeltaOp::Removed;
+        d.row = key;
+        for(size_t i = 0; i < olds.size(); ++i){
+            emit(d);
+            ++stats.removed;
+        }
+        d.op = DeltaOp::Added;
+        for(RosterRow &row : news){
+            d.row = move(row);
+            emit(d);
+            ++stats.added;
+        }
+    }
+    out.close();
+    return stats;
+}
+
+// base + delta -> out, all three sorted. A delta that doesn't fit the base (removing or changing somebody who isn't
+// there, adding somebody who is) is rejected rather than half-applied into something nobody asked for.
+DeltaStats mergeDelta(const string &basePath, const string &deltaPath, const string &outPath){
+    SortedSnapshotReader base(basePath);
+    RecordFileReader delta(deltaPath, deltaMagic, "a roster delta");
+    SnapshotWriter out(outPath);
+    DeltaStats stats;
+    RosterRow lastKey;
+    bool anyDelta = false;
+    auto nextDelta = [&](DeltaRecord &d){
+        ByteReader r(nullptr, 0);
+        if(!delta.next(r))
+            return false;
+        d = decodeDelta(r);
+        if(anyDelta && rowKeyLess(d.row, lastKey))
+            throw runtime_error(deltaPath + " is not sorted by (id, kind) at #" + to_string(d.row.id));
+        anyDelta = true;
+        lastKey.id = d.row.id;
+        lastKey.kind = d.row.kind;
+        return true;
+    };
+    auto reject = [&](const DeltaRecord &d, const char *why){
+        throw runtime_error("delta does not apply to " + basePath + ": #" + to_string(d.row.id) + " " + why);
+    };
+    RosterRow row;
+    DeltaRecord d;
+    bool hasRow = base.next(row), hasDelta = nextDelta(d);
+    while(hasRow || hasDelta){
+        if(hasRow && (!hasDelta || rowKeyLess(row, d.row))){
+            out.write(row);
+            ++stats.unchanged;
+            hasRow = base.next(row);
+            continue;
+        }
+        bool present = hasRow && !rowKeyLess(d.row, row);
+        switch(d.op){
+            case DeltaOp::Added:
+                if(present)
+                    reject(d, "is added but already there");
+                out.write(d.row);
+                ++stats.added;
+                break;
+            case DeltaOp::Removed:
+                if(!present)
+                    reject(d, "is removed but not there");
+                ++stats.removed;
+                hasRow = base.next(row);
+                break;
+            case DeltaOp::Changed:
+                if(!present)
+                    reject(d, "is changed but not there");
+                applyFields(row, d);
+                out.write(row);
+                ++stats.changed;
+                hasRow = base.next(row);
+                break;
+        }
+        hasDelta = nextDelta(d);
+    }
+    out.close();
+    return stats;
+}
+
+// ======= ASYNC PERSISTENCE =======
+// A background thread owns the file. Callers submit buffers and get a completion callback once the bytes are on
+// disk. Everything queued while the previous batch was being written goes out as the next batch: one writev and
+// one fsync for the lot (group commit), so request threads never block on the disk. On Linux the batch goes to the
+// kernel through io_uring instead - its writevs and the fsync as one linked chain in a single io_uring_enter - with
+// plain writev + fsync as the fallback where the kernel (or a seccomp policy) refuses io_uring. A PagePool's pages are
+// registered with the ring, so a page goes out as a WRITE_FIXED that the kernel doesn't have to map and pin per write.
+#ifdef __linux__
+// Just enough io_uring for AsyncWriter, on the raw syscalls (no liburing): fill SQEs, submit them and wait for their
+// completions in one call, then reap the CQEs. One thread uses a ring at a time.
+class IoUring{
+    int ringFd = -1;
+    unsigned sqEntries = 0;
+    void *sqRing = MAP_FAILED, *cqRing = MAP_FAILED;
+    size_t sqRingBytes = 0, cqRingBytes = 0, sqeBytes = 0;
+    io_uring_sqe *sqes = (io_uring_sqe*)MAP_FAILED;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray, *cqHead, *cqTail, *cqMask;
+    io_uring_cqe *cqes;
+    unsigned tail = 0, queued = 0;
+    bool buffersRegistered = false;
+
+    static void* mapRing(int fd, size_t bytes, off_t offset){
+        return ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    }
+
+    template<typename T>
+    T* at(void *ring, uint32_t offset){
+        return (T*)((char*)ring + offset);
+    }
+
+    void release(){
+        if(sqes != (io_uring_sqe*)MAP_FAILED)
+            ::munmap(sqes, sqeBytes);
+        if(cqRing != MAP_FAILED)
+            ::munmap(cqRing, cqRingBytes);
+        if(sqRing != MAP_FAILED)
+            ::munmap(sqRing, sqRingBytes);
+        if(ringFd >= 0)
+            ::close(ringFd);
+    }
+public:
+    explicit IoUring(unsigned entries){
+        io_uring_params params{};
+        ringFd = (int)::syscall(__NR_io_uring_setup, entries, &params);
+        if(ringFd < 0)
+            throw runtime_error(string("io_uring_setup: ") + strerror(errno));
+        sqEntries = params.sq_entries;
+        sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqeBytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqRing = mapRing(ringFd, sqRingBytes, IORING_OFF_SQ_RING);
+        cqRing = mapRing(ringFd, cqRingBytes, IORING_OFF_CQ_RING);
+        sqes = (io_uring_sqe*)mapRing(ringFd, sqeBytes, IORING_OFF_SQES);
+        if(sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == (io_uring_sqe*)MAP_FAILED){
+            string error = strerror(errno);
+            release();
+            throw runtime_error("io_uring mmap: " + error);
+        }
+        sqHead = at<unsigned>(sqRing, params.sq_off.head);
+        sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+        sqMask = at<unsigned>(sqRing, params.sq_off.ring_mask);
+        sqArray = at<unsigned>(sqRing, params.sq_off.array);
+        cqHead = at<unsigned>(cqRing, params.cq_off.head);
+        cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+        cqMask = at<unsigned>(cqRing, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+        tail = *sqTail;
+    }
+
+    IoUring(const IoUring &) = delete;
+    IoUring& operator=(const IoUring &) = delete;
+
+    ~IoUring(){
+        release();
+    }
+
+    unsigned capacity() const{
+        return sqEntries;
+    }
+
+    // Pins buffers for IORING_OP_WRITE_FIXED (buf_index = position here), replacing any registered before. false if
+    // the kernel refuses (too old, or over RLIMIT_MEMLOCK): then nothing is registered.
+    bool registerBuffers(const vector<iovec> &buffers){
+        if(buffersRegistered)
+            ::syscall(__NR_io_uring_register, ringFd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        buffersRegistered = !buffers.empty()
+            && ::syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, buffers.data(), (unsigned)buffers.size()) == 0;
+        return buffersRegistered;
+    }
+
+    // A zeroed SQE to fill in, or nullptr when capacity() are already queued
+    io_uring_sqe* next(){
+        if(queued == sqEntries)
+            return nullptr;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        ++tail;
+        ++queued;
+        return sqe;
+    }
+
+    // Submits everything queued and waits for all of it; fn(user_data, res) per completion. false on a syscall error.
+    template<typename Fn>
+    bool submitAndWait(Fn fn){
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        unsigned toSubmit = queued, toReap = queued;
+        queued = 0;
+        while(toReap > 0){
+            int n = (int)::syscall(__NR_io_uring_enter, ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if(n < 0){
+                if(errno == EINTR)
+                    continue;
+                return false;
+            }
+            toSubmit -= min<unsigned>(toSubmit, (unsigned)n);
+            unsigned head = *cqHead, ready = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for(; head != ready && toReap > 0; ++head, --toReap){
+                const io_uring_cqe &cqe = cqes[head & *cqMask];
+                fn(cqe.user_data, cqe.res);
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+};
+#endif
+
+class AsyncWriter{
+public:
+    typedef function<void(bool ok)> Completion;
+
+    explicit AsyncWriter(const string &path, bool truncate = true, bool syncBatches = true): syncBatches(syncBatches){
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0), 0644);
+        if(fd < 0)
+            throw runtime_error("cannot open " + path + ": " + strerror(errno));
+#ifdef __linux__
+        try{
+            ring = make_unique<IoUring>(8);
+        }
+        catch(const runtime_error &){
+            // no io_uring here: writev + fsync below
+        }
+#endif
+        worker = thread(&AsyncWriter::run, this);
+    }
+
+    ~AsyncWriter(){
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+        ::close(fd);
+    }
+
+    // The writer keeps its own copy
+    void submit(vector<uint8_t> bytes, Completion done = nullptr){
+        Request r;
+        r.owned = move(bytes);
+        r.data = r.owned.data();
+        r.size = r.owned.size();
+        r.done = move(done);
+        enqueue(move(r));
+    }
+
+    // Zero-copy: data must stay valid until done runs (see PagePool)
+    void submit(const uint8_t *data, size_t size, Completion done){
+        Request r;
+        r.data = data;
+        r.size = size;
+        r.done = move(done);
+        enqueue(move(r));
+    }
+
+    void drain(){ // returns once everything submitted so far has completed
+        unique_lock<mutex> guard(lock);
+        idle.wait(guard, [&]{ return queue.empty() && !busy; });
+    }
+
+    // Registers these buffers with the ring (waiting for the writer to go idle first, unless they already are), so
+    // zero-copy submits from inside them are written with WRITE_FIXED. false without io_uring or if the kernel refuses;
+    // the writes then go out as writevs as before.
+    bool useBuffers(const vector<iovec> &buffers){
+#ifdef __linux__
+        auto same = [&]{
+            return fixedBuffers.size() == buffers.size() && equal(buffers.begin(), buffers.end(), fixedBuffers.begin(),
+                [](const iovec &a, const iovec &b){ return a.iov_base == b.iov_base && a.iov_len == b.iov_len; });
+        };
+        unique_lock<mutex> guard(lock);
+        if(!ring)
+            return false;
+        if(same())
+            return !fixedBuffers.empty();
+        idle.wait(guard, [&]{ return queue.empty() && !busy; }); // the worker only reads fixedBuffers mid-batch
+        fixedBuffers.clear();
+        if(ring->registerBuffers(buffers))
+            fixedBuffers = buffers;
+        return !fixedBuffers.empty();
+#else
+        (void)buffers;
+        return false;
+#endif
+    }
+
+    size_t batches = 0; // how many writev+fsync rounds it took
+
+    const char* backend() const{
+#ifdef __linux__
+        lock_guard<mutex> guard(lock);
+        if(ring)
+            return fixedBuffers.empty() ? "io_uring" : "io_uring, registered buffers";
+#endif
+        return "writev";
+    }
+
+private:
+    struct Request{
+        vector<uint8_t> owned;
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+        Completion done;
+    };
+
+    int fd;
+    bool syncBatches;
+    mutable mutex lock;
+    condition_variable wake, idle;
+    vector<Request> queue;
+    bool busy = false, stopping = false;
+#ifdef __linux__
+    unique_ptr<IoUring> ring; // null: writev fallback
+    vector<iovec> fixedBuffers; // registered with ring; changed only under lock while the worker is idle
+#endif
+    thread worker;
+
+    void enqueue(Request r){
+        {
+            lock_guard<mutex> guard(lock);
+            queue.push_back(move(r));
+        }
+        wake.notify_one();
+    }
+
+    bool writeAll(vector<Request> &batch){
+        vector<iovec> iov;
+        for(Request &r : batch)
+            if(r.size)
+                iov.push_back({(void*)r.data, r.size});
+        size_t first = 0;
+#ifdef __linux__
+        if(ring)
+            return writeRing(iov);
+#endif
+        return writeRest(iov, first);
+    }
+
+#ifdef __linux__
+    // Index of the registered buffer holding all of this iovec, or -1
+    int fixedBufferOf(const iovec &v) const{
+        for(size_t i = 0; i < fixedBuffers.size(); ++i){
+            const char *base = (const char*)fixedBuffers[i].iov_base, *start = (const char*)v.iov_base;
+            if(start >= base && start + v.iov_len <= base + fixedBuffers[i].iov_len)
+                return (int)i;
+        }
+        return -1;
+    }
+
+    // Up to capacity - 1 writes linked in order and, on the last round, the fsync linked behind them: a WRITE_FIXED
+    // for each iovec inside a registered buffer, a writev of up to 1024 iovecs for each run of the others. The file is
+    // O_APPEND so the kernel appends whatever the offset. A short write breaks the chain (the rest come back
+    // -ECANCELED), and whatever is left then goes out through the writev loop.
+    bool writeRing(vector<iovec> &iov){
+        vector<int> buffer(iov.size());
+        for(size_t i = 0; i < iov.size(); ++i)
+            buffer[i] = fixedBufferOf(iov[i]);
+        size_t first = 0;
+        do{
+            struct Chunk{ size_t first, count, bytes; int buffer; };
+            vector<Chunk> chunks;
+            for(size_t next = first; next < iov.size() && chunks.size() + 1 < ring->capacity();){
+                Chunk c{next, 0, 0, buffer[next]};
+                do
+                    c.bytes += iov[next + c.count++].iov_len;
+                while(c.buffer < 0 && c.count < 1024 && next + c.count < iov.size() && buffer[next + c.count] < 0);
+                chunks.push_back(c);
+                next += c.count;
+            }
+            bool last = chunks.empty() || chunks.back().first + chunks.back().count == iov.size();
+            for(size_t i = 0; i < chunks.size(); ++i){
+                io_uring_sqe *sqe = ring->next();
+                sqe->fd = fd;
+                if(chunks[i].buffer >= 0){
+                    sqe->opcode = IORING_OP_WRITE_FIXED;
+                    sqe->addr = (uint64_t)(uintptr_t)iov[chunks[i].first].iov_base;
+                    sqe->len = (uint32_t)chunks[i].bytes;
+                    sqe->buf_index = (uint16_t)chunks[i].buffer;
+                }
+                else{
+                    sqe->opcode = IORING_OP_WRITEV;
+                    sqe->addr = (uint64_t)(uintptr_t)&iov[chunks[i].first];
+                    sqe->len = (uint32_t)chunks[i].count;
+                }
+                sqe->user_data = i;
+                if(i + 1 < chunks.size() || (last && syncBatches))
+                    sqe->flags = IOSQE_IO_LINK;
+            }
+            if(last && syncBatches){
+                io_uring_sqe *sqe = ring->next();
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fd = fd;
+                sqe->user_data = chunks.size();
+            }
+            vector<int> results(chunks.size() + 1, 0);
+            if(!ring->submitAndWait([&](uint64_t which, int res){ results[which] = res; }))
+                return false;
+            for(size_t i = 0; i < chunks.size(); ++i){
+                if(results[i] == (int)chunks[i].bytes){
+                    first = chunks[i].first + chunks[i].count;
+                    continue;
+                }
+                if(results[i] < 0 && results[i] != -ECANCELED && results[i] != -EINTR && results[i] != -EAGAIN)
+                    return false;
+                // short write: skip what did go out, then the plain loop finishes the batch and syncs it
+                size_t done = results[i] > 0 ? (size_t)results[i] : 0;
+                for(first = chunks[i].first; done > 0; ++first){
+                    size_t step = min(done, iov[first].iov_len);
+                    iov[first].iov_base = (char*)iov[first].iov_base + step;
+                    iov[first].iov_len -= step;
+                    done -= step;
+                    if(iov[first].iov_len > 0)
+                        break;
+                }
+                return writeRest(iov, first);
+            }
+            if(last)
+                return !syncBatches || results[chunks.size()] == 0;
+        }while(true);
+    }
+#endif
+
+    bool writeRest(vector<iovec> &iov, size_t first){
+        while(first < iov.size()){
+            int count = (int)min<size_t>(iov.size() - first, 1024); // IOV_MAX is at least 1024
+            ssize_t n = ::writev(fd, &iov[first], count);
+            if(n < 0){
+                if(errno == EINTR)
+                    continue;
+                return false;
+            }
+            for(size_t left = (size_t)n; left > 0;){ // partial write: advance past what went out
+                size_t step = min(left, iov[first].iov_len);
+                iov[first].iov_base = (char*)iov[first].iov_base + step;
+                iov[first].iov_len -= step;
+                left -= step;
+                if(iov[first].iov_len == 0)
+                    ++first;
+            }
+            while(first < iov.size() && iov[first].iov_len == 0)
+                ++first;
+        }
+        return !syncBatches || ::fsync(fd) == 0;
+    }
+
+    void run(){
+        for(;;){
+            vector<Request> batch;
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&]{ return stopping || !queue.empty(); });
+                if(queue.empty())
+                    return; // stopping, and nothing left to write
+                batch.swap(queue);
+                busy = true;
+            }
+            static MetricHistogram &batchSizes = MetricsRegistry::global().histogram("oops_async_write_batch_requests",
+                "Requests coalesced into one AsyncWriter write", {1, 2, 4, 8, 16, 32, 64, 128, 256});
+            static MetricCounter &written = MetricsRegistry::global().counter("oops_async_written_bytes_total",
+                "Bytes handed to AsyncWriter");
+            bool ok = writeAll(batch);
+            ++batches;
+            batchSizes.observe(batch.size());
+            for(Request &r : batch)
+                written.inc(r.size);
+            for(Request &r : batch)
+                if(r.done)
+                    r.done(ok);
+            {
+                lock_guard<mutex> guard(lock);
+                busy = false;
+            }
+            idle.notify_all();
+        }
+    }
+};
+
+// Fixed set of reusable page buffers handed to AsyncWriter without copying. At most `count` pages are in flight,
+// which bounds the memory a snapshot takes however big the roster is.
+class PagePool{
+    size_t pageSize;
+    vector<unique_ptr<uint8_t[]>> pages;
+    vector<uint8_t*> freePages;
+    mutex lock;
+    condition_variable returned;
+public:
+    PagePool(size_t count = 8, size_t pageSize = 1 << 16): pageSize(pageSize){
+        for(size_t i = 0; i < count; ++i){
+            pages.emplace_back(new uint8_t[pageSize]);
+            freePages.push_back(pages.back().get());
+        }
+    }
+
+    size_t size() const{
+        return pageSize;
+    }
+
+    vector<iovec> buffers() const{ // every page, for AsyncWriter::useBuffers
+        vector<iovec> out;
+        for(auto &page : pages)
+            out.push_back({page.get(), pageSize});
+        return out;
+    }
+
+    uint8_t* acquire(){ // waits while every page is in flight
+        unique_lock<mutex> guard(lock);
+        returned.wait(guard, [&]{ return !freePages.empty(); });
+        uint8_t *page = freePages.back();
+        freePages.pop_back();
+        return page;
+    }
+
+    void release(uint8_t *page){
+        {
+            lock_guard<mutex> guard(lock);
+            freePages.push_back(page);
+        }
+        returned.notify_one();
+    }
+};
+
+// Appends bytes into pool pages and hands each full page to the writer; the pool bounds what is in flight
+class PagedAppender{
+    AsyncWriter &writer;
+    PagePool &pool;
+    uint8_t *page;
+    size_t used = 0;
+
+    void ship(AsyncWriter::Completion done){
+        writer.submit(page, used, done);
+        used = 0;
+    }
+public:
+    PagedAppender(AsyncWriter &writer, PagePool &pool): writer(writer), pool(pool), page(pool.acquire()){
+        writer.useBuffers(pool.buffers());
+    }
+
+    void append(const uint8_t *data, size_t n){
+        while(n > 0){
+            size_t step = min(n, pool.size() - used);
+            memcpy(page + used, data, step);
+            used += step;
+            data += step;
+            n -= step;
+            if(used == pool.size()){
+                uint8_t *full = page;
+                PagePool *owner = &pool; // the appender may be gone by the time the write completes
+                ship([owner, full](bool){ owner->release(full); });
+                page = pool.acquire();
+            }
+        }
+    }
+
+    // Ships the last, partly filled page; whenDone runs once it (and so everything before it) is written
+    void finish(AsyncWriter::Completion whenDone){
+        uint8_t *last = page;
+        PagePool *owner = &pool;
+        ship([owner, last, whenDone](bool ok){
+            owner->release(last);
+            if(whenDone)
+                whenDone(ok);
+        });
+        page = nullptr;
+    }
+};
+
+// Snapshot through the async writer, a page at a time; whenDurable runs after the last page is on disk. Rows are
+// encoded one at a time as the roster is walked, so memory stays at the pool's pages whatever the roster's size.
+void writeSnapshotAsync(AsyncWriter &writer, PagePool &pool, const Roster &roster, AsyncWriter::Completion whenDurable){
+    PagedAppender out(writer, pool);
+    out.append((const uint8_t*)snapshotMagic, 8);
+    ByteWriter w;
+    forEachRow(roster, [&](const RosterRow &row){
+        w.bytes.clear();
+        appendSnapshotRecord(w, row);
+        out.append(w.bytes.data(), w.bytes.size());
+    });
+    out.finish(whenDurable);
+}
+
+// Mutation log: one record per change reported on the change feed (constructions, destructions, setSalary,
+// setFees, HR::raise, waiveFees), appended through the async writer. A log file starts with "OOPSLOG2" and then
+// holds records of varint length | varint lsn | op | varint object | payload, where the payload is a full row plus
+// char personClass | varint person | uint8 research for Created, and kind, id, value otherwise. Objects are logged
+// as their Student/Teacher parts (a TA as both), which is all the feed can see mid-construction; `object` tells
+// apart parts that share an id (a TA's two halves, copies of a Student). Version 1 had no header and no person.
+enum class LogOp : uint8_t { Created = 1, Destroyed = 2, SalarySet = 3, FeesSet = 4 };
+
+const char mutationLogMagic[8] = {'O', 'O', 'P', 'S', 'L', 'O', 'G', '2'};
+
+struct LogEntry{
+    uint64_t lsn = 0;
+    LogOp op = LogOp::Created;
+    RosterRow row; // Created: everything; otherwise kind + id, and salary or fees for the Set ops
+    uint64_t object = 0; // the part's address on the logging side: unique from its Created to its Destroyed
+    // Created only: the person the part belongs to - most-derived class ('T', 'S', 'G' or 'A') and address - so the
+    // other side can rebuild GradStudents and TAs rather than loose parts. Until classify() runs on the finished
+    // person these are just the part's own kind and address.
+    char personClass = 0;
+    uint64_t person = 0;
+    bool research = false; // GradStudent::doingResearch
+};
+
+LogEntry logEntry(LogOp op, const Teacher &t){
+    return {0, op, rowOf(t), (uint64_t)(uintptr_t)&t, 'T', (uint64_t)(uintptr_t)&t};
+}
+
+LogEntry logEntry(LogOp op, const Student &s){
+    return {0, op, rowOf(s), (uint64_t)(uintptr_t)&s, 'S', (uint64_t)(uintptr_t)&s};
+}
+
+// Fills in the person a Created part belongs to. Only once the person is fully constructed: while a TA's Student
+// part is being built it is a plain Student, and nothing yet says a Teacher part will follow.
+void classify(LogEntry &e, const IPerson &part){
+    e.person = (uint64_t)(uintptr_t)dynamic_cast<const void*>(&part);
+    if(dynamic_cast<const TA*>(&part))
+        e.personClass = 'A';
+    else if(const GradStudent *g = dynamic_cast<const GradStudent*>(&part)){
+        e.personClass = 'G';
+        e.research = g->doingResearch;
+    }
+    else
+        e.personClass = dynamic_cast<const Teacher*>(&part) ? 'T' : 'S';
+}
+
+void encodeLogEntry(ByteWriter &w, const LogEntry &e){
+    ByteWriter body;
+    body.varint(e.lsn);
+    body.put<uint8_t>((uint8_t)e.op);
+    body.varint(e.object);
+    if(e.op == LogOp::Created){
+        encodeRow(body, e.row);
+        body.put<char>(e.personClass);
+        body.varint(e.person);
+        body.put<uint8_t>(e.research);
+    }
+    else{
+        body.put<char>(e.row.kind);
+        body.varint(zigzag(e.row.id));
+        body.put<double>(e.op == LogOp::SalarySet ? e.row.salary : e.row.fees);
+    }
+    w.varint(body.bytes.size());
+    w.bytes.insert(w.bytes.end(), body.bytes.begin(), body.bytes.end());
+}
+
+LogEntry decodeLogEntry(ByteReader &r){ // r holds exactly one record body
+    LogEntry e;
+    e.lsn = r.varint();
+    e.op = (LogOp)r.get<uint8_t>();
+    e.object = r.varint();
+    if(e.op == LogOp::Created){
+        e.row = decodeRow(r);
+        e.personClass = r.get<char>();
+        e.person = r.varint();
+        e.research = r.get<uint8_t>() != 0;
+    }
+    else{
+        e.row.kind = r.get<char>();
+        e.row.id = (int)unzigzag(r.varint());
+        double value = r.get<double>();
+        (e.op == LogOp::SalarySet ? e.row.salary : e.row.fees) = value;
+    }
+    return e;
+}
+
+// LSNs are taken and submitted under one lock, so the writer sees them in order and durability is a prefix: once lsn
+// n is durable so is everything before it. A failed write stops the prefix there and fails every waiter behind it.
+class MutationLog : public IRosterObserver{
+    AsyncWriter &writer;
+    mutex appendLock; // LSN order == submission order
+    uint64_t nextLsn = 1;
+    mutex waitLock;
+    uint64_t durableLsn = 0, failedLsn = 0; // failedLsn: first entry that did not make it, 0 while none has failed
+    condition_variable durableChanged;
+public:
+    // Runs on the writer thread for every entry once it is durable: it must not touch what other threads use unlocked
+    function<void(const LogEntry&)> onDurable;
+
+    // newFile: the writer's file is empty, so the log starts with its header
+    explicit MutationLog(AsyncWriter &writer, bool newFile = true): writer(writer){
+        if(newFile)
+            writer.submit(vector<uint8_t>(mutationLogMagic, mutationLogMagic + 8));
+        RosterFeed::subscribe(this);
+    }
+
+    ~MutationLog() override{
+        RosterFeed::unsubscribe(this);
+        writer.drain();
+    }
+
+    uint64_t lastLsn(){
+        lock_guard<mutex> guard(appendLock);
+        return nextLsn - 1;
+    }
+
+    // true once lsn is durable; false if a write failed before it got there (it never will)
+    bool waitDurable(uint64_t lsn){
+        unique_lock<mutex> guard(waitLock);
+        durableChanged.wait(guard, [&]{ return durableLsn >= lsn || failedLsn != 0; });
+        return durableLsn >= lsn;
+    }
+
+    void append(LogEntry e){
+        lock_guard<mutex> guard(appendLock);
+        e.lsn = nextLsn++;
+        ByteWriter w;
+        encodeLogEntry(w, e);
+        writer.submit(move(w.bytes), [this, e](bool ok){
+            if(ok && onDurable)
+                onDurable(e);
+            {
+                lock_guard<mutex> guard(waitLock);
+                if(!ok && !failedLsn)
+                    failedLsn = e.lsn;
+                if(ok && !failedLsn) // after a hole nothing later counts as durable, even if its own write worked
+                    durableLsn = e.lsn;
+            }
+            durableChanged.notify_all();
+        });
+    }
+
+    void teacherAdded(const Teacher &t) override { append(logEntry(LogOp::Created, t)); }
+    void teacherRemoved(const Teacher &t) override { append(logEntry(LogOp::Destroyed, t)); }
+    void salaryChanged(const Teacher &t, double) override { append(logEntry(LogOp::SalarySet, t)); }
+    void studentAdded(const Student &s) override { append(logEntry(LogOp::Created, s)); }
+    void studentRemoved(const Student &s) override { append(logEntry(LogOp::Destroyed, s)); }
+    void feesChanged(const Student &s, double) override { append(logEntry(LogOp::FeesSet, s)); }
+};
+
+// Reads a whole mutation log file back
+vector<LogEntry> readMutationLog(const string &path){
+    ifstream in(path, ios::binary);
+    vector<uint8_t> bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    if(bytes.size() < 8 || memcmp(bytes.data(), mutationLogMagic, 8) != 0)
+        throw runtime_error(path + " is not a version 2 mutation log");
+    ByteReader r(bytes.data() + 8, bytes.size() - 8);
+    vector<LogEntry> entries;
+    while(!r.done()){
+        size_t length = r.varint();
+        r.need(length);
+        vector<uint8_t> body(length);
+        for(uint8_t &b : body)
+            b = r.get<uint8_t>();
+        ByteReader br(body.data(), body.size());
+        entries.push_back(decodeLogEntry(br));
+    }
+    return entries;
+}
+
+// ======= EXTERNAL SORT =======
+// Sorts record files far bigger than RAM. Run generation fills a memory budget with records, sorts them and writes
+// them out as a run while the next batch is read (AsyncWriter + PagePool write-behind). Runs are then merged up to
+// fanIn at a time through a loser tree, each run read through a double buffer whose next block is already being
+// fetched on a prefetch thread, with extra passes when there are more runs than fanIn. The same machinery produces
+// sorted snapshots (RosterRow records) and sorted index files (IndexEntry: key fields + snapshot offset).
+enum class SortKey : uint8_t { Id, Name, Salary, Fees, Age };
+
+// Index file record: the sortable fields of a row and where the row is in its snapshot
+struct IndexEntry{
+    int id = 0;
+    char kind = 'S';
+    int age = 0;
+    double salary = 0, fees = 0;
+    string name;
+    uint64_t offset = 0;
+};
+
+const char indexMagic[8] = {'O', 'O', 'P', 'S', 'I', 'D', 'X', '1'};
+
+template<typename Record> struct RecordCodec;
+
+template<> struct RecordCodec<RosterRow>{
+    static const char* magic(){ return snapshotMagic; }
+    static void encode(ByteWriter &w, const RosterRow &r){ encodeRow(w, r); }
+    static void decode(ByteReader &in, RosterRow &r){ r = decodeRow(in); }
+    static size_t footprint(const RosterRow &r){
+        return sizeof(RosterRow) + r.name.capacity() + r.dept.capacity() + r.matrix.capacity() * sizeof(int);
+    }
+};
+
+template<> struct RecordCodec<IndexEntry>{
+    static const char* magic(){ return indexMagic; }
+    static void encode(ByteWriter &w, const IndexEntry &e){
+        w.varint(zigzag(e.id));
+        w.put<char>(e.kind);
+        w.varint(zigzag(e.age));
+        w.put<double>(e.salary);
+        w.put<double>(e.fees);
+        w.str(e.name);
+        w.varint(e.offset);
+    }
+    static void decode(ByteReader &in, IndexEntry &e){
+        e.id = (int)unzigzag(in.varint());
+        e.kind = in.get<char>();
+        e.age = (int)unzigzag(in.varint());
+        e.salary = in.get<double>();
+        e.fees = in.get<double>();
+        e.name = in.str();
+        e.offset = in.varint();
+    }
+    static size_t footprint(const IndexEntry &e){
+        return sizeof(IndexEntry) + e.name.capacity();
+    }
+};
+
+// Order on the chosen key; ties fall back to (id, kind) so every sort of the same data comes out the same
+struct RowOrder{
+    SortKey key;
+
+    template<typename Record>
+    bool operator()(const Record &a, const Record &b) const{
+        switch(key){
+            case SortKey::Name:
+                if(int c = a.name.compare(b.name))
+                    return c < 0;
+                break;
+            case SortKey::Salary:
+                if(a.salary != b.salary)
+                    return a.salary < b.salary;
+                break;
+            case SortKey::Fees:
+                if(a.fees != b.fees)
+                    return a.fees < b.fees;
+                break;
+            case SortKey::Age:
+                if(a.age != b.age)
+                    return a.age < b.age;
+                break;
+            case SortKey::Id:
+                break;
+        }
+        return a.id != b.id ? a.id < b.id : a.kind < b.kind;
+    }
+};
+
+// Runs I/O jobs on its own threads; submit() returns a future for the job's result
+class PrefetchPool{
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake;
+    deque<packaged_task<ssize_t()>> jobs;
+    bool stopping = false;
+public:
+    explicit PrefetchPool(size_t threads = 2){
+        for(size_t i = 0; i < threads; ++i)
+            workers.emplace_back([this]{
+                for(;;){
+                    packaged_task<ssize_t()> job;
+                    {
+                        unique_lock<mutex> guard(lock);
+                        wake.wait(guard, [&]{ return stopping || !jobs.empty(); });
+                        if(jobs.empty())
+                            return;
+                        job = move(jobs.front());
+                        jobs.pop_front();
+                    }
+                    job();
+                }
+            });
+    }
+
+    ~PrefetchPool(){
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(thread &t : workers)
+            t.join();
+    }
+
+    future<ssize_t> submit(function<ssize_t()> fn){
+        packaged_task<ssize_t()> job(move(fn));
+        future<ssize_t> result = job.get_future();
+        {
+            lock_guard<mutex> guard(lock);
+            jobs.push_back(move(job));
+        }
+        wake.notify_one();
+        return result;
+    }
+};
+
+// Record file reader for merging: while the caller decodes one block, the next is read by the prefetch pool
+class PrefetchingRecordReader{
+    int fd;
+    size_t blockSize;
+    PrefetchPool &pool;
+    vector<uint8_t> buffer, ahead;
+    size_t pos = 0;       // start of the unconsumed bytes in buffer
+    uint64_t offset = 0;  // where the block being prefetched starts
+    future<ssize_t> pending;
+    bool eof = false;
+
+    void prefetch(){
+        ahead.resize(blockSize);
+        uint8_t *into = ahead.data();
+        int file = fd;
+        size_t size = blockSize;
+        uint64_t at = offset;
+        pending = pool.submit([=]{ // errno belongs to the pool thread, so it comes back as -errno
+            ssize_t got = ::pread(file, into, size, at);
+            return got < 0 ? (ssize_t)-errno : got;
+        });
+    }
+
+    bool fillTo(size_t n){
+        while(buffer.size() - pos < n){
+            if(eof)
+                return false;
+            ssize_t got = pending.get();
+            if(got < 0)
+                throw runtime_error(string("read failed while merging: ") + strerror((int)-got));
+            if(got == 0){
+                eof = true;
+                continue;
+            }
+            buffer.erase(buffer.begin(), buffer.begin() + pos);
+            pos = 0;
+            buffer.insert(buffer.end(), ahead.begin(), ahead.begin() + got);
+            offset += got;
+            prefetch();
+        }
+        return true;
+    }
+public:
+    PrefetchingRecordReader(const string &path, const char *magic, PrefetchPool &pool, size_t blockSize):
+        blockSize(blockSize), pool(pool){
+        fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            throw runtime_error("cannot open " + path + ": " + strerror(errno));
+        prefetch();
+        if(!fillTo(8) || memcmp(&buffer[0], magic, 8) != 0)
+            throw runtime_error(path + " has the wrong format");
+        pos = 8;
+    }
+
+    PrefetchingRecordReader(const PrefetchingRecordReader &) = delete;
+    PrefetchingRecordReader& operator=(const PrefetchingRecordReader &) = delete;
+
+    ~PrefetchingRecordReader(){
+        if(pending.valid())
+            pending.wait(); // the pool may still be writing into ahead
+        ::close(fd);
+    }
+
+    // Same contract as RecordFileReader::next
+    bool next(ByteReader &r){
+        uint64_t length = 0;
+        size_t lengthBytes = 0;
+        for(;; ++lengthBytes){
+            if(!fillTo(lengthBytes + 1)){
+                if(lengthBytes == 0)
+                    return false;
+                throw runtime_error("truncated record while merging");
+            }
+            uint8_t b = buffer[pos + lengthBytes];
+            length |= (uint64_t)(b & 0x7F) << (7 * lengthBytes);
+            if(!(b & 0x80))
+                break;
+        }
+        ++lengthBytes;
+        if(!fillTo(lengthBytes + length))
+            throw runtime_error("truncated record while merging");
+        r = ByteReader(&buffer[pos + lengthBytes], length);
+        pos += lengthBytes + length;
+        return true;
+    }
+};
+
+// Record file written behind the caller's back through AsyncWriter, at most the pool's pages in flight
+class AsyncRecordFileWriter{
+    promise<bool> written; // before file: ~AsyncWriter runs the last completion, which sets it
+    future<bool> done;
+    AsyncWriter file;
+    PagedAppender out;
+public:
+    AsyncRecordFileWriter(const string &path, const char *magic, PagePool &pool): file(path, true, false), out(file, pool){
+        out.append((const uint8_t*)magic, 8);
+    }
+
+    void write(const ByteWriter &record){
+        uint8_t length[10];
+        size_t n = 0;
+        for(uint64_t v = record.bytes.size(); ; v >>= 7){
+            length[n++] = uint8_t(v & 0x7F) | (v >= 0x80 ? 0x80 : 0);
+            if(v < 0x80)
+                break;
+        }
+        out.append(length, n);
+        out.append(record.bytes.data(), record.bytes.size());
+    }
+
+    void finish(){ // ships the last page without waiting for it; close() waits
+        done = written.get_future();
+        out.finish([this](bool ok){ written.set_value(ok); });
+    }
+
+    void close(){ // returns once everything is written
+        if(!done.valid())
+            finish();
+        if(!done.get())
+            throw runtime_error("write failed during external sort");
+    }
+};
+
+// k-way merge: each leaf is a sorted source, internal nodes remember the loser of the match played there and
+// node 0 the overall winner, so replacing the winner's record replays only its leaf-to-root path: log2(k) compares.
+template<typename Record, typename Less>
+class LoserTree{
+    vector<Record> heads;
+    vector<bool> exhausted;
+    vector<int> nodes;
+    Less less;
+
+    bool beats(int a, int b) const{ // ties go to the lower source, which keeps the merge stable
+        if(exhausted[a] || exhausted[b])
+            return !exhausted[a] && (exhausted[b] || a < b);
+        if(less(heads[a], heads[b]))
+            return true;
+        return !less(heads[b], heads[a]) && a < b;
+    }
+public:
+    LoserTree(size_t k, Less less): heads(k), exhausted(k, true), nodes(k), less(less) {}
+
+    Record& head(int source){
+        return heads[source];
+    }
+
+    // Call once every head has been loaded (or marked exhausted)
+    void build(){
+        size_t k = heads.size();
+        vector<int> winners(2 * k);
+        for(size_t i = 0; i < k; ++i)
+            winners[k + i] = (int)i;
+        for(size_t n = k - 1; n >= 1; --n){
+            int a = winners[2 * n], b = winners[2 * n + 1];
+            winners[n] = beats(a, b) ? a : b;
+            nodes[n] = beats(a, b) ? b : a;
+        }
+        nodes[0] = k > 1 ? winners[1] : 0;
+    }
+
+    void setExhausted(int source, bool done){
+        exhausted[source] = done;
+    }
+
+    int winner() const{
+        return nodes[0];
+    }
+
+    bool empty() const{
+        return exhausted[nodes[0]];
+    }
+
+    // After the winner's head has been replaced (or its source ran dry)
+    void replay(){
+        size_t k = heads.size();
+        int w = nodes[0];
+        for(size_t n = (w + k) / 2; n >= 1; n /= 2)
+            if(beats(nodes[n], w))
+                swap(nodes[n], w);
+        nodes[0] = w;
+    }
+};
+
+struct SortStats{
+    size_t records = 0, runs = 0, mergePasses = 0;
+};
+
+template<typename Record, typename Less>
+void mergeRuns(const vector<string> &runs, const string &outPath, Less less, PrefetchPool &prefetch, PagePool &pages,
+               size_t blockSize){
+    typedef RecordCodec<Record> Codec;
+    vector<unique_ptr<PrefetchingRecordReader>> inputs;
+    for(const string &run : runs)
+        inputs.emplace_back(new PrefetchingRecordReader(run, Codec::magic(), prefetch, blockSize));
+    LoserTree<Record, Less> tree(max<size_t>(inputs.size(), 1), less);
+    ByteReader r(nullptr, 0);
+    for(size_t i = 0; i < inputs.size(); ++i)
+        if(inputs[i]->next(r)){
+            Codec::decode(r, tree.head(i));
+            tree.setExhausted(i, false);
+        }
+    tree.build();
+    AsyncRecordFileWriter out(outPath, Codec::magic(), pages);
+    ByteWriter w;
+    while(!tree.empty()){
+        int source = tree.winner();
+        w.bytes.clear();
+        Codec::encode(w, tree.head(source));
+        out.write(w);
+        if(inputs[source]->next(r))
+            Codec::decode(r, tree.head(source));
+        else
+            tree.setExhausted(source, true);
+        tree.replay();
+    }
+    out.close();
+}
+
+// Sorts whatever next(record) yields into outPath using about memoryBudget bytes
+template<typename Record, typename Source, typename Less>
+SortStats externalSort(Source next, const string &outPath, Less less, size_t memoryBudget, size_t fanIn){
+    typedef RecordCodec<Record> Codec;
+    fanIn = max<size_t>(fanIn, 2);
+    size_t blockSize = clamp<size_t>(memoryBudget / (4 * fanIn), 16 << 10, 4 << 20);
+    PagePool pages(4, 256 << 10);
+    PrefetchPool prefetch;
+    SortStats stats;
+    vector<string> runs;
+    auto runName = [&]{ return outPath + ".run" + to_string(stats.runs++); };
+
+    // Run generation. A run is left writing when its batch has been handed over, and only closed once the next
+    // batch has been read, so its last pages go to disk while that happens.
+    vector<Record> batch;
+    size_t batchBytes = 0;
+    unique_ptr<AsyncRecordFileWriter> writing; // the previous run, still on its way to disk
+    auto spill = [&]{
+        if(writing){
+            writing->close();
+            writing.reset();
+        }
+        sort(batch.begin(), batch.end(), less);
+        runs.push_back(runName());
+        writing.reset(new AsyncRecordFileWriter(runs.back(), Codec::magic(), pages));
+        ByteWriter w;
+        for(const Record &r : batch){
+            w.bytes.clear();
+            Codec::encode(w, r);
+            writing->write(w);
+        }
+        writing->finish();
+        batch.clear();
+        batchBytes = 0;
+    };
+    Record record;
+    while(next(record)){
+        ++stats.records;
+        batchBytes += Codec::footprint(record);
+        batch.push_back(move(record));
+        record = Record();
+        if(batchBytes >= memoryBudget)
+            spill();
+    }
+    if(!batch.empty() || runs.empty())
+        spill();
+    writing->close();
+    writing.reset();
+    vector<Record>().swap(batch);
+
+    // Merge passes: groups of fanIn runs into longer runs until one pass can finish the job
+    while(runs.size() > fanIn){
+        vector<string> merged;
+        for(size_t i = 0; i < runs.size(); i += fanIn){
+            vector<string> group(runs.begin() + i, runs.begin() + min(runs.size(), i + fanIn));
+            merged.push_back(runName());
+            mergeRuns<Record>(group, merged.back(), less, prefetch, pages, blockSize);
+            for(const string &g : group)
+                remove(g.c_str());
+        }
+        runs.swap(merged);
+        ++stats.mergePasses;
+    }
+    mergeRuns<Record>(runs, outPath, less, prefetch, pages, blockSize);
+    ++stats.mergePasses;
+    for(const string &run : runs)
+        remove(run.c_str());
+    return stats;
+}
+
+// Sorted copy of a snapshot
+SortStats sortSnapshot(const string &inPath, const string &outPath, SortKey key, size_t memoryBudget = 64 << 20,
+                       size_t fanIn = 64){
+    SnapshotReader in(inPath);
+    return externalSort<RosterRow>([&](RosterRow &row){ return in.next(row); }, outPath, RowOrder{key}, memoryBudget, fanIn);
+}
+
+// Index over a snapshot, sorted by key; each entry points back at its row (see readRowAt)
+SortStats buildSortedIndex(const string &snapshotPath, const string &indexPath, SortKey key,
+                           size_t memoryBudget = 64 << 20, size_t fanIn = 64){
+    SnapshotReader in(snapshotPath);
+    RosterRow row;
+    return externalSort<IndexEntry>([&](IndexEntry &e){
+        if(!in.next(row))
+            return false;
+        e = {row.id, row.kind, row.age, row.salary, row.fees, move(row.name), in.recordOffset()};
+        return true;
+    }, indexPath, RowOrder{key}, memoryBudget, fanIn);
+}
+
+class SortedIndexReader{
+    RecordFileReader file;
+public:
+    explicit SortedIndexReader(const string &path): file(path, indexMagic, "a roster index") {}
+
+    bool next(IndexEntry &e){
+        ByteReader r(nullptr, 0);
+        if(!file.next(r))
+            return false;
+        RecordCodec<IndexEntry>::decode(r, e);
+        return true;
+    }
+};
+
+// ======= SHARED-MEMORY ROSTER =======
+// One flat copy of the roster in a POSIX shared-memory segment that any number of reporting processes map
+// read-only, so adding a reader costs page-table entries, not another roster. Layout:
+//   SharedHeader | SharedPerson[capacity] (sorted by id) | string arena
+// Nothing in the segment is a pointer: names and departments are offsets into the arena, so every process can map
+// it at a different address. A single writer updates it under a seqlock: the sequence is odd while a write is in
+// progress, and a reader retries whenever it saw an odd sequence or the sequence moved during its read.
+struct SharedHeader{
+    char magic[8];
+    atomic<uint64_t> sequence;
+    uint64_t capacity, count;
+    uint64_t arenaCapacity, arenaUsed;
+};
+
+struct SharedPerson{
+    char kind; // T, S, G or A as in RosterRow
+    uint8_t doingResearch;
+    int32_t id, age;
+    double salary, fees;
+    uint32_t name, nameLength, dept, deptLength; // arena offsets
+};
+
+class SharedRoster : public IRosterObserver{
+    string segment;
+    int fd = -1;
+    uint8_t *base = nullptr;
+    size_t length = 0;
+    bool writer;
+
+    SharedHeader& header() const{
+        return *(SharedHeader*)base;
+    }
+
+    SharedPerson* people() const{
+        return (SharedPerson*)(base + sizeof(SharedHeader));
+    }
+
+    char* arena() const{
+        return (char*)(people() + header().capacity);
+    }
+
+    // A torn read can see garbage offsets; clamp them so it stays inside the segment until the retry
+    string_view text(uint32_t offset, uint32_t size) const{
+        uint64_t limit = header().arenaCapacity;
+        if(offset > limit)
+            offset = (uint32_t)limit;
+        return string_view(arena() + offset, min<uint64_t>(size, limit - offset));
+    }
+
+    SharedPerson* find(int id, bool teacherSide){ // writer only
+        SharedPerson *first = people(), *last = people() + header().count;
+        SharedPerson *p = lower_bound(first, last, id, [](const SharedPerson &a, int key){ return a.id < key; });
+        for(; p != last && p->id == id; ++p)
+            if(teacherSide ? (p->kind == 'T' || p->kind == 'A') : p->kind != 'T')
+                return p;
+        return nullptr;
+    }
+
+    void map(int prot){
+        base = (uint8_t*)::mmap(nullptr, length, prot, MAP_SHARED, fd, 0);
+        if(base == MAP_FAILED)
+            throw runtime_error("cannot map " + segment + ": " + strerror(errno));
+    }
+public:
+    mutable atomic<size_t> retries{0}; // reads that had to start over because the writer got in the way
+
+    // Writer: creates (or replaces) the segment and mirrors salary/fee changes from the change feed, for the people
+    // of the roster last published only - another roster's teacher with the same id must not patch ours
+    SharedRoster(const string &segment, size_t capacity, size_t arenaBytes): segment(segment), writer(true){
+        fd = ::shm_open(segment.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+            throw runtime_error("cannot create " + segment + ": " + strerror(errno));
+        length = sizeof(SharedHeader) + capacity * sizeof(SharedPerson) + arenaBytes;
+        if(::ftruncate(fd, length) != 0)
+            throw runtime_error("cannot size " + segment + ": " + strerror(errno));
+        map(PROT_READ | PROT_WRITE);
+        SharedHeader *h = new(base) SharedHeader();
+        h->capacity = capacity;
+        h->arenaCapacity = arenaBytes;
+        memcpy(h->magic, "OOPSSHM1", 8); // last: a reader that sees the magic sees a usable header
+        RosterFeed::subscribe(this, RosterScope());
+    }
+
+    // Reader: maps an existing segment read-only
+    explicit SharedRoster(const string &segment): segment(segment), writer(false){
+        fd = ::shm_open(segment.c_str(), O_RDONLY, 0);
+        if(fd < 0)
+            throw runtime_error("cannot open " + segment + ": " + strerror(errno));
+        struct stat st;
+        if(::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SharedHeader))
+            throw runtime_error(segment + " is not a shared roster");
+        length = st.st_size;
+        map(PROT_READ);
+        if(memcmp(header().magic, "OOPSSHM1", 8) != 0)
+            throw runtime_error(segment + " is not a shared roster");
+    }
+
+    SharedRoster(const SharedRoster &) = delete;
+    SharedRoster& operator=(const SharedRoster &) = delete;
+
+    ~SharedRoster() override{
+        if(writer)
+            RosterFeed::unsubscribe(this);
+        ::munmap(base, length);
+        ::close(fd);
+        if(writer)
+            ::shm_unlink(segment.c_str()); // readers that still have it mapped keep their copy
+    }
+
+    // Runs fn(people, count) as one writer critical section
+    template<typename Fn>
+    void write(Fn fn){
+        SharedHeader &h = header();
+        uint64_t seq = h.sequence.load(memory_order_relaxed);
+        h.sequence.store(seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        fn(people(), h.count);
+        h.sequence.store(seq + 2, memory_order_release);
+    }
+
+    // Runs fn(const SharedPerson*, count) until it completes without a concurrent write and returns its result.
+    // fn may run more than once and may see torn data on the runs that get thrown away: it should only read.
+    template<typename Fn>
+    auto read(Fn fn) const{
+        const SharedHeader &h = header();
+        for(;;){
+            uint64_t before = h.sequence.load(memory_order_acquire);
+            if(before & 1){
+                ++retries;
+                this_thread::yield();
+                continue;
+            }
+            auto result = fn((const SharedPerson*)people(), (size_t)min(h.count, h.capacity));
+            atomic_thread_fence(memory_order_acquire);
+            if(h.sequence.load(memory_order_relaxed) == before)
+                return result;
+            ++retries;
+        }
+    }
+
+    // Replaces the whole contents with the roster
+    void publish(const Roster &roster){
+        vector<RosterRow> rows = rosterRows(roster);
+        sort(rows.begin(), rows.end(), [](const RosterRow &a, const RosterRow &b){ return a.id < b.id; });
+        size_t textBytes = 0;
+        for(const RosterRow &r : rows)
+            textBytes += r.name.size() + r.dept.size();
+        if(rows.size() > header().capacity || textBytes > header().arenaCapacity)
+            throw runtime_error("roster does not fit in " + segment);
+        write([&](SharedPerson *out, uint64_t &count){
+            uint64_t used = 0;
+            auto put = [&](const string &text){
+                memcpy(arena() + used, text.data(), text.size());
+                used += text.size();
+                return (uint32_t)(used - text.size());
+            };
+            for(size_t i = 0; i < rows.size(); ++i){
+                const RosterRow &r = rows[i];
+                out[i] = {r.kind, r.doingResearch, r.id, r.age, r.salary, r.fees,
+                          put(r.name), (uint32_t)r.name.size(), put(r.dept), (uint32_t)r.dept.size()};
+            }
+            count = rows.size();
+            header().arenaUsed = used;
+        });
+        RosterFeed::rescope(this, rosterScope(roster));
+    }
+
+    void salaryChanged(const Teacher &t, double) override{
+        write([&](SharedPerson *, uint64_t &){
+            if(SharedPerson *p = find(t.id, true))
+                p->salary = t.getSalary();
+        });
+    }
+
+    void feesChanged(const Student &s, double) override{
+        write([&](SharedPerson *, uint64_t &){
+            if(SharedPerson *p = find(s.id, false))
+                p->fees = s.getFees();
+        });
+    }
+
+    size_t size() const{
+        return read([](const SharedPerson *, size_t count){ return count; });
+    }
+
+    bool lookup(int id, RosterRow &out) const{
+        return read([&](const SharedPerson *people, size_t count){
+            const SharedPerson *p = lower_bound(people, people + count, id,
+                                                [](const SharedPerson &a, int key){ return a.id < key; });
+            if(p == people + count || p->id != id)
+                return false;
+            out.kind = p->kind;
+            out.id = p->id;
+            out.age = p->age;
+            out.name = string(text(p->name, p->nameLength));
+            out.dept = string(text(p->dept, p->deptLength));
+            out.salary = p->salary;
+            out.fees = p->fees;
+            out.doingResearch = p->doingResearch;
+            return true;
+        });
+    }
+
+    size_t segmentBytes() const{
+        return length;
+    }
+};
+
+// ======= QUERY SERVER =======
+// Lookups for other processes on the host over a Unix domain socket. Frames are little binary records:
+//   request:  uint32 length | uint8 op | uint32 tag | payload
+//   response: uint32 length | uint32 tag | uint8 status | payload
+// where length counts the bytes after itself. Clients may pipeline: the server answers every complete request it
+// has read in one go and sends all the answers back with a single write, matched up by tag.
+//   Info     int32 id               -> string (getInfo-style line)
+//   Eligible int32 id, uint8 hasSSN -> uint8
+//   Payroll  string dept ("" = all) -> double
+//   Count                           -> uint64
+// Answers come from a QuerySource, so the same server fronts a live roster (RosterIndex) or a replica. A server must
+// be driven (pollOnce/run) from the thread that updates its source, or while nothing does.
+enum class QueryOp : uint8_t { Info = 1, Eligible = 2, Payroll = 3, Count = 4 };
+enum class QueryStatus : uint8_t { Ok = 0, NotFound = 1, BadRequest = 2 };
+
+const size_t maxQueryFrame = 1 << 16;
+
+void frameRequest(ByteWriter &w, QueryOp op, uint32_t tag, const ByteWriter &payload = ByteWriter()){
+    w.put<uint32_t>(uint32_t(1 + 4 + payload.bytes.size()));
+    w.put<uint8_t>((uint8_t)op);
+    w.put<uint32_t>(tag);
+    w.bytes.insert(w.bytes.end(), payload.bytes.begin(), payload.bytes.end());
+}
+
+void frameResponse(vector<uint8_t> &out, uint32_t tag, QueryStatus status, const ByteWriter &payload = ByteWriter()){
+    ByteWriter w;
+    w.put<uint32_t>(uint32_t(4 + 1 + payload.bytes.size()));
+    w.put<uint32_t>(tag);
+    w.put<uint8_t>((uint8_t)status);
+    out.insert(out.end(), w.bytes.begin(), w.bytes.end());
+    out.insert(out.end(), payload.bytes.begin(), payload.bytes.end());
+}
+
+sockaddr_un unixAddress(const string &path){
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path))
+        throw runtime_error("socket path too long: " + path);
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+void makeNonBlocking(int fd){
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Non-blocking listening socket at path (replacing a stale one)
+int listenUnix(const string &path){
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = unixAddress(path);
+    ::unlink(path.c_str());
+    if(fd < 0 || ::bind(fd, (sockaddr*)&addr, sizeof addr) != 0 || ::listen(fd, 128) != 0)
+        throw runtime_error("cannot listen on " + path + ": " + strerror(errno));
+    makeNonBlocking(fd);
+    return fd;
+}
+
+// Blocking connection to the socket at path
+int connectUnix(const string &path){
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = unixAddress(path);
+    if(fd < 0 || ::connect(fd, (sockaddr*)&addr, sizeof addr) != 0){
+        string error = strerror(errno);
+        if(fd >= 0)
+            ::close(fd);
+        throw runtime_error("cannot connect to " + path + ": " + error);
+    }
+    return fd;
+}
+
+// Appends everything a non-blocking socket has to offer; false once the peer has gone away
+bool readAvailable(int fd, vector<uint8_t> &in){
+    uint8_t chunk[16384];
+    for(;;){
+        ssize_t n = ::read(fd, chunk, sizeof chunk);
+        if(n > 0){
+            in.insert(in.end(), chunk, chunk + n);
+            continue;
+        }
+        if(n == 0)
+            return false;
+        if(errno == EINTR)
+            continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+}
+
+// Writes as much of out[sent..] as the socket takes; out is cleared once it has all gone. False on a dead peer.
+bool flushPending(int fd, vector<uint8_t> &out, size_t &sent){
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL; // a peer hanging up mid-answer must not kill us with SIGPIPE
+#else
+    const int flags = 0;
+#endif
+    while(sent < out.size()){
+        ssize_t n = ::send(fd, out.data() + sent, out.size() - sent, flags);
+        if(n < 0){
+            if(errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        sent += n;
+    }
+    out.clear();
+    sent = 0;
+    return true;
+}
+
+// Readiness of a changing set of fds, level-triggered. epoll on Linux, so a wait costs the fds that are ready rather
+// than every fd registered; poll where there is no epoll (or epoll_create1 fails).
+class Poller{
+public:
+    static const uint32_t Readable = 1, Writable = 2, Closed = 4;
+    struct Event{
+        int fd;
+        uint32_t ready;
+    };
+
+    Poller(){
+#ifdef __linux__
+        epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+#endif
+    }
+
+    Poller(const Poller &) = delete;
+    Poller& operator=(const Poller &) = delete;
+
+    ~Poller(){
+#ifdef __linux__
+        if(epollFd >= 0)
+            ::close(epollFd);
+#endif
+    }
+
+    const char* backend() const{
+#ifdef __linux__
+        if(epollFd >= 0)
+            return "epoll";
+#endif
+        return "poll";
+    }
+
+    void add(int fd, bool writable = false){
+#ifdef __linux__
+        if(epollFd >= 0){
+            epoll_event e = interest(fd, writable);
+            ::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &e);
+            return;
+        }
+#endif
+        slot[fd] = fds.size();
+        fds.push_back({fd, short(POLLIN | (writable ? POLLOUT : 0)), 0});
+    }
+
+    void watchWrites(int fd, bool writable){
+#ifdef __linux__
+        if(epollFd >= 0){
+            epoll_event e = interest(fd, writable);
+            ::epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &e);
+            return;
+        }
+#endif
+        fds[slot.at(fd)].events = short(POLLIN | (writable ? POLLOUT : 0));
+    }
+
+    void remove(int fd){ // before closing fd
+#ifdef __linux__
+        if(epollFd >= 0){
+            ::epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            return;
+        }
+#endif
+        size_t at = slot.at(fd);
+        fds[at] = fds.back();
+        slot[fds[at].fd] = at;
+        fds.pop_back();
+        slot.erase(fd);
+    }
+
+    // Waits up to timeoutMs and fills ready with the fds that have something to do; returns how many
+    size_t wait(vector<Event> &ready, int timeoutMs){
+        ready.clear();
+#ifdef __linux__
+        if(epollFd >= 0){
+            epoll_event events[64];
+            int n = ::epoll_wait(epollFd, events, 64, timeoutMs);
+            for(int i = 0; i < n; ++i)
+                ready.push_back({events[i].data.fd, (events[i].events & EPOLLIN ? Readable : 0u) | (events[i].events & EPOLLOUT ? Writable : 0u)
+                                                    | (events[i].events & (EPOLLHUP | EPOLLERR) ? Closed : 0u)});
+            return ready.size();
+        }
+#endif
+        if(::poll(fds.data(), fds.size(), timeoutMs) <= 0)
+            return 0;
+        for(const pollfd &p : fds)
+            if(p.revents)
+                ready.push_back({p.fd, (p.revents & POLLIN ? Readable : 0u) | (p.revents & POLLOUT ? Writable : 0u)
+                                       | (p.revents & (POLLHUP | POLLERR) ? Closed : 0u)});
+        return ready.size();
+    }
+
+private:
+#ifdef __linux__
+    int epollFd = -1;
+
+    static epoll_event interest(int fd, bool writable){
+        epoll_event e{};
+        e.events = EPOLLIN | (writable ? (uint32_t)EPOLLOUT : 0u);
+        e.data.fd = fd;
+        return e;
+    }
+#endif
+    vector<pollfd> fds; // fallback only
+    unordered_map<int, size_t> slot; // fd -> index in fds
+};
+
+// What a query server can be asked; every lookup returns false when it knows nothing about the id/department
+class QuerySource{
+public:
+    virtual bool describe(int id, string &line) const = 0; // getInfo-style one-liner
+    virtual bool isVoteEligible(int id, bool hasSSN, bool &eligible) const = 0;
+    virtual bool payroll(const string &dept, double &total) const = 0; // dept "" = everybody
+    virtual uint64_t count() const = 0;
+    virtual ~QuerySource() = default;
+};
+
+string describeTeacher(int id, const string &name, const string &dept, double salary){
+    ostringstream line;
+    line<<"#"<<id<<": "<<name<<" from "<<dept<<" dept, earns $"<<salary<<"/yr!";
+    return line.str();
+}
+
+string describeStudent(int id, const string &name, int age, double fees){
+    ostringstream line;
+    line<<"#"<<id<<": "<<name<<", Age: "<<age<<", pays="<<fees;
+    return line.str();
+}
+
+// Lookup tables over a live roster: built once from the roster, then kept current from the change feed
+class RosterIndex : public IRosterObserver, public QuerySource{
+    unordered_map<int, const Student*> studentsById;
+    unordered_map<int, const Teacher*> teachersById;
+    unordered_set<const Teacher*> onPayroll; // whose salary is in the totals: only theirs ever comes out again
+    DeptMap<double> payrollByDept;
+    double payrollTotal = 0;
+public:
+    explicit RosterIndex(const Roster &roster){
+        for(Teacher *t : roster.allTeachers())
+            teacherAdded(*t);
+        for(Student *s : roster.allStudents())
+            studentAdded(*s);
+        RosterFeed::subscribe(this);
+    }
+
+    RosterIndex(const RosterIndex &) = delete;
+    RosterIndex& operator=(const RosterIndex &) = delete;
+
+    ~RosterIndex() override{
+        RosterFeed::unsubscribe(this);
+    }
+
+    bool describe(int id, string &line) const override{
+        if(auto s = studentsById.find(id); s != studentsById.end())
+            line = describeStudent(id, s->second->name, s->second->age, s->second->getFees());
+        else if(auto t = teachersById.find(id); t != teachersById.end())
+            line = describeTeacher(id, t->second->name, t->second->dept, t->second->getSalary());
+        else
+            return false;
+        return true;
+    }
+
+    bool isVoteEligible(int id, bool hasSSN, bool &eligible) const override{
+        auto s = studentsById.find(id);
+        if(s == studentsById.end())
+            return false;
+        eligible = s->second->isVoteEligible(hasSSN);
+        return true;
+    }
+
+    bool payroll(const string &dept, double &total) const override{
+        if(dept.empty()){
+            total = payrollTotal;
+            return true;
+        }
+        const double *d = payrollByDept.find(dept);
+        if(!d)
+            return false;
+        total = *d;
+        return true;
+    }
+
+    uint64_t count() const override{
+        return studentsById.size() + teachersById.size();
+    }
+
+    void teacherAdded(const Teacher &t) override{
+        teachersById[t.id] = &t;
+        if(!onPayroll.insert(&t).second)
+            return;
+        payrollByDept[t.dept] += t.getSalary();
+        payrollTotal += t.getSalary();
+    }
+
+    void teacherRemoved(const Teacher &t) override{
+        auto it = teachersById.find(t.id);
+        if(it != teachersById.end() && it->second == &t)
+            teachersById.erase(it);
+        if(!onPayroll.erase(&t))
+            return;
+        payrollByDept[t.dept] -= t.getSalary();
+        payrollTotal -= t.getSalary();
+    }
+
+    void salaryChanged(const Teacher &t, double oldSalary) override{
+        if(!onPayroll.count(&t))
+            return;
+        payrollByDept[t.dept] += t.getSalary() - oldSalary;
+        payrollTotal += t.getSalary() - oldSalary;
+    }
+
+    void studentAdded(const Student &s) override{
+        studentsById[s.id] = &s;
+    }
+
+    void studentRemoved(const Student &s) override{
+        auto it = studentsById.find(s.id);
+        if(it != studentsById.end() && it->second == &s)
+            studentsById.erase(it);
+    }
+};
+
+class RosterServer{
+    struct Connection{
+        int fd;
+        vector<uint8_t> in, out;
+        size_t sent = 0; // bytes of out already written
+        bool writing = false; // registered for writability: an answer is waiting for room in the socket
+    };
+
+    string path;
+    int listener;
+    const QuerySource &source;
+    unordered_map<int, Connection> connections; // by fd
+    Poller poller;
+    vector<Poller::Event> events;
+
+    void answer(ByteReader &request, vector<uint8_t> &out){
+        QueryOp op = (QueryOp)request.get<uint8_t>();
+        uint32_t tag = request.get<uint32_t>();
+        ByteWriter reply;
+        switch(op){
+            case QueryOp::Info: {
+                string line;
+                if(!source.describe(request.get<int32_t>(), line))
+                    return frameResponse(out, tag, QueryStatus::NotFound);
+                reply.str(line);
+                break;
+            }
+            case QueryOp::Eligible: {
+                int id = request.get<int32_t>();
+                bool hasSSN = request.get<uint8_t>() != 0, eligible;
+                if(!source.isVoteEligible(id, hasSSN, eligible))
+                    return frameResponse(out, tag, QueryStatus::NotFound);
+                reply.put<uint8_t>(eligible);
+                break;
+            }
+            case QueryOp::Payroll: {
+                double total;
+                if(!source.payroll(request.str(), total))
+                    return frameResponse(out, tag, QueryStatus::NotFound);
+                reply.put<double>(total);
+                break;
+            }
+            case QueryOp::Count:
+                reply.put<uint64_t>(source.count());
+                break;
+            default:
+                return frameResponse(out, tag, QueryStatus::BadRequest);
+        }
+        ++requestsServed;
+        frameResponse(out, tag, QueryStatus::Ok, reply);
+    }
+
+    // Answers every complete request in c.in. False means the peer sent garbage and should be dropped.
+    bool handleRequests(Connection &c){
+        size_t at = 0;
+        while(c.in.size() - at >= 4){
+            uint32_t length;
+            memcpy(&length, &c.in[at], 4);
+            if(length < 5 || length > maxQueryFrame)
+                return false;
+            if(c.in.size() - at - 4 < length)
+                break;
+            ByteReader request(&c.in[at + 4], length);
+            try{
+                answer(request, c.out);
+            }
+            catch(const runtime_error &){ // truncated payload
+                return false;
+            }
+            at += 4 + length;
+        }
+        c.in.erase(c.in.begin(), c.in.begin() + at);
+        return true;
+    }
+
+public:
+    size_t requestsServed = 0;
+
+    RosterServer(const string &path, const QuerySource &source): path(path), listener(listenUnix(path)), source(source){
+        poller.add(listener);
+    }
+
+    RosterServer(const RosterServer &) = delete;
+    RosterServer& operator=(const RosterServer &) = delete;
+
+    ~RosterServer(){
+        for(auto &c : connections)
+            ::close(c.first);
+        ::close(listener);
+        ::unlink(path.c_str());
+    }
+
+    const char* backend() const{
+        return poller.backend();
+    }
+
+    // One round of the event loop: wait up to timeoutMs for readiness, then accept, read, answer and write
+    void pollOnce(int timeoutMs){
+        if(poller.wait(events, timeoutMs) == 0)
+            return;
+        bool accepting = false;
+        for(const Poller::Event &e : events){
+            if(e.fd == listener){
+                accepting = true;
+                continue;
+            }
+            auto it = connections.find(e.fd);
+            if(it == connections.end())
+                continue;
+            Connection &c = it->second;
+            bool open = true;
+            if(e.ready & (Poller::Readable | Poller::Closed))
+                open = readAvailable(c.fd, c.in);
+            open = handleRequests(c) && open;
+            open = flushPending(c.fd, c.out, c.sent) && open;
+            if(!open){
+                poller.remove(c.fd);
+                ::close(c.fd);
+                connections.erase(it);
+            }
+            else if(c.writing != !c.out.empty()){
+                c.writing = !c.out.empty();
+                poller.watchWrites(c.fd, c.writing);
+            }
+        }
+        if(accepting)
+            for(int fd; (fd = ::accept(listener, nullptr, nullptr)) >= 0;){
+                makeNonBlocking(fd);
+                poller.add(fd);
+                connections.emplace(fd, Connection{fd, {}, {}, 0, false});
+            }
+    }
+
+    void run(const atomic<bool> &stop){
+        while(!stop)
+            pollOnce(20);
+    }
+};
+
+struct QueryResponse{
+    uint32_t tag = 0;
+    QueryStatus status = QueryStatus::Ok;
+    vector<uint8_t> payload;
+};
+
+// Blocking client; send() and receive() can be used directly to keep several requests in flight
+class RosterClient{
+    int fd;
+    vector<uint8_t> in;
+    size_t consumed = 0;
+    uint32_t nextTag = 0;
+
+    QueryResponse call(QueryOp op, const ByteWriter &payload){
+        ByteWriter w;
+        frameRequest(w, op, nextTag++, payload);
+        send(w.bytes);
+        QueryResponse r;
+        if(!receive(r))
+            throw runtime_error("query server hung up");
+        return r;
+    }
+public:
+    explicit RosterClient(const string &path): fd(connectUnix(path)) {}
+
+    RosterClient(const RosterClient &) = delete;
+    RosterClient& operator=(const RosterClient &) = delete;
+
+    ~RosterClient(){
+        ::close(fd);
+    }
+
+    void send(const vector<uint8_t> &frames){
+        for(size_t at = 0; at < frames.size();){
+            ssize_t n = ::write(fd, frames.data() + at, frames.size() - at);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                throw runtime_error(string("query send failed: ") + strerror(errno));
+            at += n;
+        }
+    }
+
+    bool receive(QueryResponse &r){
+        for(;;){
+            size_t available = in.size() - consumed;
+            if(available >= 4){
+                uint32_t length;
+                memcpy(&length, &in[consumed], 4);
+                if(length < 5 || length > maxQueryFrame)
+                    throw runtime_error("bad response frame");
+                if(available - 4 >= length){
+                    memcpy(&r.tag, &in[consumed + 4], 4);
+                    r.status = (QueryStatus)in[consumed + 8];
+                    r.payload.assign(in.begin() + consumed + 9, in.begin() + consumed + 4 + length);
+                    consumed += 4 + length;
+                    return true;
+                }
+            }
+            if(consumed > 0){
+                in.erase(in.begin(), in.begin() + consumed);
+                consumed = 0;
+            }
+            uint8_t chunk[16384];
+            ssize_t n = ::read(fd, chunk, sizeof chunk);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return false;
+            in.insert(in.end(), chunk, chunk + n);
+        }
+    }
+
+    string info(int id){
+        ByteWriter p;
+        p.put<int32_t>(id);
+        QueryResponse r = call(QueryOp::Info, p);
+        if(r.status != QueryStatus::Ok)
+            return "";
+        ByteReader out(r.payload.data(), r.payload.size());
+        return out.str();
+    }
+
+    bool isVoteEligible(int id, bool hasSSN){
+        ByteWriter p;
+        p.put<int32_t>(id);
+        p.put<uint8_t>(hasSSN);
+        QueryResponse r = call(QueryOp::Eligible, p);
+        return r.status == QueryStatus::Ok && r.payload.at(0) != 0;
+    }
+
+    double payroll(const string &dept = ""){
+        ByteWriter p;
+        p.str(dept);
+        QueryResponse r = call(QueryOp::Payroll, p);
+        if(r.status != QueryStatus::Ok)
+            return 0;
+        ByteReader out(r.payload.data(), r.payload.size());
+        return out.get<double>();
+    }
+
+    uint64_t count(){
+        QueryResponse r = call(QueryOp::Count, ByteWriter());
+        ByteReader out(r.payload.data(), r.payload.size());
+        return out.get<uint64_t>();
+    }
+};
+
+string latencySummary(vector<double> us){
+    if(us.empty())
+        return "";
+    sort(us.begin(), us.end());
+    auto at = [&](double q){ return us[min(us.size() - 1, (size_t)(q * us.size()))]; };
+    ostringstream out;
+    out<<"latency p50 "<<at(0.5)<<" us, p99 "<<at(0.99)<<" us, p999 "<<at(0.999)<<" us, max "<<us.back()<<" us";
+    return out.str();
+}
+
+struct LoadReport{
+    size_t requests = 0;
+    double seconds = 0;
+    vector<double> latencyUs;
+
+    string summary() const{
+        ostringstream out;
+        out<<requests<<" requests, "<<(size_t)(requests / seconds)<<" req/s, "<<latencySummary(latencyUs);
+        return out.str();
+    }
+};
+
+// Load generator: `connections` clients driven from one event loop (a Poller), each keeping up to `pipelineDepth`
+// requests in flight, with a 70/20/10 mix of Info/Eligible/Payroll over the given ids. Latency is measured from a
+// request's send to its response.
+LoadReport generateLoad(const string &path, const vector<int> &ids, size_t connections, size_t requestsPerConnection,
+                        size_t pipelineDepth){
+    struct Client{
+        int fd = -1;
+        vector<uint8_t> in, out;
+        size_t sent = 0, received = 0; // requests framed, responses matched
+        size_t written = 0;            // bytes of out already on the socket
+        bool writing = false;
+        vector<chrono::steady_clock::time_point> sentAt;
+    };
+    LoadReport report;
+    Poller poller;
+    vector<Client> clients(connections);
+    unordered_map<int, Client*> byFd;
+
+    auto fill = [&](Client &client, size_t c){ // tops the pipeline up to pipelineDepth
+        ByteWriter frames;
+        for(; client.sent < requestsPerConnection && client.sent - client.received < pipelineDepth; ++client.sent){
+            ByteWriter p;
+            int id = ids[(client.sent * 7919 + c * 104729) % ids.size()];
+            QueryOp op = client.sent % 10 < 7 ? QueryOp::Info : client.sent % 10 < 9 ? QueryOp::Eligible : QueryOp::Payroll;
+            if(op == QueryOp::Payroll)
+                p.str("");
+            else
+                p.put<int32_t>(id);
+            if(op == QueryOp::Eligible)
+                p.put<uint8_t>(1);
+            frameRequest(frames, op, (uint32_t)client.sent, p);
+            client.sentAt[client.sent] = chrono::steady_clock::now();
+        }
+        client.out.insert(client.out.end(), frames.bytes.begin(), frames.bytes.end());
+    };
+    size_t active = 0;
+    auto finish = [&](Client &client){
+        poller.remove(client.fd);
+        byFd.erase(client.fd);
+        ::close(client.fd);
+        client.fd = -1;
+        --active;
+    };
+
+    auto start = chrono::steady_clock::now();
+    for(size_t c = 0; c < connections; ++c){
+        Client &client = clients[c];
+        client.fd = connectUnix(path);
+        makeNonBlocking(client.fd);
+        client.sentAt.resize(requestsPerConnection);
+        poller.add(client.fd);
+        byFd[client.fd] = &client;
+        ++active;
+        fill(client, c);
+        if(!flushPending(client.fd, client.out, client.written) || requestsPerConnection == 0)
+            finish(client);
+        else if(!client.out.empty())
+            poller.watchWrites(client.fd, client.writing = true);
+    }
+
+    vector<Poller::Event> events;
+    while(active > 0){
+        poller.wait(events, 100);
+        for(const Poller::Event &e : events){
+            auto found = byFd.find(e.fd);
+            if(found == byFd.end())
+                continue;
+            Client &client = *found->second;
+            bool open = true;
+            if(e.ready & (Poller::Readable | Poller::Closed))
+                open = readAvailable(client.fd, client.in);
+            size_t at = 0;
+            while(client.in.size() - at >= 4){
+                uint32_t length, tag;
+                memcpy(&length, &client.in[at], 4);
+                if(length < 5 || length > maxQueryFrame){
+                    open = false;
+                    break;
+                }
+                if(client.in.size() - at - 4 < length)
+                    break;
+                memcpy(&tag, &client.in[at + 4], 4);
+                if(tag < client.sent)
+                    report.latencyUs.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - client.sentAt[tag]).count());
+                ++client.received;
+                at += 4 + length;
+            }
+            client.in.erase(client.in.begin(), client.in.begin() + at);
+            fill(client, &client - clients.data());
+            open = flushPending(client.fd, client.out, client.written) && open;
+            if(!open || client.received >= requestsPerConnection)
+                finish(client);
+            else if(client.writing != !client.out.empty()){
+                client.writing = !client.out.empty();
+                poller.watchWrites(client.fd, client.writing);
+            }
+        }
+    }
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    report.requests = report.latencyUs.size();
+    return report;
+}
+
+// ======= METRICS EXPORT =======
+// Scrape-time families on top of the METRICS registry, and two ways out: a file that a node_exporter textfile
+// collector can pick up, and a tiny HTTP/1.0 endpoint on a Unix socket (curl --unix-socket path http://x/metrics).
+
+// oops_population / oops_live_objects from Teacher's count and the part gauges, and oops_op_latency_seconds from
+// the LatencyRecorder histograms (empty unless built with -DOOPS_INSTRUMENT)
+void installRosterCollectors(){
+    static once_flag installed;
+    call_once(installed, []{
+        CoreMetrics::get();
+        MetricsRegistry::global().collect([](ostream &out){
+            CoreMetrics &m = CoreMetrics::get();
+            int64_t tas = m.tas.value(), grads = m.gradStudents.value();
+            int64_t teachers = Teacher::getTeacherCount() - tas, students = m.studentParts.value() - grads - tas;
+            out<<"# HELP oops_population People alive (a TA counts once)\n# TYPE oops_population gauge\n";
+            writeSample(out, "oops_population", "", teachers + students + grads + tas);
+            out<<"# HELP oops_live_objects Live objects by most-derived class\n# TYPE oops_live_objects gauge\n";
+            writeSample(out, "oops_live_objects", metricLabels({{"class", "Teacher"}}), teachers);
+            writeSample(out, "oops_live_objects", metricLabels({{"class", "Student"}}), students);
+            writeSample(out, "oops_live_objects", metricLabels({{"class", "GradStudent"}}), grads);
+            writeSample(out, "oops_live_objects", metricLabels({{"class", "TA"}}), tas);
+        });
+        MetricsRegistry::global().collect([](ostream &out){
+            static const vector<double> bounds = {50e-9, 100e-9, 250e-9, 500e-9, 1e-6, 2.5e-6, 5e-6, 10e-6, 25e-6, 100e-6, 1e-3};
+            bool header = false;
+            for(int op = 0; op < (int)TimedOp::Count; ++op){
+                vector<uint64_t> counts = LatencyRecorder::merged((TimedOp)op);
+                if(accumulate(counts.begin(), counts.end(), (uint64_t)0) == 0)
+                    continue;
+                double scale = LatencyRecorder::nsPerTick() * 1e-9;
+                MetricHistogram converted(bounds); // each HDR bucket lands whole in the first bound above its top
+                for(int i = 0; i < LatencyHistogram::bucketCount; ++i)
+                    if(counts[i])
+                        converted.observe(LatencyHistogram::highestOf(i) * scale, counts[i]);
+                if(!header)
+                    out<<"# HELP oops_op_latency_seconds Latency of instrumented operations\n# TYPE oops_op_latency_seconds histogram\n";
+                header = true;
+                converted.render(out, "oops_op_latency_seconds", metricLabels({{"op", LatencyRecorder::name((TimedOp)op)}}));
+            }
+        });
+    });
+}
+
+string metricsText(){
+    installRosterCollectors();
+    ostringstream out;
+    MetricsRegistry::global().exposition(out);
+    return out.str();
+}
+
+// Written beside path and renamed over it, so a collector never reads half a scrape
+void writeMetricsFile(const string &path){
+    string temp = path + ".tmp", text = metricsText();
+    {
+        ofstream out(temp, ios::binary | ios::trunc);
+        out<<text;
+        if(!out.flush())
+            throw runtime_error("cannot write " + temp);
+    }
+    if(::rename(temp.c_str(), path.c_str()) != 0)
+        throw runtime_error("cannot rename " + temp + ": " + strerror(errno));
+}
+
+// Same event loop shape as RosterServer: every connection gets the current exposition once its request headers are
+// in, then is closed
+class MetricsEndpoint{
+    struct Connection{
+        int fd;
+        vector<uint8_t> in, out;
+        size_t sent = 0;
+        bool answered = false;
+    };
+
+    string path;
+    int listener;
+    vector<Connection> connections;
+
+    void answer(Connection &c){
+        string body = metricsText();
+        string head = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                      + to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+        c.out.assign(head.begin(), head.end());
+        c.out.insert(c.out.end(), body.begin(), body.end());
+        c.answered = true;
+        ++scrapes;
+    }
+public:
+    size_t scrapes = 0;
+
+    explicit MetricsEndpoint(const string &path): path(path), listener(listenUnix(path)){
+        installRosterCollectors();
+    }
+
+    MetricsEndpoint(const MetricsEndpoint &) = delete;
+    MetricsEndpoint& operator=(const MetricsEndpoint &) = delete;
+
+    ~MetricsEndpoint(){
+        for(Connection &c : connections)
+            ::close(c.fd);
+        ::close(listener);
+        ::unlink(path.c_str());
+    }
+
+    void pollOnce(int timeoutMs){
+        vector<pollfd> fds;
+        fds.push_back({listener, POLLIN, 0});
+        for(Connection &c : connections)
+            fds.push_back({c.fd, short(c.answered ? POLLOUT : POLLIN), 0});
+        if(::poll(fds.data(), fds.size(), timeoutMs) <= 0)
+            return;
+        vector<bool> keep(connections.size(), true);
+        for(size_t i = 0; i < connections.size(); ++i){
+            short ready = fds[i + 1].revents;
+            if(!ready)
+                continue;
+            Connection &c = connections[i];
+            bool open = true;
+            if(!c.answered){
+                open = readAvailable(c.fd, c.in);
+                static const char end[] = "\r\n\r\n";
+                if(search(c.in.begin(), c.in.end(), end, end + 4) != c.in.end())
+                    answer(c);
+                else if(c.in.size() > maxQueryFrame)
+                    open = false;
+            }
+            keep[i] = c.answered ? flushPending(c.fd, c.out, c.sent) && !c.out.empty() : open;
+        }
+        for(size_t i = connections.size(); i-- > 0;)
+            if(!keep[i]){
+                ::close(connections[i].fd);
+                connections.erase(connections.begin() + i);
+            }
+        if(fds[0].revents & POLLIN)
+            for(int fd; (fd = ::accept(listener, nullptr, nullptr)) >= 0;){
+                makeNonBlocking(fd);
+                connections.push_back({fd, {}, {}, 0, false});
+            }
+    }
+
+    void run(const atomic<bool> &stop){
+        while(!stop)
+            pollOnce(20);
+    }
+};
+
+// Blocking GET /metrics against a MetricsEndpoint; returns the body
+string scrapeMetrics(const string &path){
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = unixAddress(path);
+    if(fd < 0 || ::connect(fd, (sockaddr*)&addr, sizeof addr) != 0){
+        if(fd >= 0)
+            ::close(fd);
+        throw runtime_error("cannot connect to " + path + ": " + strerror(errno));
+    }
+    const string request = "GET /metrics HTTP/1.0\r\n\r\n";
+    string response;
+    bool ok = ::write(fd, request.data(), request.size()) == (ssize_t)request.size();
+    char chunk[16384];
+    for(ssize_t n; ok && ((n = ::read(fd, chunk, sizeof chunk)) > 0 || (n < 0 && errno == EINTR));)
+        if(n > 0)
+            response.append(chunk, n);
+    ::close(fd);
+    size_t body = response.find("\r\n\r\n");
+    if(!ok || response.compare(0, 12, "HTTP/1.0 200") != 0 || body == string::npos)
+        throw runtime_error("bad metrics response from " + path);
+    return response.substr(body + 4);
+}
+
+// ======= MERKLE DIGESTS =======
+// Hash tree over roster records. Every Teacher part and Student part (a TA is both) is a record keyed by (side, id)
+// and hashed over what rowOf captures: id, name, dept and salary, or id, name, age, fees and the matrix. Students
+// carry no marks, so there are none to hash. The tree is a binary trie on the bits of mix64(key): a node over at
+// most leafCapacity keys is a leaf, larger ones split in two, so depth tracks log(n) and the shape depends only on
+// the key set. A leaf is the sum of its records' mixed hashes, so records come and go in any order in O(1) plus the
+// O(log n) path up; an inner node hashes its two children. Equal roots mean equal rosters (up to 64-bit collisions)
+// and diff() only descends where the two trees disagree: O(d log n) for d differing records.
+uint64_t mix64(uint64_t x){ // splitmix64 finalizer
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t hashCombine(uint64_t h, uint64_t v){ // order-sensitive
+    return mix64(h ^ mix64(v));
+}
+
+uint64_t hashBytes(uint64_t h, string_view s){
+    h = hashCombine(h, s.size());
+    size_t i = 0;
+    for(; i + 8 <= s.size(); i += 8){
+        uint64_t word;
+        memcpy(&word, s.data() + i, 8);
+        h = hashCombine(h, word);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, s.data() + i, s.size() - i);
+    return hashCombine(h, tail);
+}
+
+uint64_t hashDouble(uint64_t h, double v){
+    uint64_t bits;
+    memcpy(&bits, &v, 8);
+    return hashCombine(h, bits);
+}
+
+// Hash of a Teacher (kind 'T') or Student (any other kind) record. An empty matrix stands for the constructor's
+// i + j pattern, which is how rowOf reports it, so a copy that spelled the pattern out would hash differently.
+uint64_t recordHash(const RosterRow &r){
+    bool teacher = r.kind == 'T';
+    uint64_t h = hashCombine(teacher ? 1 : 2, (uint32_t)r.id);
+    h = hashBytes(h, r.name);
+    if(teacher)
+        return hashDouble(hashBytes(h, r.dept), r.salary);
+    h = hashCombine(hashDouble(hashCombine(h, (uint32_t)r.age), r.fees), (uint32_t)r.size);
+    h = hashCombine(h, r.matrix.size());
+    for(int v : r.matrix)
+        h = hashCombine(h, (uint32_t)v);
+    return h;
+}
+
+class MerkleTree{
+    static const size_t leafCapacity = 16; // a node over more records than this is split by the next key bit
+
+    struct Node{
+        uint64_t hash = 0;
+        size_t records = 0;                     // keys below this node
+        unordered_map<uint64_t, uint64_t> sums; // leaf: key -> sum of the hashes of its records
+        unique_ptr<Node> child[2];              // both set for an inner node
+    };
+
+    Node top;
+
+    static int bit(uint64_t key, int level){
+        return mix64(key) >> (63 - level) & 1;
+    }
+
+    static uint64_t entryHash(uint64_t key, uint64_t sum){
+        return sum ? hashCombine(key, sum) : 0;
+    }
+
+    static void gather(const Node &n, unordered_map<uint64_t, uint64_t> &into){
+        if(!n.child[0]){
+            into.insert(n.sums.begin(), n.sums.end());
+            return;
+        }
+        gather(*n.child[0], into);
+        gather(*n.child[1], into);
+    }
+
+    static void rehash(Node &n){
+        uint64_t left = n.child[0]->hash, right = n.child[1]->hash;
+        n.hash = left | right ? hashCombine(left, right) : 0;
+    }
+
+    // mix64 is a bijection, so distinct keys part ways within 64 levels
+    static void split(Node &n, int level){
+        n.child[0].reset(new Node);
+        n.child[1].reset(new Node);
+        for(auto &[key, sum] : n.sums){
+            Node &c = *n.child[bit(key, level)];
+            c.sums.emplace(key, sum);
+            c.hash += entryHash(key, sum);
+            ++c.records;
+        }
+        unordered_map<uint64_t, uint64_t>().swap(n.sums);
+        for(auto &c : n.child)
+            if(c->records > leafCapacity)
+                split(*c, level + 1);
+        rehash(n);
+    }
+
+    static void merge(Node &n){
+        gather(n, n.sums);
+        n.child[0].reset();
+        n.child[1].reset();
+        n.hash = 0;
+        for(auto &[key, sum] : n.sums)
+            n.hash += entryHash(key, sum);
+    }
+
+    // Returns how many keys appeared (1) or went (-1) below n
+    static int change(Node &n, int level, uint64_t key, uint64_t delta){
+        int added;
+        if(n.child[0]){
+            added = change(*n.child[bit(key, level)], level + 1, key, delta);
+            n.records += added;
+            if(n.records > leafCapacity)
+                rehash(n);
+            else
+                merge(n);
+            return added;
+        }
+        auto [it, fresh] = n.sums.try_emplace(key, 0);
+        uint64_t before = entryHash(key, it->second);
+        it->second += delta;
+        n.hash += entryHash(key, it->second) - before;
+        added = fresh;
+        if(it->second == 0){
+            n.sums.erase(it);
+            --added;
+        }
+        n.records += added;
+        if(n.records > leafCapacity)
+            split(n, level);
+        return added;
+    }
+
+    static size_t count(const Node &n){
+        return n.child[0] ? 1 + count(*n.child[0]) + count(*n.child[1]) : 1;
+    }
+public:
+    static uint64_t key(const RosterRow &r){
+        return (uint64_t)(r.kind == 'T') << 32 | (uint32_t)r.id;
+    }
+
+    static string keyName(uint64_t key){
+        return string(key >> 32 ? "Teacher #" : "Student #") + to_string((int)(uint32_t)key);
+    }
+
+    void add(const RosterRow &r){
+        change(top, 0, key(r), recordHash(r));
+    }
+
+    void remove(const RosterRow &r){
+        change(top, 0, key(r), -recordHash(r));
+    }
+
+    uint64_t root() const{
+        return top.hash;
+    }
+
+    size_t nodeCount() const{
+        return count(top);
+    }
+
+    // Keys whose records differ between a and b, in key order; visited counts the tree nodes compared. The shape
+    // follows the key set, so where one side is split and the other isn't the keys differ and both are listed out.
+    friend vector<uint64_t> diff(const MerkleTree &a, const MerkleTree &b, size_t *visited = nullptr){
+        vector<uint64_t> keys;
+        vector<pair<const Node*, const Node*>> stack = {{&a.top, &b.top}};
+        size_t compared = 0;
+        while(!stack.empty()){
+            auto [x, y] = stack.back();
+            stack.pop_back();
+            ++compared;
+            if(x->hash == y->hash)
+                continue;
+            if(x->child[0] && y->child[0]){
+                stack.push_back({x->child[0].get(), y->child[0].get()});
+                stack.push_back({x->child[1].get(), y->child[1].get()});
+                continue;
+            }
+            unordered_map<uint64_t, uint64_t> left, right;
+            gather(*x, left);
+            gather(*y, right);
+            for(auto &[k, sum] : left){
+                auto other = right.find(k);
+                if(other == right.end() || other->second != sum)
+                    keys.push_back(k);
+            }
+            for(auto &[k, sum] : right)
+                if(!left.count(k))
+                    keys.push_back(k);
+        }
+        if(visited)
+            *visited = compared;
+        sort(keys.begin(), keys.end());
+        return keys;
+    }
+};
+
+// One-off digest of a roster
+MerkleTree digestOf(const Roster &roster){
+    MerkleTree tree;
+    for(Teacher *t : roster.allTeachers())
+        tree.add(rowOf(*t));
+    for(Student *s : roster.allStudents())
+        tree.add(rowOf(*s));
+    return tree;
+}
+
+// Digest kept current from the change feed: the roster it starts from plus everyone created afterwards. Writes that
+// bypass the feed (public fields such as age, matrix cells) need a refresh() of that object.
+class RosterDigest : public IRosterObserver{
+    MerkleTree tree;
+    unordered_map<const void*, RosterRow> records; // what each object contributed, so it can be taken out again
+
+    void put(const void *object, RosterRow row){
+        auto it = records.find(object);
+        if(it != records.end())
+            tree.remove(it->second);
+        tree.add(row);
+        records[object] = move(row);
+    }
+
+    void drop(const void *object){
+        auto it = records.find(object);
+        if(it == records.end())
+            return;
+        tree.remove(it->second);
+        records.erase(it);
+    }
+public:
+    explicit RosterDigest(const Roster &roster){
+        for(Teacher *t : roster.allTeachers())
+            put(t, rowOf(*t));
+        for(Student *s : roster.allStudents())
+            put(s, rowOf(*s));
+        RosterFeed::subscribe(this);
+    }
+
+    RosterDigest(const RosterDigest &) = delete;
+    RosterDigest& operator=(const RosterDigest &) = delete;
+
+    ~RosterDigest() override{
+        RosterFeed::unsubscribe(this);
+    }
+
+    const MerkleTree& digest() const{
+        return tree;
+    }
+
+    void refresh(const Teacher &t){
+        if(records.count(&t))
+            put(&t, rowOf(t));
+    }
+
+    void refresh(const Student &s){
+        if(records.count(&s))
+            put(&s, rowOf(s));
+    }
+
+    void teacherAdded(const Teacher &t) override { put(&t, rowOf(t)); }
+    void teacherRemoved(const Teacher &t) override { drop(&t); }
+    void salaryChanged(const Teacher &t, double) override { refresh(t); }
+    void studentAdded(const Student &s) override { put(&s, rowOf(s)); }
+    void studentRemoved(const Student &s) override { drop(&s); }
+    void feesChanged(const Student &s, double) override { refresh(s); }
+};
+
+// ======= LOG-SHIPPING REPLICATION =======
+// The primary numbers every change on the feed (the LogEntry records MutationLog writes) and ships them over a Unix
+// socket to followers, which keep a row-level copy of every live Teacher/Student part and answer queries from it.
+// Messages are frames of uint32 length | uint8 type | payload:
+//   Hello     follower -> primary   varint protocol (replicationProtocol), varint lastAppliedLsn (0 = fresh)
+//   Snapshot  primary -> follower   varint lsn, int64 sentNs, then a Created entry per live part
+//   Entries   primary -> follower   varint headLsn, int64 oldestNs, then a batch of entries
+//   Ack       follower -> primary   varint appliedLsn
+// A follower whose lastAppliedLsn is still inside the primary's retained window catches up from the log; a fresh or
+// badly lagging one gets a snapshot first. Times are steady_clock nanoseconds, which are host-wide, so lag can be
+// measured across the two processes.
+// Entries are encodeLogEntry records, so the protocol moves with the log format: a follower speaking another
+// version is disconnected at Hello.
+enum class ReplMessage : uint8_t { Hello = 1, Snapshot = 2, Entries = 3, Ack = 4 };
+const uint64_t replicationProtocol = 2;
+
+const size_t maxReplFrame = (size_t)1 << 30;
+
+int64_t steadyNs(){
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void frameMessage(vector<uint8_t> &out, ReplMessage type, const ByteWriter &payload){
+    ByteWriter w;
+    w.put<uint32_t>(uint32_t(1 + payload.bytes.size()));
+    w.put<uint8_t>((uint8_t)type);
+    out.insert(out.end(), w.bytes.begin(), w.bytes.end());
+    out.insert(out.end(), payload.bytes.begin(), payload.bytes.end());
+}
+
+// Calls fn(type, payload) for every complete frame in `in` and drops them from it; false on a malformed frame,
+// including one whose payload runs out while fn reads it, so the caller drops that peer
+template<typename Fn>
+bool takeFrames(vector<uint8_t> &in, Fn fn){
+    size_t at = 0;
+    while(in.size() - at >= 4){
+        uint32_t length;
+        memcpy(&length, &in[at], 4);
+        if(length < 1 || length > maxReplFrame)
+            return false;
+        if(in.size() - at - 4 < length)
+            break;
+        ByteReader payload(in.data() + at + 5, length - 1); // not &in[at + 5]: an empty payload ends the buffer
+        try{
+            fn((ReplMessage)in[at + 4], payload);
+        }
+        catch(const runtime_error &){ // truncated payload
+            return false;
+        }
+        at += 4 + length;
+    }
+    in.erase(in.begin(), in.begin() + at);
+    return true;
+}
+
+// Splits a run of length-prefixed log entries (as encodeLogEntry writes them)
+template<typename Fn>
+void forEachLogEntry(ByteReader &r, Fn fn){
+    while(!r.done()){
+        size_t length = r.varint();
+        r.need(length);
+        vector<uint8_t> body(length);
+        for(uint8_t &b : body)
+            b = r.get<uint8_t>();
+        ByteReader br(body.data(), body.size());
+        fn(decodeLogEntry(br));
+    }
+}
+
+class ReplicationPrimary : public IRosterObserver{
+    struct Follower{
+        int fd;
+        vector<uint8_t> in, out;
+        size_t sent = 0;
+        bool streaming = false; // has had its snapshot/catch-up and now gets every batch
+        uint64_t acked = 0;
+    };
+
+    // An entry logged since the last pump. Created ones are classified when shipped, by which time the person is
+    // fully built - unless the part has gone (or its address been reused) in between, which `live` tells.
+    struct Fresh{
+        LogEntry entry;
+        const void *key; // the Teacher* or Student* it was logged under (a TA's Teacher part can't be cast back to)
+        const IPerson *part;
+        int64_t at;
+    };
+
+    string path;
+    int listener;
+    size_t retain;
+    uint64_t lsn = 0;
+    unordered_map<const Teacher*, uint64_t> liveTeachers; // parts the followers know about -> lsn of their Created
+    unordered_map<const Student*, uint64_t> liveStudents;
+    deque<pair<LogEntry, int64_t>> retained; // the last `retain` entries with the time they were logged
+    vector<Fresh> fresh;                     // entries since the last pump
+    vector<Follower> followers;
+
+    template<typename Part>
+    void record(LogEntry e, const Part &part){
+        e.lsn = ++lsn;
+        fresh.push_back({move(e), &part, &part, steadyNs()});
+    }
+
+    template<typename Part>
+    static bool stillLive(const unordered_map<const Part*, uint64_t> &live, const void *key, uint64_t lsn){
+        auto it = live.find(static_cast<const Part*>(key));
+        return it != live.end() && it->second == lsn;
+    }
+
+    // Encodes everything since the last pump once, for every follower and the retained window
+    void ship(){
+        if(fresh.empty())
+            return;
+        ByteWriter entries;
+        for(Fresh &f : fresh){
+            LogEntry &e = f.entry;
+            bool live = e.row.kind == 'T' ? stillLive(liveTeachers, f.key, e.lsn) : stillLive(liveStudents, f.key, e.lsn);
+            if(e.op == LogOp::Created && live)
+                classify(e, *f.part);
+            encodeLogEntry(entries, e);
+            retained.emplace_back(move(e), f.at);
+            if(retained.size() > retain)
+                retained.pop_front();
+        }
+        ByteWriter payload;
+        payload.varint(lsn);
+        payload.put<int64_t>(fresh.front().at);
+        payload.bytes.insert(payload.bytes.end(), entries.bytes.begin(), entries.bytes.end());
+        for(Follower &f : followers)
+            if(f.streaming)
+                frameMessage(f.out, ReplMessage::Entries, payload);
+        fresh.clear();
+    }
+
+    void greet(Follower &f, uint64_t lastApplied){
+        ByteWriter payload;
+        if(lastApplied > 0 && lastApplied <= lsn && (retained.empty() || lastApplied + 1 >= retained.front().first.lsn)){
+            payload.varint(lsn);
+            int64_t oldest = steadyNs();
+            ByteWriter entries;
+            for(auto &[e, at] : retained)
+                if(e.lsn > lastApplied){
+                    oldest = min(oldest, at);
+                    encodeLogEntry(entries, e);
+                }
+            payload.put<int64_t>(oldest);
+            payload.bytes.insert(payload.bytes.end(), entries.bytes.begin(), entries.bytes.end());
+            frameMessage(f.out, ReplMessage::Entries, payload);
+        }
+        else{
+            payload.varint(lsn);
+            payload.put<int64_t>(steadyNs());
+            for(auto &live : liveTeachers){
+                LogEntry e = logEntry(LogOp::Created, *live.first);
+                classify(e, *live.first);
+                encodeLogEntry(payload, e);
+            }
+            for(auto &live : liveStudents){
+                LogEntry e = logEntry(LogOp::Created, *live.first);
+                classify(e, *live.first);
+                encodeLogEntry(payload, e);
+            }
+            frameMessage(f.out, ReplMessage::Snapshot, payload);
+            ++snapshotsSent;
+        }
+        f.streaming = true;
+    }
+public:
+    size_t snapshotsSent = 0;
+
+    // Followers start from the people in `roster` plus whoever is created from now on
+    ReplicationPrimary(const string &path, const Roster &roster, size_t retain = 4096):
+        path(path), listener(listenUnix(path)), retain(retain){
+        for(Teacher *t : roster.allTeachers())
+            liveTeachers[t] = 0;
+        for(Student *s : roster.allStudents())
+            liveStudents[s] = 0;
+        RosterFeed::subscribe(this);
+    }
+
+    ReplicationPrimary(const ReplicationPrimary &) = delete;
+    ReplicationPrimary& operator=(const ReplicationPrimary &) = delete;
+
+    ~ReplicationPrimary() override{
+        RosterFeed::unsubscribe(this);
+        for(Follower &f : followers)
+            ::close(f.fd);
+        ::close(listener);
+        ::unlink(path.c_str());
+    }
+
+    // Ships everything logged since the last call as one batch, then services the sockets for up to timeoutMs.
+    // Call it from the thread that mutates the roster.
+    void pump(int timeoutMs){
+        ship();
+        vector<pollfd> fds;
+        fds.push_back({listener, POLLIN, 0});
+        for(Follower &f : followers)
+            fds.push_back({f.fd, short(POLLIN | (f.out.empty() ? 0 : POLLOUT)), 0});
+        ::poll(fds.data(), fds.size(), timeoutMs);
+        for(size_t i = followers.size(); i-- > 0;){
+            Follower &f = followers[i];
+            bool open = true;
+            if(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+                open = readAvailable(f.fd, f.in);
+            open = takeFrames(f.in, [&](ReplMessage type, ByteReader &payload){
+                if(type == ReplMessage::Hello){
+                    if(payload.varint() == replicationProtocol)
+                        greet(f, payload.varint());
+                    else
+                        open = false;
+                }
+                else if(type == ReplMessage::Ack)
+                    f.acked = max<uint64_t>(f.acked, payload.varint());
+            }) && open;
+            if(!flushPending(f.fd, f.out, f.sent) || !open){
+                ::close(f.fd);
+                followers.erase(followers.begin() + i);
+            }
+        }
+        if(fds[0].revents & POLLIN)
+            for(int fd; (fd = ::accept(listener, nullptr, nullptr)) >= 0;){
+                makeNonBlocking(fd);
+                followers.push_back({fd, {}, {}, 0, false, 0});
+            }
+    }
+
+    uint64_t lastLsn() const{
+        return lsn;
+    }
+
+    size_t followerCount() const{
+        return followers.size();
+    }
+
+    // Entries the slowest follower has not acknowledged yet
+    uint64_t lag() const{
+        uint64_t slowest = lsn;
+        for(const Follower &f : followers)
+            slowest = min(slowest, f.acked);
+        return lsn - slowest;
+    }
+
+    void teacherAdded(const Teacher &t) override{
+        liveTeachers[&t] = lsn + 1;
+        record(logEntry(LogOp::Created, t), t);
+    }
+
+    void teacherRemoved(const Teacher &t) override{
+        if(liveTeachers.erase(&t))
+            record(logEntry(LogOp::Destroyed, t), t);
+    }
+
+    void salaryChanged(const Teacher &t, double) override{
+        if(liveTeachers.count(&t))
+            record(logEntry(LogOp::SalarySet, t), t);
+    }
+
+    void studentAdded(const Student &s) override{
+        liveStudents[&s] = lsn + 1;
+        record(logEntry(LogOp::Created, s), s);
+    }
+
+    void studentRemoved(const Student &s) override{
+        if(liveStudents.erase(&s))
+            record(logEntry(LogOp::Destroyed, s), s);
+    }
+
+    void feesChanged(const Student &s, double) override{
+        if(liveStudents.count(&s))
+            record(logEntry(LogOp::FeesSet, s), s);
+    }
+};
+
+// Hot standby: applies the primary's batches to a row-level copy and serves queries from it (through RosterServer)
+class ReplicaFollower : public QuerySource{
+    struct Part{
+        RosterRow row;
+        char personClass;
+        uint64_t person; // the owning person's identity on the primary
+        bool research;
+    };
+
+    string path;
+    int fd = -1;
+    vector<uint8_t> in, out;
+    size_t sent = 0;
+    unordered_map<uint64_t, Part> parts; // by the part's identity on the primary
+    unordered_map<int, uint64_t> studentsById, teachersById;
+    DeptMap<double> payrollByDept;
+    double payrollTotal = 0;
+    MerkleTree tree;
+
+    void reset(){
+        parts.clear();
+        studentsById.clear();
+        teachersById.clear();
+        payrollByDept.clear();
+        payrollTotal = 0;
+        tree = MerkleTree();
+    }
+
+    void apply(const LogEntry &e){
+        if(e.op == LogOp::Created){
+            RosterRow &r = (parts[e.object] = {e.row, e.personClass, e.person, e.research}).row;
+            tree.add(r);
+            if(r.kind == 'T'){
+                teachersById[r.id] = e.object;
+                payrollByDept[r.dept] += r.salary;
+                payrollTotal += r.salary;
+            }
+            else
+                studentsById[r.id] = e.object;
+            return;
+        }
+        auto part = parts.find(e.object);
+        if(part == parts.end())
+            return;
+        RosterRow &r = part->second.row;
+        bool teacher = r.kind == 'T';
+        tree.remove(r);
+        switch(e.op){
+            case LogOp::Destroyed: {
+                auto &byId = teacher ? teachersById : studentsById;
+                auto it = byId.find(r.id);
+                if(it != byId.end() && it->second == e.object)
+                    byId.erase(it);
+                if(teacher){
+                    payrollByDept[r.dept] -= r.salary;
+                    payrollTotal -= r.salary;
+                }
+                parts.erase(part);
+                return;
+            }
+            case LogOp::SalarySet:
+                payrollByDept[r.dept] += e.row.salary - r.salary;
+                payrollTotal += e.row.salary - r.salary;
+                r.salary = e.row.salary;
+                break;
+            case LogOp::FeesSet:
+                r.fees = e.row.fees;
+                break;
+            default:
+                break;
+        }
+        tree.add(r);
+    }
+
+    void receive(ReplMessage type, ByteReader &payload){
+        uint64_t head = payload.varint();
+        int64_t oldestNs = payload.get<int64_t>();
+        if(type == ReplMessage::Snapshot){
+            reset();
+            ++snapshotsLoaded;
+        }
+        forEachLogEntry(payload, [&](const LogEntry &e){
+            apply(e);
+            appliedLsn = max(appliedLsn, e.lsn);
+        });
+        appliedLsn = max(appliedLsn, head);
+        ++batchesApplied;
+        lastLagUs = (steadyNs() - oldestNs) / 1000.0;
+        maxLagUs = max(maxLagUs, lastLagUs);
+        ByteWriter ack;
+        ack.varint(appliedLsn);
+        frameMessage(out, ReplMessage::Ack, ack);
+    }
+public:
+    uint64_t appliedLsn = 0;
+    size_t batchesApplied = 0, snapshotsLoaded = 0;
+    double lastLagUs = 0, maxLagUs = 0; // from the oldest entry in a batch being logged to the batch being applied
+
+    explicit ReplicaFollower(const string &primaryPath): path(primaryPath){
+        reconnect();
+    }
+
+    // Compare with the primary's RosterDigest to verify the copy, or diff() the two to find what to resend
+    const MerkleTree& digest() const{
+        return tree;
+    }
+
+    ReplicaFollower(const ReplicaFollower &) = delete;
+    ReplicaFollower& operator=(const ReplicaFollower &) = delete;
+
+    ~ReplicaFollower() override{
+        if(fd >= 0)
+            ::close(fd);
+    }
+
+    // (Re)connects and asks to resume after appliedLsn
+    void reconnect(){
+        if(fd >= 0)
+            ::close(fd);
+        in.clear();
+        out.clear();
+        sent = 0;
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = unixAddress(path);
+        if(fd < 0 || ::connect(fd, (sockaddr*)&addr, sizeof addr) != 0)
+            throw runtime_error("cannot reach primary at " + path + ": " + strerror(errno));
+        makeNonBlocking(fd);
+        ByteWriter hello;
+        hello.varint(replicationProtocol);
+        hello.varint(appliedLsn);
+        frameMessage(out, ReplMessage::Hello, hello);
+    }
+
+    // Waits up to timeoutMs for the primary and applies whatever arrived; false once the primary has gone away
+    bool pollOnce(int timeoutMs){
+        pollfd p = {fd, short(POLLIN | (out.empty() ? 0 : POLLOUT)), 0};
+        ::poll(&p, 1, timeoutMs);
+        bool open = readAvailable(fd, in);
+        open = takeFrames(in, [&](ReplMessage type, ByteReader &payload){
+            if(type == ReplMessage::Snapshot || type == ReplMessage::Entries)
+                receive(type, payload);
+        }) && open;
+        return flushPending(fd, out, sent) && open;
+    }
+
+    // Failover: turns the rows back into live objects of their original classes. A TA's two parts merge into one
+    // 'A' row; a part whose other half was never logged comes back on its own.
+    Roster promote() const{
+        unordered_map<uint64_t, pair<const Part*, const Part*>> halves; // person -> (student part, teacher part)
+        Roster roster;
+        for(auto &[object, part] : parts){
+            if(part.personClass == 'A'){
+                auto &h = halves[part.person];
+                (part.row.kind == 'T' ? h.second : h.first) = &part;
+                continue;
+            }
+            RosterRow row = part.row;
+            if(part.personClass == 'G'){
+                row.kind = 'G';
+                row.doingResearch = part.research;
+            }
+            addRow(roster, row);
+        }
+        for(auto &[person, h] : halves){
+            if(!h.first || !h.second){
+                addRow(roster, (h.first ? h.first : h.second)->row);
+                continue;
+            }
+            RosterRow row = h.first->row;
+            row.kind = 'A';
+            row.dept = h.second->row.dept;
+            row.salary = h.second->row.salary;
+            row.doingResearch = h.first->research;
+            addRow(roster, row);
+        }
+        return roster;
+    }
+
+    bool describe(int id, string &line) const override{
+        if(auto s = studentsById.find(id); s != studentsById.end()){
+            const RosterRow &r = parts.at(s->second).row;
+            line = describeStudent(id, r.name, r.age, r.fees);
+        }
+        else if(auto t = teachersById.find(id); t != teachersById.end()){
+            const RosterRow &r = parts.at(t->second).row;
+            line = describeTeacher(id, r.name, r.dept, r.salary);
+        }
+        else
+            return false;
+        return true;
+    }
+
+    bool isVoteEligible(int id, bool hasSSN, bool &eligible) const override{
+        auto s = studentsById.find(id);
+        if(s == studentsById.end())
+            return false;
+        eligible = hasSSN && parts.at(s->second).row.age >= 18; // Student::isVoteEligible on the row
+        return true;
+    }
+
+    bool payroll(const string &dept, double &total) const override{
+        if(dept.empty()){
+            total = payrollTotal;
+            return true;
+        }
+        const double *d = payrollByDept.find(dept);
+        if(!d)
+            return false;
+        total = *d;
+        return true;
+    }
+
+    uint64_t count() const override{
+        return studentsById.size() + teachersById.size();
+    }
+};
+
+// ======= TRACE RECORD / REPLAY =======
+// TraceRecorder captures what the OOPS_TRACE hooks report; TraceReplayer runs it again against fresh objects, on
+// one thread or on one thread per recorded thread, as fast as possible or at the recorded pace - so an incident
+// captured in production becomes a benchmark.
+// A trace file is "OOPSTRC2", then the roster the recording started on - records of varint count and that many
+// people, each its snapshot row (encodeRow) and the serials of its Student and Teacher parts (0 for none), closed by
+// a record of count 0 - then the events. Each thread buffers its own events (an uncontended mutex, only taken while
+// recording) and flushes them as one record of varint thread, varint count, events. An event is the op byte, varint
+// ns since the thread's previous event, varint object, then what the op needs to be redone.
+// Objects are named by serial, not address: every constructor starts a new serial at its address, so an object
+// freed on one thread and another built at the same address on a second stay apart in a parallel replay.
+// A GradStudent or TA first reports its Student (and Teacher) base constructors - or copy constructors; its own
+// then folds those into a single GradStudentCtor / TACtor (GradStudentCopy / TACopy) event, so the replay builds the
+// derived object directly.
+const char traceMagic[8] = {'O', 'O', 'P', 'S', 'T', 'R', 'C', '2'};
+
+struct TraceEvent{
+    TraceOp op = TraceOp::Count;
+    uint64_t ns = 0;                // since recording started
+    uint64_t object = 0, other = 0; // serials (other: copy/assign source)
+    uint64_t teacherPart = 0;       // a TA's Teacher part, for TACtor and TACopy
+    double x = 0, y = 0;            // salary, fees, percentage, amount, discount - whatever the op takes
+    int32_t id = 0, age = 0, size = 0;
+    bool flag = false;              // hasSSN, doingResearch
+    string name, dept;
+};
+
+void encodeTraceEvent(ByteWriter &w, const TraceEvent &e, uint64_t previousNs){
+    w.put<uint8_t>((uint8_t)e.op);
+    w.varint(e.ns - previousNs);
+    w.varint(e.object);
+    switch(e.op){
+        case TraceOp::TeacherCtor:
+            w.put<int32_t>(e.id); w.str(e.name); w.str(e.dept); w.put<double>(e.y);
+            break;
+        case TraceOp::StudentCtor: case TraceOp::GradStudentCtor: case TraceOp::TACtor:
+            w.put<int32_t>(e.id); w.put<int32_t>(e.age); w.str(e.name); w.put<double>(e.x); w.put<int32_t>(e.size);
+            if(e.op != TraceOp::StudentCtor)
+                w.put<uint8_t>(e.flag);
+            if(e.op == TraceOp::TACtor){
+                w.varint(e.teacherPart); w.str(e.dept); w.put<double>(e.y);
+            }
+            break;
+        case TraceOp::TeacherCopy: case TraceOp::StudentCopy: case TraceOp::GradStudentCopy:
+        case TraceOp::TeacherAssign: case TraceOp::StudentAssign:
+            w.varint(e.other);
+            break;
+        case TraceOp::TACopy:
+            w.varint(e.other); w.varint(e.teacherPart);
+            break;
+        case TraceOp::SetSalary: case TraceOp::SetFees: case TraceOp::Raise: case TraceOp::WaiveFees:
+            w.put<double>(e.x);
+            break;
+        case TraceOp::SetSalaryDiscount:
+            w.put<double>(e.x); w.put<double>(e.y);
+            break;
+        case TraceOp::IsVoteEligible:
+            w.put<uint8_t>(e.flag);
+            break;
+        default:
+            break;
+    }
+}
+
+TraceEvent decodeTraceEvent(ByteReader &r, uint64_t previousNs){
+    TraceEvent e;
+    uint8_t op = r.get<uint8_t>();
+    if(op >= (uint8_t)TraceOp::Count)
+        throw runtime_error("unknown trace op " + to_string(op));
+    e.op = (TraceOp)op;
+    e.ns = previousNs + r.varint();
+    e.object = r.varint();
+    switch(e.op){
+        case TraceOp::TeacherCtor:
+            e.id = r.get<int32_t>(); e.name = r.str(); e.dept = r.str(); e.y = r.get<double>();
+            break;
+        case TraceOp::StudentCtor: case TraceOp::GradStudentCtor: case TraceOp::TACtor:
+            e.id = r.get<int32_t>(); e.age = r.get<int32_t>(); e.name = r.str(); e.x = r.get<double>(); e.size = r.get<int32_t>();
+            if(e.op != TraceOp::StudentCtor)
+                e.flag = r.get<uint8_t>() != 0;
+            if(e.op == TraceOp::TACtor){
+                e.teacherPart = r.varint(); e.dept = r.str(); e.y = r.get<double>();
+            }
+            break;
+        case TraceOp::TeacherCopy: case TraceOp::StudentCopy: case TraceOp::GradStudentCopy:
+        case TraceOp::TeacherAssign: case TraceOp::StudentAssign:
+            e.other = r.varint();
+            break;
+        case TraceOp::TACopy:
+            e.other = r.varint(); e.teacherPart = r.varint();
+            break;
+        case TraceOp::SetSalary: case TraceOp::SetFees: case TraceOp::Raise: case TraceOp::WaiveFees:
+            e.x = r.get<double>();
+            break;
+        case TraceOp::SetSalaryDiscount:
+            e.x = r.get<double>(); e.y = r.get<double>();
+            break;
+        case TraceOp::IsVoteEligible:
+            e.flag = r.get<uint8_t>() != 0;
+            break;
+        default:
+            break;
+    }
+    return e;
+}
+
+// The state of one recording; hooks reach it through activeTraceSink, so a recorder stopping while another thread
+// is mid-hook only means that thread's event is dropped
+class TraceSink{
+    struct ThreadTrace{
+        uint32_t thread;
+        mutex lock;
+        vector<TraceEvent> events;
+        uint64_t flushedNs = 0; // ns of the last event already written, the base for the next record's deltas
+    };
+
+    // Address -> serial of the object living there, sharded so hooks on different threads rarely meet
+    struct Identities{
+        mutex lock;
+        unordered_map<uint64_t, uint64_t> serials;
+    };
+
+    static atomic<uint64_t>& generations(){
+        static atomic<uint64_t> next{1};
+        return next;
+    }
+
+    const uint64_t generation = generations()++;
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    mutex lock; // file and threads
+    RecordFileWriter file;
+    vector<unique_ptr<ThreadTrace>> threads;
+    bool closed = false;
+    Identities identities[64];
+    atomic<uint64_t> nextSerial{1};
+
+    ThreadTrace& local(){
+        thread_local uint64_t cachedGeneration = 0;
+        thread_local ThreadTrace *cached = nullptr;
+        if(cachedGeneration != generation){
+            lock_guard<mutex> guard(lock);
+            threads.emplace_back(new ThreadTrace());
+            threads.back()->thread = (uint32_t)threads.size() - 1;
+            cached = threads.back().get();
+            cachedGeneration = generation;
+        }
+        return *cached;
+    }
+
+    // Writes all but the newest `keep` events (t.lock held)
+    void flush(ThreadTrace &t, size_t keep){
+        if(t.events.size() <= keep)
+            return;
+        size_t count = t.events.size() - keep;
+        ByteWriter record;
+        record.varint(t.thread);
+        record.varint(count);
+        for(size_t i = 0; i < count; ++i){
+            encodeTraceEvent(record, t.events[i], t.flushedNs);
+            t.flushedNs = t.events[i].ns;
+        }
+        t.events.erase(t.events.begin(), t.events.begin() + count);
+        lock_guard<mutex> guard(lock);
+        if(!closed)
+            file.write(record);
+        recorded += count;
+    }
+public:
+    enum class Lifetime { Born, Living, Dying };
+
+    atomic<size_t> recorded{0};
+
+    // Writes the roster (none: an empty one) as the trace's starting point; nothing may change it meanwhile
+    TraceSink(const string &path, const Roster *roster): file(path, traceMagic){
+        ByteWriter people, record;
+        size_t count = 0;
+        auto emit = [&]{
+            record.bytes.clear();
+            record.varint(count);
+            record.bytes.insert(record.bytes.end(), people.bytes.begin(), people.bytes.end());
+            file.write(record);
+            people.bytes.clear();
+            count = 0;
+        };
+        if(roster)
+            forEachPerson(*roster, [&](const RosterRow &row, const Student *s, const Teacher *t){
+                encodeRow(people, row);
+                people.varint(identify(s, Lifetime::Born));
+                people.varint(identify(t, Lifetime::Born));
+                if(++count == 1024)
+                    emit();
+            });
+        if(count)
+            emit();
+        emit(); // count 0: end of the roster
+    }
+
+    // Serial of the object at this address (0 for none). A living object seen for the first time - built before
+    // the recording and not in its roster - gets one then.
+    uint64_t identify(const void *object, Lifetime when){
+        if(!object)
+            return 0;
+        uint64_t address = (uint64_t)(uintptr_t)object;
+        Identities &shard = identities[mix64(address) & 63];
+        lock_guard<mutex> guard(shard.lock);
+        if(when == Lifetime::Born)
+            return shard.serials[address] = nextSerial++;
+        auto it = shard.serials.find(address);
+        if(it == shard.serials.end()){
+            uint64_t serial = nextSerial++;
+            if(when == Lifetime::Living)
+                shard.serials.emplace(address, serial);
+            return serial;
+        }
+        uint64_t serial = it->second;
+        if(when == Lifetime::Dying)
+            shard.serials.erase(it);
+        return serial;
+    }
+
+    void record(TraceEvent &&e){
+        ThreadTrace &t = local();
+        lock_guard<mutex> guard(t.lock);
+        e.ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        e.ns = max(e.ns, t.events.empty() ? t.flushedNs : t.events.back().ns);
+        t.events.push_back(move(e));
+        if(t.events.size() >= 4096)
+            flush(t, 8); // a derived constructor may still fold its base events, which are always among the last few
+    }
+
+    // Replaces the base constructor (or copy constructor) events of student (and teacher) with one event for the
+    // derived object
+    void fold(TraceOp op, const void *student, const void *teacher, bool doingResearch){
+        bool copy = op == TraceOp::GradStudentCopy || op == TraceOp::TACopy;
+        uint64_t studentSerial = identify(student, Lifetime::Living), teacherSerial = identify(teacher, Lifetime::Living);
+        ThreadTrace &t = local();
+        lock_guard<mutex> guard(t.lock);
+        auto find = [&](TraceOp base, uint64_t serial){
+            for(size_t i = t.events.size(); i-- > 0;)
+                if(t.events[i].op == base && t.events[i].object == serial)
+                    return (ptrdiff_t)i;
+            return (ptrdiff_t)-1;
+        };
+        ptrdiff_t s = find(copy ? TraceOp::StudentCopy : TraceOp::StudentCtor, studentSerial);
+        ptrdiff_t te = teacher ? find(copy ? TraceOp::TeacherCopy : TraceOp::TeacherCtor, teacherSerial) : -1;
+        if(s < 0 || (teacher && te < 0))
+            return; // recording started mid-construction: the base events stand on their own
+        TraceEvent &derived = t.events[s];
+        derived.op = op;
+        derived.flag = doingResearch;
+        if(teacher){
+            derived.teacherPart = teacherSerial;
+            derived.dept = t.events[te].dept;
+            derived.y = t.events[te].y;
+            t.events.erase(t.events.begin() + te);
+        }
+    }
+
+    void close(){
+        vector<ThreadTrace*> all;
+        {
+            lock_guard<mutex> guard(lock);
+            for(auto &t : threads)
+                all.push_back(t.get());
+        }
+        for(ThreadTrace *t : all){
+            lock_guard<mutex> guard(t->lock);
+            flush(*t, 0);
+        }
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        file.close();
+    }
+};
+
+shared_ptr<TraceSink> activeTraceSink; // only through atomic_load / atomic_store
+
+void traceOp(TraceOp op, const void *object, double x, double y, const void *other){
+    shared_ptr<TraceSink> sink = atomic_load(&activeTraceSink);
+    if(!sink)
+        return;
+    TraceSink::Lifetime lifetime = TraceSink::Lifetime::Living;
+    if(op == TraceOp::TeacherCopy || op == TraceOp::StudentCopy)
+        lifetime = TraceSink::Lifetime::Born;
+    else if(op == TraceOp::TeacherDtor || op == TraceOp::StudentDtor)
+        lifetime = TraceSink::Lifetime::Dying;
+    TraceEvent e;
+    e.op = op;
+    e.object = sink->identify(object, lifetime);
+    e.other = sink->identify(other, TraceSink::Lifetime::Living);
+    e.x = x;
+    e.y = y;
+    e.flag = op == TraceOp::IsVoteEligible && x != 0;
+    sink->record(move(e));
+}
+
+void traceTeacher(const void *teacher, int id, const string &name, const string &dept, double salary){
+    shared_ptr<TraceSink> sink = atomic_load(&activeTraceSink);
+    if(!sink)
+        return;
+    TraceEvent e;
+    e.op = TraceOp::TeacherCtor;
+    e.object = sink->identify(teacher, TraceSink::Lifetime::Born);
+    e.id = id;
+    e.name = name;
+    e.dept = dept;
+    e.y = salary;
+    sink->record(move(e));
+}
+
+void traceStudent(const void *student, int id, int age, const string &name, double fees, int size){
+    shared_ptr<TraceSink> sink = atomic_load(&activeTraceSink);
+    if(!sink)
+        return;
+    TraceEvent e;
+    e.op = TraceOp::StudentCtor;
+    e.object = sink->identify(student, TraceSink::Lifetime::Born);
+    e.id = id;
+    e.age = age;
+    e.name = name;
+    e.x = fees;
+    e.size = size;
+    sink->record(move(e));
+}
+
+void traceDerived(TraceOp op, const void *student, const void *teacher, bool doingResearch){
+    if(shared_ptr<TraceSink> sink = atomic_load(&activeTraceSink))
+        sink->fold(op, student, teacher, doingResearch);
+}
+
+// Records every traced operation, from every thread, from construction until stop()/destruction. One at a time.
+class TraceRecorder{
+    shared_ptr<TraceSink> sink;
+
+    TraceRecorder(const string &path, const Roster *roster): sink(make_shared<TraceSink>(path, roster)){
+        shared_ptr<TraceSink> none;
+        if(!atomic_compare_exchange_strong(&activeTraceSink, &none, sink))
+            throw runtime_error("a trace is already being recorded");
+        traceActive = true;
+    }
+public:
+    // From nothing: events about people built before this are unresolved in the replay
+    explicit TraceRecorder(const string &path): TraceRecorder(path, nullptr) {}
+
+    // From a snapshot of roster, which the replay rebuilds first. Nothing may change the roster while this runs.
+    TraceRecorder(const string &path, const Roster &roster): TraceRecorder(path, &roster) {}
+
+    TraceRecorder(const TraceRecorder &) = delete;
+    TraceRecorder& operator=(const TraceRecorder &) = delete;
+
+    ~TraceRecorder(){
+        stop();
+    }
+
+    // Returns how many events the trace holds
+    size_t stop(){
+        if(atomic_load(&activeTraceSink) == sink){
+            traceActive = false;
+            atomic_store(&activeTraceSink, shared_ptr<TraceSink>());
+            sink->close();
+        }
+        return sink->recorded;
+    }
+};
+
+struct ReplayStats{
+    size_t events = 0;
+    size_t unresolved = 0; // events about objects the trace never constructed (alive before recording began)
+    double seconds = 0;
+};
+
+class TraceReplayer{
+    struct Person{ // one of the roster the recording started on
+        RosterRow row;
+        uint64_t student, teacher; // serials of its parts, 0 for none
+    };
+
+    vector<Person> roster;
+    vector<vector<TraceEvent>> threads; // per recorded thread, in order
+
+    // Replayed people by serial. A TA is in both maps (its Student and its Teacher part), sharing one owner.
+    mutex lock;
+    unordered_map<uint64_t, shared_ptr<Teacher>> teachers;
+    unordered_map<uint64_t, shared_ptr<Student>> students;
+
+    template<typename T>
+    shared_ptr<T> find(unordered_map<uint64_t, shared_ptr<T>> &table, uint64_t address){
+        lock_guard<mutex> guard(lock);
+        auto it = table.find(address);
+        return it == table.end() ? nullptr : it->second;
+    }
+
+    template<typename T>
+    void bind(unordered_map<uint64_t, shared_ptr<T>> &table, uint64_t address, shared_ptr<T> object){
+        lock_guard<mutex> guard(lock);
+        table[address] = move(object);
+    }
+
+    template<typename T>
+    void release(unordered_map<uint64_t, shared_ptr<T>> &table, uint64_t address){
+        shared_ptr<T> last; // destroyed after the lock is dropped
+        lock_guard<mutex> guard(lock);
+        auto it = table.find(address);
+        if(it != table.end()){
+            last = move(it->second);
+            table.erase(it);
+        }
+    }
+
+    // Builds the starting roster again (addRow does the rows, matrices included)
+    void restore(){
+        for(const Person &p : roster){
+            Roster built;
+            addRow(built, p.row);
+            switch(p.row.kind){
+                case 'T':
+                    bind(teachers, p.teacher, shared_ptr<Teacher>(move(built.teachers.back())));
+                    break;
+                case 'S':
+                    bind(students, p.student, shared_ptr<Student>(move(built.students.back())));
+                    break;
+                case 'G':
+                    bind(students, p.student, shared_ptr<Student>(move(built.gradStudents.back())));
+                    break;
+                case 'A': {
+                    shared_ptr<TA> ta(move(built.tas.back()));
+                    bind(students, p.student, shared_ptr<Student>(ta));
+                    bind(teachers, p.teacher, shared_ptr<Teacher>(ta, &ta->asTeacher()));
+                    break;
+                }
+            }
+        }
+    }
+
+    // False when the event names an object the replay doesn't know
+    bool apply(const TraceEvent &e){
+        HR hr;
+        switch(e.op){
+            case TraceOp::TeacherCtor:
+                bind(teachers, e.object, make_shared<Teacher>(e.id, e.name, e.dept, e.y));
+                return true;
+            case TraceOp::StudentCtor:
+                bind(students, e.object, make_shared<Student>(e.id, e.age, e.name, e.x, e.size));
+                return true;
+            case TraceOp::GradStudentCtor:
+                bind(students, e.object, shared_ptr<Student>(make_shared<GradStudent>(e.id, e.age, e.name, e.x, e.flag, e.size)));
+                return true;
+            case TraceOp::TACtor: {
+                auto ta = make_shared<TA>(e.id, e.age, e.name, e.x, e.dept, e.y, e.flag, e.size);
+                bind(students, e.object, shared_ptr<Student>(ta));
+                bind(teachers, e.teacherPart, shared_ptr<Teacher>(ta, &ta->asTeacher()));
+                return true;
+            }
+            case TraceOp::TeacherDtor:
+                release(teachers, e.object);
+                return true;
+            case TraceOp::StudentDtor:
+                release(students, e.object);
+                return true;
+            case TraceOp::TeacherCopy: { // a plain Teacher, even from a TA's part: a TA's own copy is a TACopy
+                shared_ptr<Teacher> source = find(teachers, e.other);
+                if(!source)
+                    return false;
+                bind(teachers, e.object, make_shared<Teacher>(*source));
+                return true;
+            }
+            case TraceOp::StudentCopy: {
+                shared_ptr<Student> source = find(students, e.other);
+                if(!source)
+                    return false;
+                bind(students, e.object, make_shared<Student>(*source));
+                return true;
+            }
+            case TraceOp::GradStudentCopy: {
+                shared_ptr<GradStudent> source = dynamic_pointer_cast<GradStudent>(find(students, e.other));
+                if(!source)
+                    return false;
+                bind(students, e.object, shared_ptr<Student>(make_shared<GradStudent>(*source)));
+                return true;
+            }
+            case TraceOp::TACopy: {
+                shared_ptr<TA> source = dynamic_pointer_cast<TA>(find(students, e.other));
+                if(!source)
+                    return false;
+                auto ta = make_shared<TA>(*source);
+                bind(students, e.object, shared_ptr<Student>(ta));
+                bind(teachers, e.teacherPart, shared_ptr<Teacher>(ta, &ta->asTeacher()));
+                return true;
+            }
+            default:
+                break;
+        }
+        if(e.op == TraceOp::SetSalary || e.op == TraceOp::SetSalaryDiscount || e.op == TraceOp::Raise
+           || e.op == TraceOp::TeacherGetInfo || e.op == TraceOp::TeacherAssign){
+            shared_ptr<Teacher> t = find(teachers, e.object);
+            if(!t)
+                return false;
+            if(e.op == TraceOp::TeacherAssign){
+                shared_ptr<Teacher> source = find(teachers, e.other);
+                if(!source)
+                    return false;
+                *t = *source;
+            }
+            else if(e.op == TraceOp::SetSalary) t->setSalary(e.x);
+            else if(e.op == TraceOp::SetSalaryDiscount) t->setSalary(e.x, e.y);
+            else if(e.op == TraceOp::Raise) hr.raise(*t, (int)e.x);
+            else t->Teacher::getInfo(); // not virtual: a TA's getInfo was recorded as its two base calls
+            return true;
+        }
+        shared_ptr<Student> s = find(students, e.object);
+        if(!s)
+            return false;
+        switch(e.op){
+            case TraceOp::StudentAssign: {
+                shared_ptr<Student> source = find(students, e.other);
+                if(!source)
+                    return false;
+                *s = *source;
+                return true;
+            }
+            case TraceOp::SetFees: s->setFees(e.x); break;
+            case TraceOp::WaiveFees: waiveFees(*s, e.x); break;
+            case TraceOp::StudentGetInfo: s->Student::getInfo(); break;
+            case TraceOp::IsVoteEligible: {
+                volatile bool eligible = s->isVoteEligible(e.flag); // volatile: the call itself is what's replayed
+                (void)eligible;
+                break;
+            }
+            default: break;
+        }
+        return true;
+    }
+
+    void play(const vector<TraceEvent> &events, bool paced, chrono::steady_clock::time_point start, atomic<size_t> &unresolved){
+        for(const TraceEvent &e : events){
+            if(paced)
+                this_thread::sleep_until(start + chrono::nanoseconds(e.ns));
+            if(!apply(e))
+                ++unresolved;
+        }
+    }
+public:
+    explicit TraceReplayer(const string &path){
+        RecordFileReader file(path, traceMagic, "an operation trace");
+        ByteReader r(nullptr, 0);
+        for(size_t count = 1; count > 0;){
+            if(!file.next(r))
+                throw runtime_error(path + " ends inside its starting roster");
+            count = r.varint();
+            for(size_t i = 0; i < count; ++i){
+                Person p;
+                p.row = decodeRow(r);
+                p.student = r.varint();
+                p.teacher = r.varint();
+                roster.push_back(move(p));
+            }
+        }
+        vector<uint64_t> lastNs;
+        while(file.next(r)){
+            size_t thread = r.varint(), count = r.varint();
+            if(thread >= threads.size()){
+                threads.resize(thread + 1);
+                lastNs.resize(thread + 1, 0);
+            }
+            for(size_t i = 0; i < count; ++i){
+                threads[thread].push_back(decodeTraceEvent(r, lastNs[thread]));
+                lastNs[thread] = threads[thread].back().ns;
+            }
+        }
+    }
+
+    TraceReplayer(const TraceReplayer &) = delete;
+    TraceReplayer& operator=(const TraceReplayer &) = delete;
+
+    ~TraceReplayer(){
+        clear();
+    }
+
+    size_t recordedThreads() const{
+        return threads.size();
+    }
+
+    double recordedSeconds() const{ // first event to last
+        uint64_t last = 0;
+        for(auto &events : threads)
+            if(!events.empty())
+                last = max(last, events.back().ns);
+        return last * 1e-9;
+    }
+
+    // Rebuilds the starting roster, then plays the events. parallel: one thread per recorded thread, otherwise
+    // everything in timestamp order on the calling thread. paced: keep the recorded gaps between events, otherwise go
+    // as fast as possible. quiet: send getInfo's and the destructors' output nowhere. A parallel replay has none of
+    // the original program's own locking, so it is only as race-free as the recorded threads were in touching
+    // disjoint people. Run again after clear() for another pass from the start.
+    ReplayStats run(bool parallel, bool paced, bool quiet = true){
+        ReplayStats stats;
+        atomic<size_t> unresolved{0};
+        ostream nowhere(nullptr);
+        streambuf *console = quiet ? cout.rdbuf(nowhere.rdbuf()) : nullptr;
+        restore();
+        auto start = chrono::steady_clock::now();
+        if(parallel){
+            vector<thread> players;
+            for(auto &events : threads)
+                players.emplace_back([&, start]{ play(events, paced, start, unresolved); });
+            for(thread &t : players)
+                t.join();
+        }
+        else{
+            vector<TraceEvent> merged;
+            for(auto &events : threads)
+                merged.insert(merged.end(), events.begin(), events.end());
+            stable_sort(merged.begin(), merged.end(), [](const TraceEvent &a, const TraceEvent &b){ return a.ns < b.ns; });
+            play(merged, paced, start, unresolved);
+        }
+        stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if(quiet)
+            cout.rdbuf(console);
+        for(auto &events : threads)
+            stats.events += events.size();
+        stats.unresolved = unresolved;
+        return stats;
+    }
+
+    // People the replay left alive, and what the Teachers among them earn
+    size_t alive(){
+        lock_guard<mutex> guard(lock);
+        size_t tas = 0; // in both maps
+        for(auto &[address, s] : students)
+            tas += dynamic_cast<const TA*>(s.get()) != nullptr;
+        return teachers.size() + students.size() - tas;
+    }
+
+    double payroll(){
+        lock_guard<mutex> guard(lock);
+        double total = 0;
+        for(auto &[address, t] : teachers)
+            total += t->getSalary();
+        return total;
+    }
+
+    void clear(){ // destroys whatever the replay left alive
+        unordered_map<uint64_t, shared_ptr<Teacher>> t;
+        unordered_map<uint64_t, shared_ptr<Student>> s;
+        {
+            lock_guard<mutex> guard(lock);
+            t.swap(teachers);
+            s.swap(students);
+        }
+    }
+};
+
+// ======= WORKLOAD GENERATOR =======
+// Seedable synthetic rosters and mutation streams for benchmarks and load runs. A seed and a config always give the
+// same people and the same stream: only mt19937_64's raw output is used, and the distributions on top of it are
+// computed here, because <random>'s normal/discrete distributions differ from one standard library to the next.
+class WorkloadRandom{
+    mt19937_64 rng;
+public:
+    explicit WorkloadRandom(uint64_t seed): rng(seed) {}
+
+    double uniform(){ // [0, 1)
+        return (rng() >> 11) * 0x1.0p-53;
+    }
+
+    size_t below(size_t n){
+        return (size_t)(uniform() * n);
+    }
+
+    double normal(double mean, double stddev){ // Box-Muller, one value per call
+        double u1 = 1 - uniform(), u2 = uniform();
+        return mean + stddev * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+    }
+
+    size_t pick(const vector<double> &cdf){ // index drawn from cumulative weights
+        size_t i = upper_bound(cdf.begin(), cdf.end(), uniform() * cdf.back()) - cdf.begin();
+        return min(i, cdf.size() - 1);
+    }
+};
+
+vector<double> cumulative(vector<double> weights){
+    partial_sum(weights.begin(), weights.end(), weights.begin());
+    return weights;
+}
+
+// Weight of rank i is 1/(i+1)^skew: skew 0 is uniform, 1 is classic Zipf
+vector<double> zipfWeights(size_t n, double skew){
+    vector<double> weights(n);
+    for(size_t i = 0; i < n; ++i)
+        weights[i] = 1 / pow((double)(i + 1), skew);
+    return weights;
+}
+
+struct WorkloadConfig{
+    uint64_t seed = 1;
+    double teachers = 15, students = 60, gradStudents = 15, tas = 10; // class mix, relative weights
+    double deptSkew = 1.1;                                          // Zipf over knownDepts, CSE most popular
+    double nameLengthMean = 6, nameLengthStddev = 2;                // per name part, clamped to 2..14 letters
+    vector<pair<int, double>> matrixSizes = {{3, 90}, {8, 9}, {32, 1}}; // Student matrix size, relative weight
+    double raiseRate = 50, waiverRate = 30, copyRate = 20;          // mutation mix, relative weights
+    double targetSkew = 0;                                          // Zipf over people: 0 uniform, ~1 a few hot ones
+};
+
+class WorkloadGenerator{
+    WorkloadConfig config;
+    WorkloadRandom random;
+    vector<double> classCdf, deptCdf, sizeCdf;
+    int nextId = 1;
+
+    string namePart(){
+        static const char consonants[] = "bcdfghjklmnprstvwz", vowels[] = "aeiou";
+        int length = (int)lround(random.normal(config.nameLengthMean, config.nameLengthStddev));
+        string part;
+        bool vowel = random.uniform() < 0.3;
+        for(int i = 0; i < min(14, max(2, length)); ++i, vowel = !vowel) // alternating, so names stay pronounceable
+            part += vowel ? vowels[random.below(5)] : consonants[random.below(18)];
+        part[0] = (char)toupper(part[0]);
+        return part;
+    }
+public:
+    explicit WorkloadGenerator(const WorkloadConfig &config = WorkloadConfig()): config(config), random(config.seed){
+        classCdf = cumulative({config.teachers, config.students, config.gradStudents, config.tas});
+        deptCdf = cumulative(zipfWeights(knownDeptCount, config.deptSkew));
+        vector<double> sizeWeights;
+        for(auto &[size, weight] : config.matrixSizes)
+            sizeWeights.push_back(weight);
+        sizeCdf = cumulative(sizeWeights);
+    }
+
+    string name(){
+        string first = namePart();
+        return first + ' ' + namePart();
+    }
+
+    void addPerson(Roster &roster){
+        int id = nextId++;
+        string person = name(), dept(knownDepts[random.pick(deptCdf)]);
+        int size = config.matrixSizes[random.pick(sizeCdf)].first;
+        double salary = 1000 * round(exp(random.normal(log(90.0), 0.35))); // log-normal, median $90k
+        double fees = 500 * (4 + random.below(37));                        // $2k..$20k
+        switch(random.pick(classCdf)){
+            case 0:
+                roster.teachers.push_back(make_unique<Teacher>(id, person, dept, salary));
+                break;
+            case 1:
+                roster.students.push_back(make_unique<Student>(id, 18 + (int)random.below(8), person, fees, size));
+                break;
+            case 2:
+                roster.gradStudents.push_back(make_unique<GradStudent>(id, 22 + (int)random.below(14), person, fees,
+                                                                       random.uniform() < 0.7, size));
+                break;
+            default:
+                roster.tas.push_back(make_unique<TA>(id, 21 + (int)random.below(10), person, fees / 2, dept, salary / 3,
+                                                     random.uniform() < 0.5, size));
+        }
+    }
+
+    void generate(Roster &roster, size_t n){
+        bool logged = Student::logLifecycle;
+        Student::logLifecycle = false;
+        for(size_t i = 0; i < n; ++i)
+            addPerson(roster);
+        Student::logLifecycle = logged;
+    }
+};
+
+// One step of a mutation stream. HR::raise and waiveFees log every call, so streams apply the same changes through
+// the quiet setters instead (see applyMutation).
+struct Mutation{
+    enum Kind : uint8_t { Raise, Waiver, Copy } kind;
+    size_t target; // index into Roster::allTeachers() for a raise, allStudents() otherwise
+    double amount; // raise percentage, or dollars waived
+};
+
+class MutationStream{
+    WorkloadRandom random;
+    vector<double> kindCdf, teacherCdf, studentCdf;
+public:
+    // Seeded apart from the roster's generator, so changing the stream's rates doesn't change who gets generated
+    MutationStream(const WorkloadConfig &config, size_t teachers, size_t students): random(config.seed ^ 0x9e3779b97f4a7c15){
+        kindCdf = cumulative({teachers ? config.raiseRate : 0, students ? config.waiverRate : 0, students ? config.copyRate : 0});
+        if(kindCdf.back() <= 0)
+            throw invalid_argument("mutation stream has nothing to mutate");
+        teacherCdf = cumulative(zipfWeights(teachers, config.targetSkew));
+        studentCdf = cumulative(zipfWeights(students, config.targetSkew));
+    }
+
+    Mutation next(){
+        Mutation m;
+        m.kind = (Mutation::Kind)random.pick(kindCdf);
+        m.target = random.pick(m.kind == Mutation::Raise ? teacherCdf : studentCdf);
+        m.amount = m.kind == Mutation::Raise ? (double)(1 + random.below(10)) : 50.0 * (1 + random.below(20));
+        return m;
+    }
+};
+
+struct MutationCounts{
+    size_t raises = 0, waivers = 0, copies = 0;
+};
+
+void applyMutation(const vector<Teacher*> &teachers, const vector<Student*> &students, const Mutation &m, MutationCounts &counts){
+    switch(m.kind){
+        case Mutation::Raise: {
+            Teacher &t = *teachers[m.target];
+            t.setSalary(t.getSalary() * (100 + m.amount) / 100);
+            ++counts.raises;
+            break;
+        }
+        case Mutation::Waiver: {
+            Student &s = *students[m.target];
+            s.setFees(max(0.0, s.getFees() - m.amount));
+            ++counts.waivers;
+            break;
+        }
+        case Mutation::Copy: { // as the class it really is, so GradStudent and TA copies get exercised too
+            const Student &source = *students[m.target];
+            if(const TA *ta = dynamic_cast<const TA*>(&source))
+                TA copy(*ta);
+            else if(const GradStudent *g = dynamic_cast<const GradStudent*>(&source))
+                GradStudent copy(*g);
+            else
+                Student copy(source);
+            ++counts.copies;
+            break;
+        }
+    }
+}
+
+// ======= HARDWARE COUNTERS =======
+// perf_event_open counters for the benchmark harness: cycles, instructions, L1D and last-level cache misses and
+// branch misses, counted in user space for the calling thread only (work a benchmark hands to other threads, like
+// the query server's event loop, is not included). The events form one group led by cycles, so the PMU counts them
+// over the same intervals and ratios like IPC hold up; an event the PMU lacks is left out of the group rather than
+// taking the rest with it. When the kernel had to multiplex the group, readings are scaled by the time it was
+// enabled vs running during the measured region. In containers the syscall is usually blocked (seccomp, or
+// perf_event_paranoid > 2); then available() is false and the harness just prints wall time.
+struct PerfReading{
+    const char *name;
+    bool valid;   // the event opened and was scheduled at least once
+    double value;
+};
+
+class PerfCounters{
+    struct Event{
+        const char *name;
+        uint32_t type;
+        uint64_t config;
+        int fd;
+        size_t slot = 0; // position in the group's read
+    };
+
+    vector<Event> events;
+    int leader = -1; // the first event that opened: cycles unless the PMU lacks it
+    size_t members = 0;
+    vector<uint64_t> atStart; // group read at start(); the times in it are never reset
+    string reason;
+
+    // One PERF_FORMAT_GROUP read: member count, time enabled, time running, then one value per member
+    bool readGroup(vector<uint64_t> &raw) const{
+        raw.assign(3 + members, 0);
+#ifdef __linux__
+        ssize_t bytes = raw.size() * sizeof(uint64_t);
+        return leader >= 0 && ::read(leader, raw.data(), bytes) == bytes && raw[0] == members;
+#else
+        return false;
+#endif
+    }
+public:
+    PerfCounters(){
+#ifdef __linux__
+        const uint64_t l1dReadMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                     | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        events = {
+            {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+            {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+            {"L1d-misses", PERF_TYPE_HW_CACHE, l1dReadMiss, -1},
+            {"LLC-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1},
+            {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1},
+        };
+        for(Event &e : events){
+            perf_event_attr attr{};
+            attr.size = sizeof attr;
+            attr.type = e.type;
+            attr.config = e.config;
+            attr.disabled = leader < 0; // members follow the leader's enable/disable
+            attr.exclude_kernel = 1; // all that perf_event_paranoid=2 allows, and the roster code is user space anyway
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            e.fd = (int)::syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+            if(e.fd < 0){
+                if(reason.empty())
+                    reason = string("perf_event_open: ") + strerror(errno);
+                continue;
+            }
+            if(leader < 0)
+                leader = e.fd;
+            e.slot = members++;
+        }
+        if(available())
+            reason.clear();
+#else
+        reason = "hardware counters need Linux perf_event_open";
+#endif
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters& operator=(const PerfCounters &) = delete;
+
+    ~PerfCounters(){
+        for(Event &e : events)
+            if(e.fd >= 0)
+                ::close(e.fd);
+    }
+
+    bool available() const{
+        return any_of(events.begin(), events.end(), [](const Event &e){ return e.fd >= 0; });
+    }
+
+    const string& unavailableReason() const{
+        return reason;
+    }
+
+    void start(){
+        if(!readGroup(atStart))
+            atStart.clear();
+#ifdef __linux__
+        if(leader >= 0)
+            ::ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    void stop(){
+#ifdef __linux__
+        if(leader >= 0)
+            ::ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    // Counts since start(), scaled by the region's enabled/running time when the group was multiplexed. Deltas
+    // throughout: PERF_EVENT_IOC_RESET clears the counts but not the times.
+    vector<PerfReading> read() const{
+        vector<uint64_t> now;
+        bool ok = !atStart.empty() && readGroup(now);
+        uint64_t enabled = ok ? now[1] - atStart[1] : 0, running = ok ? now[2] - atStart[2] : 0;
+        vector<PerfReading> out;
+        for(const Event &e : events){
+            bool valid = ok && e.fd >= 0 && running > 0;
+            double value = valid ? (double)(now[3 + e.slot] - atStart[3 + e.slot]) * enabled / running : 0;
+            out.push_back({e.name, valid, value});
+        }
+        return out;
+    }
+};
+
+// Per-iteration and per-row averages over sums of readings, e.g. "cycles 1.2e+07 (12.0/row), ... IPC 2.41"
+string perfSummary(const vector<PerfReading> &sums, int iterations, size_t rows){
+    ostringstream out;
+    out<<fixed;
+    double cycles = 0, instructions = 0;
+    for(const PerfReading &r : sums){
+        if(!out.str().empty())
+            out<<", ";
+        if(!r.valid){
+            out<<r.name<<" n/a";
+            continue;
+        }
+        double perIteration = r.value / iterations;
+        out<<r.name<<' '<<setprecision(0)<<perIteration<<" ("<<setprecision(2)<<perIteration / rows<<"/row)";
+        if(string(r.name) == "cycles")
+            cycles = r.value;
+        if(string(r.name) == "instructions")
+            instructions = r.value;
+    }
+    if(cycles > 0 && instructions > 0)
+        out<<", IPC "<<setprecision(2)<<instructions / cycles;
+    return out.str();
+}
+
+// ======= BENCHMARKS =======
+// Run with: ./oops-practice --bench [name-filter] [n] [--runs k] [--save baseline.json] [--compare baseline.json]
+// --compare exits with 1 when any benchmark got significantly slower, or allocates more, than in the baseline.
+// A benchmark prepares its input for a given n and hands back the closure that is actually timed. The harness
+// switches Student's lifecycle messages off around each one (setup, runs and teardown) and restores them after.
+struct Benchmark{
+    string name;
+    size_t defaultN;
+    function<function<void()>(size_t n)> setup;
+};
+
+volatile double benchSink; // timed work writes its result here so the optimizer can't throw it away
+string benchNote;          // extra detail a benchmark wants printed under its timing line
+
+// Heap allocations from every thread while countAllocations is on (the harness turns it on around each timed run),
+// through the replacement operator new below; otherwise an allocation pays one relaxed load
+atomic<bool> countAllocations{false};
+atomic<uint64_t> allocationsCounted{0};
+
+void* operator new(size_t size){
+    if(countAllocations.load(memory_order_relaxed))
+        allocationsCounted.fetch_add(1, memory_order_relaxed);
+    for(;;){
+        if(void *p = malloc(size ? size : 1))
+            return p;
+        new_handler handler = get_new_handler();
+        if(!handler)
+            throw bad_alloc();
+        handler();
+    }
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept{ // std::get_temporary_buffer, for one
+    try{
+        return ::operator new(size);
+    }
+    catch(const bad_alloc &){
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size){ // the library's would forward here anyway, but a sanitizer's wouldn't
+    return ::operator new(size);
+}
+
+void* operator new[](size_t size, const nothrow_t &tag) noexcept{
+    return ::operator new(size, tag);
+}
+
+// Paired with the news above (so sanitizers see malloc/free); out of line, or GCC sees free() meet a new-expression
+__attribute__((noinline)) void operator delete(void *p) noexcept{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, const nothrow_t&) noexcept{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, const nothrow_t&) noexcept{
+    free(p);
+}
+
+// n keys 0..n-1 in random order, payload = position
+vector<JoinTuple<uint32_t>> shuffledKeys(size_t n, unsigned seed){
+    vector<JoinTuple<uint32_t>> v(n);
+    for(size_t i = 0; i < n; ++i)
+        v[i] = {(int)i, (uint32_t)i};
+    shuffle(v.begin(), v.end(), mt19937(seed));
+    return v;
+}
+
+function<void()> benchRadixJoin(size_t n){
+    auto students = make_shared<vector<JoinTuple<uint32_t>>>(shuffledKeys(n, 1));
+    auto teachers = make_shared<vector<JoinTuple<uint32_t>>>(shuffledKeys(n, 2));
+    return [=]{
+        uint64_t sum = 0;
+        radixHashJoin(*teachers, *students, [&](uint32_t s, uint32_t t){ sum += s ^ t; });
+        benchSink = (double)sum;
+    };
+}
+
+function<void()> benchUnorderedMapJoin(size_t n){ // textbook baseline: one big std::unordered_map
+    auto students = make_shared<vector<JoinTuple<uint32_t>>>(shuffledKeys(n, 1));
+    auto teachers = make_shared<vector<JoinTuple<uint32_t>>>(shuffledKeys(n, 2));
+    return [=]{
+        unordered_map<int, uint32_t> table(teachers->size());
+        for(auto &t : *teachers)
+            table.emplace(t.key, t.payload);
+        uint64_t sum = 0;
+        for(auto &s : *students){
+            auto it = table.find(s.key);
+            if(it != table.end())
+                sum += s.payload ^ it->second;
+        }
+        benchSink = (double)sum;
+    };
+}
+
+// n teachers over `depts` departments; salaries in [50k, 300k)
+shared_ptr<vector<Teacher*>> syntheticTeachers(size_t n, size_t depts){
+    auto teachers = shared_ptr<vector<Teacher*>>(new vector<Teacher*>(), [](vector<Teacher*> *v){
+        for(Teacher *t : *v)
+            delete t;
+        delete v;
+    });
+    mt19937 rng(3);
+    teachers->reserve(n);
+    for(size_t i = 0; i < n; ++i)
+        teachers->push_back(new Teacher((int)i, "T" + to_string(i), "D" + to_string(rng() % depts), 50000.0 + rng() % 250000));
+    return teachers;
+}
+
+template<bool Engine>
+function<void()> benchGroupBy(size_t n, size_t depts){
+    auto teachers = syntheticTeachers(n, depts);
+    return [=]{
+        auto key = [](const Teacher &t){ return t.dept; };
+        auto value = [](const Teacher &t){ return t.getSalary(); };
+        benchSink = Engine ? (double)groupBy<string>(*teachers, key, value).size() : (double)naiveGroupBy<string>(*teachers, key, value).size();
+    };
+}
 
-    // Setter
-    void setSalary(const double salary){
-        this->salary = salary;
+// n ids already present, probed with n ids of which 90% are new
+template<bool Bloom>
+function<void()> benchIdProbe(size_t n){
+    auto present = make_shared<unordered_set<int>>();
+    auto filter = make_shared<BlockedBloom>(n, 0.01);
+    auto probes = make_shared<vector<int>>(n);
+    mt19937 rng(4);
+    present->reserve(n);
+    for(size_t i = 0; i < n; ++i){
+        present->insert((int)(2 * i));
+        filter->insert((int)(2 * i));
     }
+    for(int &p : *probes)
+        p = (int)(rng() % 10 == 0 ? 2 * (rng() % n) : 2 * n + rng() % n);
+    return [=]{
+        size_t hits = 0;
+        if(Bloom){
+            vector<int> maybe;
+            for(size_t i = 0; i < probes->size(); i += 1024){
+                maybe.clear();
+                filter->filterBatch(probes->data() + i, min<size_t>(1024, probes->size() - i), maybe);
+                for(int p : maybe)
+                    hits += present->count(p);
+            }
+        }
+        else
+            for(int p : *probes)
+                hits += present->count(p);
+        benchSink = (double)hits;
+    };
+}
 
-    void setSalary(const double salary, double discount){ // Function overloading
-        this->salary = salary * (1-discount)/100;
+// Names are 1-3 random syllables and a number; 1000 substring queries per run
+function<void()> benchNameSearch(size_t n){
+    static const char *syllables[] = {"an", "ber", "chi", "dra", "el", "fin", "gor", "ha", "is", "jo", "ka", "lin",
+                                      "mo", "ne", "ol", "pri", "qua", "ro", "sa", "ti", "ul", "vi", "wen", "xa", "yo", "ze"};
+    mt19937 rng(5);
+    auto randomName = [&]{
+        string name;
+        for(int k = 0, parts = 1 + rng() % 3; k < parts; ++k)
+            name += syllables[rng() % 26];
+        return name + to_string(rng() % 1000);
+    };
+    auto teachers = make_shared<vector<Teacher>>();
+    teachers->reserve(n);
+    for(size_t i = 0; i < n; ++i)
+        teachers->emplace_back((int)i, randomName(), "CSE", 0.0);
+    vector<Teacher*> roster;
+    for(Teacher &t : *teachers)
+        roster.push_back(&t);
+    auto index = make_shared<NameIndex>(vector<Student*>{}, roster);
+    auto patterns = make_shared<vector<string>>();
+    for(int q = 0; q < 1000; ++q){
+        string name = (*teachers)[rng() % n].name;
+        patterns->push_back(name.substr(rng() % (name.size() - 2), 4));
     }
+    return [=]{
+        size_t found = 0;
+        for(const string &p : *patterns)
+            found += index->findSubstring(p).size();
+        benchSink = (double)found;
+    };
+}
 
-    // Getter
-    double getSalary() const{
-        return salary;
+// Salary total per dept; depts drawn from the known list plus a few unknown ones
+template<bool Perfect>
+function<void()> benchDeptLookup(size_t n){
+    auto teachers = make_shared<vector<Teacher>>();
+    mt19937 rng(6);
+    teachers->reserve(n);
+    for(size_t i = 0; i < n; ++i){
+        int d = rng() % (knownDeptCount + 3);
+        string dept = d < knownDeptCount ? string(knownDepts[d]) : "Visiting-" + to_string(d);
+        teachers->emplace_back((int)i, "T", dept, 50000.0 + rng() % 1000);
     }
+    return [=]{
+        double total = 0;
+        if(Perfect){
+            DeptMap<double> sums;
+            for(const Teacher &t : *teachers)
+                sums[t.dept] += t.getSalary();
+            sums.forEach([&](const string &, double v){ total += v; });
+        }
+        else{
+            unordered_map<string, double> sums;
+            for(const Teacher &t : *teachers)
+                sums[t.dept] += t.getSalary();
+            for(auto &kv : sums)
+                total += kv.second;
+        }
+        benchSink = total;
+    };
+}
 
-    static int getTeacherCount(){ // NEW: can be called as Teacher::getTeacherCount()
-        return teacherCount;
+// n people: a quarter each of Teachers, Students, GradStudents and TAs
+shared_ptr<Roster> syntheticRoster(size_t n){
+    bool logged = Student::logLifecycle;
+    Student::logLifecycle = false;
+    auto roster = make_shared<Roster>();
+    mt19937 rng(7);
+    for(size_t i = 0; i < n; ++i){
+        int id = (int)i, age = 18 + rng() % 40;
+        string name = "Person-" + to_string(rng() % 100000);
+        double money = 1000.0 * (rng() % 300);
+        switch(i % 4){
+            case 0: roster->teachers.push_back(make_unique<Teacher>(id, name, string(knownDepts[rng() % knownDeptCount]), money)); break;
+            case 1: roster->students.push_back(make_unique<Student>(id, age, name, money)); break;
+            case 2: roster->gradStudents.push_back(make_unique<GradStudent>(id, age, name, money, rng() % 2 == 0)); break;
+            default: roster->tas.push_back(make_unique<TA>(id, age, name, money / 10, "CSE", money)); break;
+        }
     }
+    Student::logLifecycle = logged;
+    return roster;
+}
 
-    // virtual void getInfo () const override { - writing virtual here is redundant! as already written in interface.
-    void getInfo () const override {
-        cout<<"#"<<id<<": "<<name<<" from "<<dept<<" dept, earns "<<"$"<<getSalary()<<"/yr!"<<endl;
-        cout<<"Total Teachers = "<<teacherCount<<endl;
+function<void()> benchJsonWrite(size_t n){
+    auto roster = syntheticRoster(n);
+    return [=]{
+        ostringstream out;
+        writeJson(out, *roster);
+        benchSink = (double)out.tellp();
+    };
+}
+
+function<void()> benchJsonRead(size_t n){
+    ostringstream out;
+    writeJson(out, *syntheticRoster(n));
+    auto text = make_shared<string>(out.str());
+    return [=]{
+        istringstream in(*text);
+        Roster roster;
+        readJson(in, roster);
+        benchSink = (double)roster.size();
+    };
+}
+
+// n mutation-log sized records, each made durable with its own write + fsync
+function<void()> benchSyncPersist(size_t n){
+    return [=]{
+        int fd = ::open("oops-bench.log", O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        vector<double> us;
+        ByteWriter w;
+        encodeLogEntry(w, logEntry(LogOp::SalarySet, Teacher(1, "T", "CSE", 1.0)));
+        for(size_t i = 0; i < n; ++i){
+            auto start = chrono::steady_clock::now();
+            if(::write(fd, w.bytes.data(), w.bytes.size()) < 0 || ::fsync(fd) != 0)
+                break;
+            us.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+        }
+        ::close(fd);
+        ::unlink("oops-bench.log");
+        benchNote = latencySummary(us);
+    };
+}
+
+// The same records through AsyncWriter from 4 producer threads: group commit batches them
+function<void()> benchAsyncPersist(size_t n){
+    return [=]{
+        vector<double> us(n);
+        size_t batches;
+        {
+            AsyncWriter writer("oops-bench.log");
+            ByteWriter w;
+            encodeLogEntry(w, logEntry(LogOp::SalarySet, Teacher(1, "T", "CSE", 1.0)));
+            vector<thread> producers;
+            for(size_t t = 0; t < 4; ++t)
+                producers.emplace_back([&, t]{
+                    for(size_t i = t; i < n; i += 4){
+                        auto start = chrono::steady_clock::now();
+                        writer.submit(w.bytes, [&us, i, start](bool){
+                            us[i] = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+                        });
+                    }
+                });
+            for(thread &p : producers)
+                p.join();
+            writer.drain();
+            batches = writer.batches;
+        }
+        ::unlink("oops-bench.log");
+        benchNote = latencySummary(us) + ", " + to_string(batches) + " fsyncs";
+    };
+}
+
+// A server on its own thread over a synthetic roster, alive for as long as the benchmark closure
+struct ServerFixture{
+    shared_ptr<Roster> roster;
+    string path = "/tmp/oops-bench-" + to_string(getpid()) + ".sock";
+    unique_ptr<RosterIndex> index;
+    unique_ptr<RosterServer> server;
+    atomic<bool> stop{false};
+    thread loop;
+    vector<int> ids;
+
+    explicit ServerFixture(size_t people): roster(syntheticRoster(people)), index(new RosterIndex(*roster)),
+                                           server(new RosterServer(path, *index)){
+        for(Student *s : roster->allStudents())
+            ids.push_back(s->id);
+        loop = thread([this]{ server->run(stop); });
     }
 
-    // ~Teacher() override = default; // if you don't want to write anything in the destructor keep it as default!
-    ~Teacher() override {
-        --teacherCount;
+    ~ServerFixture(){
+        stop = true;
+        loop.join();
     }
 };
 
-int Teacher::teacherCount = 0; // IMPORTANT TO DEFINE STATIC VARIABLE IN CLASS!
+template<size_t Depth>
+function<void()> benchServer(size_t n){
+    auto fixture = make_shared<ServerFixture>(10000);
+    return [=]{
+        benchNote = generateLoad(fixture->path, fixture->ids, 4, n / 4, Depth).summary();
+    };
+}
 
-class Student: virtual public IPerson{
-private:
-    double fees;
-public:
-    const int id;
-    int age;
-    string name;
-    int **matrix;
-    int size;
+// One day of roster churn over sorted rows: 2% leave, 5% of teachers get a raise, 3% of students a fee change,
+// 1% a matrix edit, and `hires` new students join. The result is sorted again.
+vector<RosterRow> simulateDay(vector<RosterRow> rows, size_t hires, unsigned seed){
+    mt19937 rng(seed);
+    vector<RosterRow> next;
+    next.reserve(rows.size() + hires);
+    int maxId = 0;
+    for(RosterRow &r : rows){
+        maxId = max(maxId, r.id);
+        unsigned roll = rng() % 100;
+        if(roll < 2)
+            continue;
+        if(roll < 7 && (r.kind == 'T' || r.kind == 'A'))
+            r.salary = round(r.salary * 1.05);
+        else if(roll < 10 && r.kind != 'T')
+            r.fees = max(0.0, r.fees - 100);
+        else if(roll < 11 && r.kind != 'T'){
+            if(r.matrix.empty())
+                for(int i = 0; i < r.size; ++i)
+                    for(int j = 0; j < r.size; ++j)
+                        r.matrix.push_back(i + j);
+            r.matrix[0] += 1;
+        }
+        next.push_back(move(r));
+    }
+    for(size_t i = 0; i < hires; ++i){
+        RosterRow hire;
+        hire.id = maxId + 1 + (int)i;
+        hire.age = 18 + rng() % 5;
+        hire.name = "Hire-" + to_string(hire.id);
+        hire.fees = 1000.0 * (rng() % 50);
+        hire.size = 3;
+        next.push_back(move(hire));
+    }
+    sort(next.begin(), next.end(), rowKeyLess);
+    return next;
+}
 
-    friend void waiveFees(Student &s, double amount);
+// Two consecutive days of an n-person roster on disk, removed again when the benchmark is done with them
+struct DeltaFixture{
+    string day1 = "oops-bench-day1.snap", day2 = "oops-bench-day2.snap", delta = "oops-bench.delta",
+           merged = "oops-bench-merged.snap";
 
-    Student():id(0){ // No need to write this as constructor with 0 args is already handled with the below constructor!
-        this->age = 18;
-        this->name = "";
-        this->size = 3;
-        setFees(0);
+    explicit DeltaFixture(size_t n){
+        vector<RosterRow> rows = sortedRows(*syntheticRoster(n));
+        writeSnapshot(day1, rows);
+        writeSnapshot(day2, simulateDay(move(rows), n / 100, 1));
+        diffSnapshots(day1, day2, delta);
+    }
 
-        // Allocate Matrix
-        matrix = new int*[size];
-        for (int i = 0; i < size; ++i)
-            matrix[i] = new int[size];
-        // Initialize Matrix
-        for (int i = 0; i < size; ++i)
-            for (int j = 0; j < size; ++j)
-                matrix[i][j] = i + j;
+    ~DeltaFixture(){
+        for(const string &f : {day1, day2, delta, merged})
+            remove(f.c_str());
     }
+};
 
-    // Constructor as Initialization List
-    Student(int id=0, int age=18, string name="", double fees=0.0, int size=3): id(id), age(age), name(name), size(size){
-        // this->id = id; - not allowed as declared constant!
-        setFees(fees);
+function<void()> benchDeltaDiff(size_t n){
+    auto fixture = make_shared<DeltaFixture>(n);
+    return [=]{ benchSink = diffSnapshots(fixture->day1, fixture->day2, fixture->delta).changed; };
+}
 
-        // Allocate Matrix
-        matrix = new int*[size];
-        for (int i = 0; i < size; ++i)
-            matrix[i] = new int[size];
-        // Initialize Matrix
-        for (int i = 0; i < size; ++i)
-            for (int j = 0; j < size; ++j)
-                matrix[i][j] = i + j;
-    }
+function<void()> benchDeltaMerge(size_t n){
+    auto fixture = make_shared<DeltaFixture>(n);
+    return [=]{ benchSink = mergeDelta(fixture->day1, fixture->delta, fixture->merged).changed; };
+}
 
-    // Shallow copy - is already handled by the default copy constructor!
-    Student(const Student &s):id(s.id), age(s.age), name(s.name), size(s.size){ //Deep Copy
-        this->setFees(s.getFees());
-        // Allocate New Matrix
-        matrix = new int*[size];
-        for (int i = 0; i < size; ++i)
-            matrix[i] = new int[size];
-        // Copy Values
-        for (int i = 0; i < size; ++i)
-            for (int j = 0; j < size; ++j)
-                matrix[i][j] = s.matrix[i][j];
+// n-person snapshot on disk sorted by salary, out of core (16 MB budget) vs. loaded and sorted in memory
+struct SortFixture{
+    string input = "oops-bench-unsorted.snap", output = "oops-bench-sorted.snap";
+
+    explicit SortFixture(size_t n){
+        writeSnapshot(input, rosterRows(*syntheticRoster(n)));
     }
 
-    Student& operator=(const Student &s){
-        if (this == &s) {
-            // self-assignment: s1 = s1;
-            return *this;
-        }
+    ~SortFixture(){
+        remove(input.c_str());
+        remove(output.c_str());
+    }
+};
 
-        // If, logically, a Student’s id should also change on assignment, 
-        // then id probably shouldn’t be const, or you should delete operator=:
-        // Student& operator=(const Student&) = delete;
+function<void()> benchExternalSort(size_t n){
+    auto fixture = make_shared<SortFixture>(n);
+    return [=]{
+        SortStats stats = sortSnapshot(fixture->input, fixture->output, SortKey::Salary, 16 << 20);
+        benchNote = to_string(stats.runs) + " runs, " + to_string(stats.mergePasses) + " merge pass(es)";
+    };
+}
 
-        // id is const, so we CANNOT assign to it.
-        // You might want to assert that ids are equal if that's a logical requirement:
-        // if (id != s.id) { /* maybe throw or log error */ }
-        // Note: I'm just copying the content of s2, keeping the original id of s3;
+function<void()> benchInMemorySort(size_t n){
+    auto fixture = make_shared<SortFixture>(n);
+    return [=]{
+        vector<RosterRow> rows;
+        SnapshotReader in(fixture->input);
+        for(RosterRow row; in.next(row);)
+            rows.push_back(move(row));
+        sort(rows.begin(), rows.end(), RowOrder{SortKey::Salary});
+        writeSnapshot(fixture->output, rows);
+    };
+}
 
-        this->age = s.age;
-        this->name = s.name;
-        this->setFees(s.getFees());
+// Deep copy: the Student copy constructor (matrix rows allocated and copied) plus the destructor, n times
+function<void()> benchStudentCopy(size_t n){
+    auto source = make_shared<Student>(1, 20, "Source", 1000);
+    return [=]{
+        double fees = 0;
+        for(size_t i = 0; i < n; ++i){
+            Student copy(*source);
+            fees += copy.getFees();
+        }
+        benchSink = fees;
+    };
+}
 
-        // If sizes differ, reallocate matrix
-        if (size != s.size) {
-            // free old matrix
-            if (matrix) {
-                for (int i = 0; i < size; ++i)
-                    delete[] matrix[i];
-                delete[] matrix;
+// Allocation and virtual destruction through IPerson* over all four classes (getInfo prints, so it isn't timed)
+function<void()> benchMixedLifecycle(size_t n){
+    return [=]{
+        vector<unique_ptr<IPerson>> people;
+        people.reserve(n);
+        for(size_t i = 0; i < n; ++i){
+            int id = (int)i;
+            switch(i % 4){
+                case 0: people.emplace_back(new Teacher(id, "T", "CSE", 1000)); break;
+                case 1: people.emplace_back(new Student(id, 20, "S", 1000)); break;
+                case 2: people.emplace_back(new GradStudent(id, 25, "G", 1000, true)); break;
+                default: people.emplace_back(new TA(id, 24, "A", 100, "CSE", 1000)); break;
             }
-            size = s.size;
-            matrix = new int*[size];
-            for (int i = 0; i < size; ++i)
-                matrix[i] = new int[size];
         }
-        // copy the matrix contents
-        for (int i = 0; i < size; ++i)
-            for (int j = 0; j < size; ++j)
-                matrix[i][j] = s.matrix[i][j];
-        return *this;   // return *this, NOT a local
-    }
+        benchSink = (double)people.size();
+    };
+}
 
-    void setFees(const double fees){ // const parameters: whose values aren't changed inside the function
-        this->fees = fees; // this function can't be constant
-    }
+// A generated 100k roster under a uniform mix of raises, waivers and copies (n mutations per run)
+function<void()> benchMutationStream(size_t n){
+    auto roster = make_shared<Roster>();
+    WorkloadConfig config;
+    WorkloadGenerator(config).generate(*roster, 100000);
+    return [=]{
+        vector<Teacher*> teachers = roster->allTeachers();
+        vector<Student*> students = roster->allStudents();
+        MutationStream stream(config, teachers.size(), students.size());
+        MutationCounts counts;
+        for(size_t i = 0; i < n; ++i)
+            applyMutation(teachers, students, stream.next(), counts);
+        benchSink = (double)counts.copies;
+    };
+}
 
-    double getFees() const {
-        return fees;
+// Replays, on one thread and flat out, a recorded run: an n/10-person generated roster taking n mutations, torn down
+function<void()> benchTraceReplay(size_t n){
+    string path = "bench-" + to_string(getpid()) + ".trace";
+    {
+        TraceRecorder recorder(path);
+        WorkloadConfig config;
+        Roster roster; // destroyed before the recorder stops, so the trace ends with everyone gone again
+        WorkloadGenerator(config).generate(roster, n / 10 + 1);
+        vector<Teacher*> teachers = roster.allTeachers();
+        vector<Student*> students = roster.allStudents();
+        MutationStream stream(config, teachers.size(), students.size());
+        MutationCounts counts;
+        for(size_t i = 0; i < n; ++i)
+            applyMutation(teachers, students, stream.next(), counts);
     }
+    auto replayer = make_shared<TraceReplayer>(path);
+    remove(path.c_str());
+    return [=]{
+        ReplayStats stats = replayer->run(false, false);
+        benchNote = to_string(stats.events) + " events, " + to_string(stats.unresolved) + " unresolved";
+    };
+}
 
-    virtual void getInfo() const override { // const functions: functions that don't change the data members values of the class
-        cout<<"#"<<id<<": "<<name<<", Age: "<<age<<", pays="<<getFees()<<" & has matrix: "<<"size="<<size<<endl;
-        cout<<"Matrix"<<endl;
-        for(int i=0; i<size; ++i){
-            for(int j=0; j<size; ++j)
-                cout<<matrix[i][j]<<" ";
-            cout<<endl;
-        }
-    }
+// One footprint report over an n-person generated roster
+function<void()> benchFootprint(size_t n){
+    auto roster = make_shared<Roster>();
+    WorkloadGenerator().generate(*roster, n);
+    return [=]{
+        benchSink = (double)rosterFootprint(*roster).totalBytes();
+    };
+}
 
-    ~Student() override{
-        if(matrix){
-            for(int i=0; i<size; ++i)
-                delete[] matrix[i];
-            delete[] matrix;
+// What one OOPS_TIMED scope costs: two tick reads and a histogram bump (for 1 in 2^Shift calls)
+template<unsigned Shift>
+function<void()> benchLatencyRecord(size_t n){
+    return [=]{
+        unsigned before = LatencyRecorder::sampleShift.exchange(Shift);
+        for(size_t i = 0; i < n; ++i){
+            ScopedLatency timed(TimedOp::GetInfo);
         }
-        cout<<"#"<<id<<": "<<name<<", Age: "<<age<<", Matrix of size "<<size<<" is deleted!"<<endl;
-    }
-};
+        LatencyRecorder::sampleShift = before;
+    };
+}
 
-class GradStudent : public Student{
-public:
-    bool doingResearch;
-    GradStudent(int id=0, int age=18, string name="", double fees=0.0, bool doingResearch=true): 
-        Student(id, age, name, fees), doingResearch(doingResearch){}
+vector<Benchmark> benchmarks(){
+    return {
+        {"join/radix", 10000000, benchRadixJoin},
+        {"join/unordered_map", 10000000, benchUnorderedMapJoin},
+        {"groupby/dept/partitioned", 2000000, [](size_t n){ return benchGroupBy<true>(n, 16); }},
+        {"groupby/dept/map", 2000000, [](size_t n){ return benchGroupBy<false>(n, 16); }},
+        {"groupby/wide/partitioned", 2000000, [](size_t n){ return benchGroupBy<true>(n, n / 4 + 1); }},
+        {"groupby/wide/map", 2000000, [](size_t n){ return benchGroupBy<false>(n, n / 4 + 1); }},
+        {"ids/bloom+set", 10000000, benchIdProbe<true>},
+        {"ids/set", 10000000, benchIdProbe<false>},
+        {"names/substring-x1000", 1000000, benchNameSearch},
+        {"dept/perfect-hash", 5000000, benchDeptLookup<true>},
+        {"dept/unordered_map", 5000000, benchDeptLookup<false>},
+        {"json/write", 1000000, benchJsonWrite},
+        {"json/read", 1000000, benchJsonRead},
+        {"persist/sync-write-fsync", 2000, benchSyncPersist},
+        {"persist/async-group-commit", 2000, benchAsyncPersist},
+        {"server/unpipelined", 200000, benchServer<1>},
+        {"server/pipelined-x32", 200000, benchServer<32>},
+        {"delta/diff", 1000000, benchDeltaDiff},
+        {"delta/merge", 1000000, benchDeltaMerge},
+        {"sort/external-salary", 1000000, benchExternalSort},
+        {"sort/in-memory-salary", 1000000, benchInMemorySort},
+        {"latency/record-every-call", 10000000, benchLatencyRecord<0>},
+        {"latency/record-1-in-16", 10000000, benchLatencyRecord<4>},
+        {"object/student-copy", 1000000, benchStudentCopy},
+        {"object/mixed-lifecycle", 1000000, benchMixedLifecycle},
+        {"workload/mutation-stream", 1000000, benchMutationStream},
+        {"trace/replay", 1000000, benchTraceReplay},
+        {"footprint/roster-report", 1000000, benchFootprint},
+    };
+}
+
+// One benchmark's timings, as saved to and loaded from a baseline file
+struct BenchResult{
+    string name;
+    size_t n = 0;
+    vector<double> ms;          // every timed iteration, in run order
+    vector<double> allocations; // heap allocations in each of those iterations (empty in older baselines)
 };
 
-class TA : public Student, protected Teacher{
-public:
-    TA(int id=0, int age=18, string name="", double fees=0.0, string dept="", 
-        double salary=0.0, bool doingResearch=true): 
-            Student(id, age, name, fees), Teacher(id, name, dept, salary){}
-    
-    void getInfo() const override{
-        cout << "===== TA Info =====\n";
-        cout << "[As Student] ";
-        Student::getInfo();   // call Student version
-        cout << "[As Teacher] ";
-        Teacher::getInfo();   // call Teacher version
+void writeBaseline(const string &path, const vector<BenchResult> &results){
+    ofstream out(path, ios::binary | ios::trunc);
+    {
+        JsonWriter w(out);
+        w.raw("{\"results\":[");
+        for(size_t i = 0; i < results.size(); ++i){
+            w.raw(i ? ",\n{\"name\":" : "\n{\"name\":");
+            w.str(results[i].name);
+            w.key("n"); w.number((long long)results[i].n);
+            w.key("ms");
+            w.raw("[");
+            for(size_t j = 0; j < results[i].ms.size(); ++j){
+                if(j)
+                    w.raw(",", 1);
+                w.number(results[i].ms[j]);
+            }
+            w.raw("]");
+            w.key("allocations");
+            w.raw("[");
+            for(size_t j = 0; j < results[i].allocations.size(); ++j){
+                if(j)
+                    w.raw(",", 1);
+                w.number((long long)results[i].allocations[j]);
+            }
+            w.raw("]}");
+        }
+        w.raw("\n]}\n");
     }
+    if(!out.flush())
+        throw runtime_error("cannot write baseline " + path);
+}
 
-    ~TA() override{
-        cout<<"Destructor from TA class says Hi!"<<endl;
-    }
-};
+vector<BenchResult> readBaseline(const string &path){
+    ifstream in(path, ios::binary);
+    if(!in)
+        throw runtime_error("cannot open baseline " + path);
+    JsonReader r(in);
+    vector<BenchResult> results;
+    string key;
+    r.expect('{');
+    if(r.peek() != '}')
+        do{
+            r.readString(key);
+            r.expect(':');
+            if(key != "results"){
+                r.skipValue();
+                continue;
+            }
+            r.expect('[');
+            if(r.peek() != ']')
+                do{
+                    BenchResult b;
+                    r.expect('{');
+                    if(r.peek() != '}')
+                        do{
+                            r.readString(key);
+                            r.expect(':');
+                            if(key == "name") b.name = r.readString();
+                            else if(key == "n") b.n = (size_t)r.readNumber();
+                            else if(key == "ms" || key == "allocations"){
+                                vector<double> &into = key == "ms" ? b.ms : b.allocations;
+                                r.expect('[');
+                                if(r.peek() != ']')
+                                    do
+                                        into.push_back(r.readNumber());
+                                    while(r.peek() == ',' && r.next());
+                                r.expect(']');
+                            }
+                            else r.skipValue();
+                        } while(r.peek() == ',' && r.next());
+                    r.expect('}');
+                    results.push_back(move(b));
+                } while(r.peek() == ',' && r.next());
+            r.expect(']');
+        } while(r.peek() == ',' && r.next());
+    r.expect('}');
+    return results;
+}
 
-void demoStaticVar(){
-    static int count = 0;
-    cout<<"[Static variable] count, called "<<++count<<" times!"<<endl;
+// Two-sided Mann-Whitney U test: how likely samples this far apart are if both come from the same distribution.
+// Exact (counting every arrangement of ranks) while that stays small, which covers the harness's handful of
+// iterations; otherwise the normal approximation with tie and continuity corrections.
+double mannWhitneyP(const vector<double> &a, const vector<double> &b){
+    size_t na = a.size(), nb = b.size(), total = na + nb;
+    if(na == 0 || nb == 0)
+        return 1;
+    vector<pair<double, int>> all;
+    for(double v : a)
+        all.push_back({v, 0});
+    for(double v : b)
+        all.push_back({v, 1});
+    sort(all.begin(), all.end());
+    double rankSumA = 0, tieTerm = 0;
+    for(size_t i = 0; i < total;){
+        size_t j = i;
+        while(j < total && all[j].first == all[i].first)
+            ++j;
+        double rank = (i + j + 1) / 2.0; // midrank of positions i..j-1, counted from 1
+        for(size_t k = i; k < j; ++k)
+            if(all[k].second == 0)
+                rankSumA += rank;
+        double t = (double)(j - i);
+        tieTerm += t * t * t - t;
+        i = j;
+    }
+    double u = rankSumA - na * (na + 1) / 2.0, mean = na * nb / 2.0;
+    if(na * nb <= 400){
+        // ways[k][s]: arrangements putting k of the first sample's values among the ranks so far with U = s
+        vector<vector<double>> ways(na + 1, vector<double>(na * nb + 1, 0));
+        ways[0][0] = 1;
+        for(size_t position = 0; position < total; ++position)
+            for(size_t k = min(na, position + 1); k-- > 0;){
+                size_t others = position - k; // second-sample values already placed below this one
+                if(others > nb)
+                    continue;
+                for(size_t s = 0; s + others <= na * nb; ++s)
+                    if(ways[k][s])
+                        ways[k + 1][s + others] += ways[k][s];
+            }
+        double arrangements = 0, asExtreme = 0, distance = fabs(u - mean);
+        for(size_t s = 0; s <= na * nb; ++s){
+            arrangements += ways[na][s];
+            if(fabs(s - mean) >= distance - 1e-9)
+                asExtreme += ways[na][s];
+        }
+        return min(1.0, asExtreme / arrangements);
+    }
+    double variance = na * nb / 12.0 * ((total + 1) - tieTerm / (total * (total - 1.0)));
+    if(variance <= 0)
+        return 1;
+    double z = max(0.0, fabs(u - mean) - 0.5) / sqrt(variance);
+    return erfc(z / sqrt(2.0));
 }
 
-void demoStaticObj(){
-    // This is how singletons / caches / loggers are often implemented: static objects that live for the whole run.
-    static Student classRep(999, 22, "Static-Rep", 5178, 2);
-    cout<<"[demoStaticObject] Class Representative info:"<<endl;
-    classRep.getInfo();
+double medianOf(vector<double> v){
+    sort(v.begin(), v.end());
+    return v.empty() ? 0 : v.size() % 2 ? v[v.size() / 2] : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
 }
 
-void waiveFees(Student &s, double amount){
-    cout<<"[Friend Func] Waiving $"<<amount<<" for "<<s.name<<endl;
-    s.fees -= amount;
+// One line per benchmark against the baseline; returns how many got significantly slower or now allocate
+// significantly more per run (each counts once). A change has to pass the test at alpha AND move the median by more
+// than minChange, so run-to-run jitter that happens to be consistent across a handful of iterations doesn't fail a
+// build. Allocations are only compared when the baseline recorded them.
+int compareWithBaseline(const vector<BenchResult> &baseline, const vector<BenchResult> &current, ostream &out,
+                        double alpha = 0.05, double minChange = 0.05){
+    int regressions = 0;
+    out<<"--- compared with baseline (Mann-Whitney U, alpha "<<alpha<<", median change > "<<minChange * 100<<"%) ---"<<endl;
+    for(const BenchResult &now : current){
+        auto before = find_if(baseline.begin(), baseline.end(), [&](const BenchResult &b){ return b.name == now.name; });
+        out<<now.name<<": ";
+        if(before == baseline.end() || before->n != now.n){
+            out<<(before == baseline.end() ? "not in baseline" : "baseline used n=" + to_string(before->n))<<endl;
+            continue;
+        }
+        double was = medianOf(before->ms), is = medianOf(now.ms), change = was > 0 ? is / was - 1 : 0;
+        double p = mannWhitneyP(before->ms, now.ms);
+        bool significant = p < alpha && fabs(change) > minChange;
+        out<<fixed<<setprecision(3)<<was<<" -> "<<is<<" ms ("<<showpos<<setprecision(1)<<change * 100<<noshowpos<<"%), p="
+           <<setprecision(4)<<p<<defaultfloat<<setprecision(6);
+        bool moreAllocations = false;
+        if(!before->allocations.empty() && !now.allocations.empty()){
+            double wasAllocs = medianOf(before->allocations), isAllocs = medianOf(now.allocations);
+            double allocChange = wasAllocs > 0 ? isAllocs / wasAllocs - 1 : isAllocs > 0;
+            moreAllocations = allocChange > minChange && mannWhitneyP(before->allocations, now.allocations) < alpha;
+            out<<"; "<<(uint64_t)wasAllocs<<" -> "<<(uint64_t)isAllocs<<" allocations";
+        }
+        if(significant && change > 0)
+            out<<"  REGRESSION";
+        else if(significant)
+            out<<"  faster";
+        if(moreAllocations)
+            out<<"  ALLOCATION REGRESSION";
+        regressions += (significant && change > 0) || moreAllocations;
+        out<<endl;
+    }
+    out<<regressions<<" regression(s)"<<endl;
+    return regressions;
 }
 
-class HR{
-public:
-    void raise(Teacher &t, int percentage){
-        cout<<"[HR] Teacher "<<t.name<<" old salary ="<<t.salary<<endl; 
-        t.salary = t.salary* ((100 + percentage)*1.0)/100;
-        cout<<"[HR] Teacher "<<t.name<<" new salary ="<<t.salary<<endl; 
+int runBenchmarks(int argc, char *argv[]){
+    vector<string> positional;
+    string savePath, baselinePath;
+    int iterations = 5;
+    for(int i = 0; i < argc; ++i){
+        string arg = argv[i];
+        if((arg == "--save" || arg == "--compare" || arg == "--runs") && i + 1 < argc){
+            string value = argv[++i];
+            if(arg == "--save") savePath = value;
+            else if(arg == "--compare") baselinePath = value;
+            else iterations = max(1, stoi(value));
+        }
+        else
+            positional.push_back(arg);
     }
-};
+    string filter = positional.size() > 0 ? positional[0] : "";
+    size_t n = positional.size() > 1 ? stoull(positional[1]) : 0;
+    vector<BenchResult> baseline;
+    if(!baselinePath.empty())
+        try{
+            baseline = readBaseline(baselinePath); // before running, so a bad path fails fast
+        }
+        catch(const runtime_error &e){
+            cerr<<e.what()<<endl;
+            return 2;
+        }
+    vector<BenchResult> results;
+    PerfCounters counters;
+    if(!counters.available())
+        cout<<"(no hardware counters: "<<counters.unavailableReason()<<"; reporting wall time only)"<<endl;
+    for(const Benchmark &b : benchmarks()){
+        if(b.name.find(filter) == string::npos)
+            continue;
+        size_t rows = n ? n : b.defaultN;
+        bool logged = Student::logLifecycle;
+        Student::logLifecycle = false;
+        function<void()> body = b.setup(rows);
+        body(); // warm-up
+        vector<double> ms, allocations;
+        vector<PerfReading> counts;
+        for(int i = 0; i < iterations; ++i){
+            counters.start();
+            uint64_t allocatedBefore = allocationsCounted.load();
+            countAllocations = true;
+            auto start = chrono::steady_clock::now();
+            body();
+            ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+            countAllocations = false;
+            allocations.push_back((double)(allocationsCounted.load() - allocatedBefore));
+            counters.stop();
+            vector<PerfReading> now = counters.read();
+            if(counts.empty())
+                counts = now;
+            else
+                for(size_t e = 0; e < now.size(); ++e){
+                    counts[e].valid &= now[e].valid;
+                    counts[e].value += now[e].value;
+                }
+        }
+        body = nullptr; // tears the fixture down while lifecycle messages are still off
+        Student::logLifecycle = logged;
+        results.push_back({b.name, rows, ms, allocations});
+        sort(ms.begin(), ms.end());
+        cout<<b.name<<" n="<<rows<<": median "<<ms[iterations / 2]<<" ms, min "<<ms[0]<<" ms, "
+            <<ms[iterations / 2] * 1e6 / rows<<" ns/row, "<<(uint64_t)medianOf(allocations)<<" allocations"<<endl;
+        if(counters.available())
+            cout<<"    "<<perfSummary(counts, iterations, rows)<<endl;
+        if(!benchNote.empty())
+            cout<<"    "<<benchNote<<endl;
+        benchNote.clear();
+    }
+    if(!savePath.empty())
+        writeBaseline(savePath, results);
+    if(!baselinePath.empty() && compareWithBaseline(baseline, results, cout) > 0)
+        return 1;
+    return 0;
+}
+
+int replayTraceFile(int argc, char *argv[]){
+    set<string> flags(argv + 1, argv + argc);
+    TraceReplayer replayer(argv[0]);
+    ReplayStats stats = replayer.run(flags.count("--parallel") > 0, flags.count("--paced") > 0, flags.count("--verbose") == 0);
+    cout<<stats.events<<" events from "<<replayer.recordedThreads()<<" thread(s) replayed in "<<stats.seconds * 1e3
+        <<" ms, "<<stats.unresolved<<" about people the trace never built; "<<replayer.alive()<<" left alive"<<endl;
+    return 0;
+}
 
-int main(){
+int main(int argc, char *argv[]){
     ios_base::sync_with_stdio(false);
     cin.tie(NULL);
 
+    if(argc > 1 && string(argv[1]) == "--bench")
+        return runBenchmarks(argc - 2, argv + 2);
+    if(argc > 2 && string(argv[1]) == "--replay") // --replay trace [--parallel] [--paced] [--verbose]
+        return replayTraceFile(argc - 2, argv + 2);
+
     // Teacher Class
     Teacher t1(0001, "Steve", "CSE", 100000.00);
     Teacher t2(0002, "Jacob", "MAE", 250000.00);
@@ -314,5 +8886,543 @@ int main(){
     HR h;
     h.raise(t1, 50);
 
+    // Top-K Check - highest paid teacher and the two largest outstanding fees
+    vector<Teacher*> staff = {&t1, &t2};
+    for(auto &e : topPaidTeachers(staff, 1).sorted())
+        cout<<"[Top-K] Teacher "<<e.second->name<<" earns $"<<e.first<<endl;
+    vector<Student*> cohort = {&s1, &s2, &s3, &g1};
+    for(auto &e : topOutstandingFees(cohort, 2).sorted())
+        cout<<"[Top-K] Student #"<<e.second->id<<" "<<e.second->name<<" owes $"<<e.first<<endl;
+
+    // Hash Join Check - student #401 and teacher #401 are the same TA, loaded as two separate rosters
+    Student taAsStudent(401, 26, "TA-John", 9000);
+    Teacher taAsTeacher(401, "TA-John", "CSE", 60000.0);
+    vector<Student*> studentRoster = {&s1, &s3, &taAsStudent};
+    vector<Teacher*> teacherRoster = {&t1, &t2, &taAsTeacher};
+    joinStudentsTeachers(studentRoster, teacherRoster, [](const Student &s, const Teacher &t){
+        cout<<"[Join] #"<<s.id<<" "<<s.name<<" pays $"<<s.getFees()<<", earns $"<<t.getSalary()<<endl;
+    });
+    cout<<"[Join] TA net payroll = $"<<netPayroll(studentRoster, teacherRoster)<<endl;
+
+    // Group-By Check - same answers as a plain std::map, grouped three different ways
+    Groups<string> byDept; // DeptMap walks in dept id order; by name for the comparison below
+    salaryByDept(teacherRoster).forEach([&](const string &dept, const Aggregate &a){
+        if(a.count)
+            byDept.emplace_back(dept, a);
+    });
+    sort(byDept.begin(), byDept.end(), [](const pair<string, Aggregate> &a, const pair<string, Aggregate> &b){ return a.first < b.first; });
+    for(auto &g : byDept)
+        cout<<"[Group-By] dept "<<g.first<<": count="<<g.second.count<<" sum="<<g.second.sum<<" avg="<<g.second.avg()
+            <<" min="<<g.second.min<<" max="<<g.second.max<<endl;
+    auto byAge = feesByAge(cohort);
+    for(auto &g : byAge)
+        cout<<"[Group-By] age "<<g.first<<": count="<<g.second.count<<" avg fees="<<g.second.avg()<<endl;
+    vector<GradStudent*> grads = {&g1};
+    for(auto &g : feesByResearch(grads))
+        cout<<"[Group-By] doingResearch="<<g.first<<": count="<<g.second.count<<" avg fees="<<g.second.avg()<<endl;
+    auto deptKey = [](const Teacher &t){ return t.dept; };
+    auto salaryValue = [](const Teacher &t){ return t.getSalary(); };
+    cout<<"[Group-By] matches naive std::map: "<<(sameGroups(byDept, naiveGroupBy<string>(teacherRoster, deptKey, salaryValue)) ? "Yes" : "No")<<endl;
+
+    // Fenwick Histogram Check - built in bulk from the rosters, then kept up to date by the change feed
+    RosterHistograms histograms(cohort, teacherRoster);
+    cout<<"[Histogram] students aged 18-25: "<<histograms.ages.countBetween(18, 25)<<endl;
+    cout<<"[Histogram] teachers earning 100k-200k: "<<histograms.salaries.countBetween(100000, 200000)
+        <<" (total $"<<histograms.salaries.sumBetween(100000, 200000)<<")"<<endl;
+    h.raise(t2, 10);
+    Student freshman(501, 19, "Freshman");
+    cout<<"[Histogram] after a raise and a new student: aged 18-25 = "<<histograms.ages.countBetween(18, 25)
+        <<", earning 100k-200k = "<<histograms.salaries.countBetween(100000, 200000)<<endl;
+
+    // Bloom Filter Check - registry fills up as people are constructed; new ids rarely reach the exact index
+    IdRegistry ids(4);
+    Teacher hire(601, "Hire", "ECE", 90000.0);
+    Student transfer(602, 21, "Transfer");
+    for(int id = 600; id < 610; ++id)
+        if(ids.exists(id))
+            cout<<"[Bloom] id "<<id<<" already taken"<<endl;
+    cout<<"[Bloom] "<<ids.lookups<<" lookups, "<<ids.exactChecks<<" went to the exact index"<<endl;
+
+    // Name Index Check - exact, prefix and substring, and it notices people created after it was built
+    NameIndex names(cohort, teacherRoster);
+    Teacher visiting(701, "Harriet", "PHY", 80000.0);
+    cout<<"[Names] exact \"Harry\": "<<names.findExact("Harry").size()<<" match(es)"<<endl;
+    for(auto *e : names.findPrefix("Har"))
+        cout<<"[Names] prefix \"Har\": "<<e->name<<endl;
+    for(auto *e : names.findSubstring("arr"))
+        cout<<"[Names] substring \"arr\": "<<e->name<<endl;
+
+    // Dept Perfect Hash Check - known depts resolve at compile-time-chosen slots, unknown ones get interned
+    DeptMap<double> payrollByDept;
+    for(Teacher *t : {&t1, &t2, &hire, &visiting})
+        payrollByDept[t->dept] += t->getSalary();
+    payrollByDept["Visiting-Arts"] += 1000;
+    payrollByDept.forEach([](const string &dept, double total){
+        if(total > 0)
+            cout<<"[Dept] "<<dept<<" (id "<<DeptRegistry::id(dept)<<"): $"<<total<<endl;
+    });
+
+    // JSON Check - export a roster, read it back, export again: the two texts must match
+    {
+        Student::logLifecycle = false;
+        Roster roster;
+        roster.teachers.push_back(make_unique<Teacher>(1, "Steve \"the prof\"", "CSE", 150000.0));
+        roster.students.push_back(make_unique<Student>(101, 25, "Harry", 11900, 2));
+        roster.students.back()->matrix[0][0] = 7;
+        roster.gradStudents.push_back(make_unique<GradStudent>(301, 27, "MS-Harry", 18000, false));
+        roster.tas.push_back(make_unique<TA>(401, 26, "TA-John", 9000, "CSE", 60000.0));
+        stringstream json;
+        writeJson(json, roster);
+        cout<<"[JSON] "<<json.str();
+        Roster loaded;
+        readJson(json, loaded);
+        stringstream again;
+        writeJson(again, loaded);
+        cout<<"[JSON] round trip identical: "<<(again.str() == json.str() ? "Yes" : "No")<<endl;
+    }
+
+    // Columnar Check - 40k people sorted by age, row groups of 4096; an age-range scan reads only the groups it needs
+    {
+        Student::logLifecycle = false;
+        vector<RosterRow> rows = rosterRows(*syntheticRoster(40000));
+        stable_sort(rows.begin(), rows.end(), [](const RosterRow &a, const RosterRow &b){ return a.age < b.age; });
+        string path = "roster.col";
+        writeColumnar(path, rows, 4096);
+        ColumnarReader reader(path);
+        RowFilter twenties;
+        twenties.minAge = 20;
+        twenties.maxAge = 29;
+        size_t matched = 0;
+        double fees = 0;
+        reader.scan(twenties, 1u << ColFees, [&](const RosterRow &r){ ++matched; fees += r.fees; });
+        cout<<"[Columnar] "<<matched<<" people in their twenties owe $"<<fees<<"; read "<<reader.groupsRead<<"/"
+            <<reader.groups.size()<<" row groups, "<<reader.bytesRead<<" of "<<ifstream(path, ios::ate | ios::binary).tellg()<<" bytes"<<endl;
+        remove(path.c_str());
+    }
+
+    // Frozen Roster Check - compress a cold cohort, scan it in place, thaw it back to identical objects
+    {
+        Student::logLifecycle = false;
+        shared_ptr<Roster> cohortRoster = syntheticRoster(20000);
+        cohortRoster->students[0]->matrix[1][1] = 42; // one matrix that no longer follows i + j
+        FrozenRoster frozen(*cohortRoster);
+        double fees = 0;
+        frozen.forEach([&](const FrozenPerson &p){ fees += p.fees; });
+        cout<<"[Frozen] "<<frozen.size()<<" people: "<<expandedBytes(*cohortRoster)<<" bytes expanded, "<<frozen.memoryBytes()
+            <<" frozen ("<<(double)expandedBytes(*cohortRoster) / frozen.memoryBytes()<<"x smaller)"<<endl;
+        cout<<"[Frozen] aged 18-25: "<<frozen.countAgeBetween(18, 25)<<", total fees $"<<(long long)fees<<endl;
+        stringstream before, after;
+        writeJson(before, *cohortRoster);
+        writeJson(after, frozen.thaw());
+        cout<<"[Frozen] thawed roster identical: "<<(before.str() == after.str() ? "Yes" : "No")<<endl;
+    }
+
+    // Async Persistence Check - log a raise and a fee waiver, snapshot a roster, wait for both to be durable
+    {
+        AsyncWriter logFile("roster.log");
+        MutationLog mutations(logFile);
+        mutex durableLock; // onDurable runs on the writer thread; only main prints
+        vector<LogEntry> durable;
+        mutations.onDurable = [&](const LogEntry &e){
+            if(e.op == LogOp::SalarySet || e.op == LogOp::FeesSet){
+                lock_guard<mutex> guard(durableLock);
+                durable.push_back(e);
+            }
+        };
+        auto reportDurable = [&](bool ok){
+            lock_guard<mutex> guard(durableLock);
+            for(const LogEntry &e : durable)
+                cout<<"[Persist] lsn "<<e.lsn<<" durable: #"<<e.row.id<<(e.op == LogOp::SalarySet ? " salary $" : " fees $")
+                    <<(e.op == LogOp::SalarySet ? e.row.salary : e.row.fees)<<endl;
+            durable.clear();
+            if(!ok)
+                cout<<"[Persist] mutation log write failed"<<endl;
+        };
+        h.raise(t1, 5);
+        reportDurable(mutations.waitDurable(mutations.lastLsn()));
+        waiveFees(s1, 50);
+        reportDurable(mutations.waitDurable(mutations.lastLsn()));
+
+        Student::logLifecycle = false;
+        shared_ptr<Roster> snapshotRoster = syntheticRoster(2000);
+        AsyncWriter snapshotFile("roster.snap");
+        PagePool pages(4, 4096);
+        promise<bool> written;
+        writeSnapshotAsync(snapshotFile, pages, *snapshotRoster, [&](bool ok){ written.set_value(ok); });
+        bool ok = written.get_future().get();
+        cout<<"[Persist] snapshot of "<<loadSnapshot("roster.snap").size()<<" people durable: "<<(ok ? "Yes" : "No")
+            <<" in "<<snapshotFile.batches<<" batch(es) via "<<snapshotFile.backend()<<endl;
+    }
+    cout<<"[Persist] mutation log holds "<<readMutationLog("roster.log").size()<<" entries"<<endl;
+    remove("roster.log");
+    remove("roster.snap");
+
+    // Mapped Matrix Check - a 64 MB matrix with the threshold lowered to 1 MB lives in a file; its copy is cloned file to file
+    {
+        size_t heapLimit = Student::mappedMatrixBytes;
+        Student::mappedMatrixBytes = 1 << 20;
+        Student big(900, 20, "Big", 0, 4096);
+        big.matrix[4095][4095] = -1;
+        Student bigCopy(big);
+        bigCopy.matrix[0][0] = -2;
+        cout<<"[Mapped] matrix in a file: "<<(big.isMatrixMapped() ? "Yes" : "No")<<", copy in a file: "
+            <<(bigCopy.isMatrixMapped() ? "Yes" : "No")<<", copy sees "<<bigCopy.matrix[4095][4095]<<", original keeps "
+            <<big.matrix[0][0]<<endl;
+        Student::mappedMatrixBytes = 0;
+        Student tiny(901, 20, "Tiny", 0, 2);
+        tiny.getInfo();
+        Student::mappedMatrixBytes = heapLimit;
+    }
+
+    // Shared Memory Check - a forked reader process maps the roster read-only while this process keeps raising a
+    // teacher; every read it gets must be a consistent one (salary and the published roster both intact)
+    {
+        Student::logLifecycle = false;
+        shared_ptr<Roster> sharedSource = syntheticRoster(1000);
+        Teacher *raised = sharedSource->teachers[0].get();
+        SharedRoster segment("/oops-roster-" + to_string(getpid()), 4096, 64 << 10);
+        segment.publish(*sharedSource);
+        pid_t child = fork();
+        if(child == 0){
+            SharedRoster view("/oops-roster-" + to_string(getppid()));
+            bool consistent = true;
+            for(int i = 0; i < 20000; ++i){
+                RosterRow row;
+                consistent &= view.lookup(raised->id, row) && row.name == raised->name && row.salary >= raised->getSalary()
+                              && view.size() == 1000;
+            }
+            _exit(consistent ? 0 : 1);
+        }
+        for(int i = 0; i < 20000; ++i)
+            raised->setSalary(raised->getSalary() + 1);
+        int status = 0;
+        waitpid(child, &status, 0);
+        cout<<"[Shared] "<<segment.size()<<" people in a "<<segment.segmentBytes() / 1024<<" KB segment, reader process saw only consistent reads: "
+            <<(WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "Yes" : "No")<<endl;
+    }
+
+    // Query Server Check - ask the server what main() already knows, then put it under a short pipelined load
+    {
+        string socketPath = "/tmp/oops-roster-" + to_string(getpid()) + ".sock";
+        Roster servedRoster;
+        servedRoster.teachers.push_back(make_unique<Teacher>(7001, "Ada", "CSE", 120000));
+        servedRoster.teachers.push_back(make_unique<Teacher>(7002, "Alan", "Math", 90000));
+        servedRoster.students.push_back(make_unique<Student>(7101, 17, "Minor", 5000));
+        servedRoster.students.push_back(make_unique<Student>(7102, 19, "Voter", 5000));
+        RosterIndex servedIndex(servedRoster);
+        RosterServer server(socketPath, servedIndex);
+        atomic<bool> stop{false};
+        thread loop([&]{ server.run(stop); });
+        {
+            RosterClient client(socketPath);
+            cout<<"[Server] info 7001: "<<client.info(7001)<<endl;
+            cout<<"[Server] 7101 eligible to vote: "<<(client.isVoteEligible(7101, true) ? "Yes" : "No")
+                <<", 7102: "<<(client.isVoteEligible(7102, true) ? "Yes" : "No")<<endl;
+            cout<<"[Server] CSE payroll $"<<client.payroll("CSE")<<" of $"<<client.payroll()<<", people known: "<<client.count()<<endl;
+        }
+        LoadReport load = generateLoad(socketPath, {7101, 7102}, 2, 5000, 16);
+        cout<<"[Server] load run answered "<<load.requests<<" of 10000 requests ("<<server.backend()<<")"<<endl;
+        stop = true;
+        loop.join();
+    }
+
+    // Replication Check - a follower process joins after the primary's log window has moved on (so it starts from a
+    // snapshot), follows a stream of raises, hires and departures, and answers queries that must match the primary
+    {
+        Student::logLifecycle = false;
+        string primaryPath = "/tmp/oops-primary-" + to_string(getpid()) + ".sock";
+        string replicaPath = "/tmp/oops-replica-" + to_string(getpid()) + ".sock";
+        shared_ptr<Roster> primaryRoster = syntheticRoster(1000);
+        unique_ptr<ReplicationPrimary> primary(new ReplicationPrimary(primaryPath, *primaryRoster, 256));
+        for(int i = 0; i < 1000; ++i){
+            Teacher &t = *primaryRoster->teachers[i % primaryRoster->teachers.size()];
+            t.setSalary(t.getSalary() * 1.01);
+        }
+        cout.flush();
+        pid_t follower = fork();
+        if(follower == 0){
+            {
+                ReplicaFollower replica(primaryPath);
+                RosterServer replicaServer(replicaPath, replica);
+                while(replica.pollOnce(5))
+                    replicaServer.pollOnce(0);
+                cout<<"[Replica] follower: "<<replica.snapshotsLoaded<<" snapshot, "<<replica.batchesApplied
+                    <<" batches up to lsn "<<replica.appliedLsn<<", max lag "<<replica.maxLagUs / 1000<<" ms"<<endl;
+            } // _exit skips destructors, so close the server (and unlink its socket) first
+            _exit(0);
+        }
+        for(int i = 0; i < 300; ++i){
+            Teacher &t = *primaryRoster->teachers[i % primaryRoster->teachers.size()];
+            t.setSalary(t.getSalary() * 1.02);
+            primaryRoster->students.push_back(make_unique<Student>(80000 + i, 18 + i % 5, "Hire-" + to_string(i), 1000));
+            if(i % 3 == 0)
+                primaryRoster->students.erase(primaryRoster->students.begin());
+            Student &s = *primaryRoster->students.back();
+            s.setFees(s.getFees() - 10);
+            primary->pump(i % 10 == 0 ? 1 : 0);
+        }
+        for(int i = 0; i < 2000 && (primary->followerCount() == 0 || primary->lag() > 0); ++i)
+            primary->pump(5);
+        double expected = 0;
+        for(Teacher *t : primaryRoster->allTeachers())
+            expected += t->getSalary();
+        unique_ptr<RosterClient> onReplica;
+        for(int attempt = 0; !onReplica && attempt < 100; ++attempt){
+            try{
+                onReplica.reset(new RosterClient(replicaPath));
+            }
+            catch(const runtime_error &){
+                primary->pump(5);
+            }
+        }
+        RosterIndex primaryIndex(*primaryRoster);
+        string hired;
+        primaryIndex.describe(80299, hired);
+        cout<<"[Replica] primary at lsn "<<primary->lastLsn()<<", lag "<<primary->lag()<<" entries, snapshots sent: "
+            <<primary->snapshotsSent<<endl;
+        cout<<"[Replica] follower payroll matches primary: "<<(fabs(onReplica->payroll() - expected) < 1e-6 ? "Yes" : "No")
+            <<", headcount matches: "<<(onReplica->count() == primaryIndex.count() ? "Yes" : "No")
+            <<", latest hire matches: "<<(onReplica->info(80299) == hired ? "Yes" : "No")<<endl;
+        onReplica.reset();
+        cout.flush();
+        primary.reset();
+        waitpid(follower, nullptr, 0);
+    }
+
+    // Merkle Check - a JSON copy with three edits: the roots differ and diff() names exactly the edited records,
+    // touching a handful of nodes; the feed-maintained digest tracks the roster, and a replica verifies against it
+    {
+        Student::logLifecycle = false;
+        shared_ptr<Roster> original = syntheticRoster(20000);
+        stringstream json;
+        writeJson(json, *original);
+        Roster copy;
+        readJson(json, copy);
+        bool sameRoot = digestOf(*original).root() == digestOf(copy).root();
+        copy.teachers[5]->setSalary(1);
+        copy.students[7]->matrix[0][0] = -1;
+        copy.tas[3]->age += 1;
+        size_t visited;
+        vector<uint64_t> changed = diff(digestOf(*original), digestOf(copy), &visited);
+        cout<<"[Merkle] JSON copy has the same root: "<<(sameRoot ? "Yes" : "No")<<"; after 3 edits diff finds";
+        for(uint64_t k : changed)
+            cout<<" "<<MerkleTree::keyName(k);
+        cout<<" comparing "<<visited<<" of "<<digestOf(copy).nodeCount()<<" nodes"<<endl;
+
+        RosterDigest live(*original);
+        string primaryPath = "/tmp/oops-merkle-" + to_string(getpid()) + ".sock";
+        ReplicationPrimary primary(primaryPath, *original);
+        ReplicaFollower replica(primaryPath);
+        auto sync = [&]{
+            for(int i = 0; i < 10; ++i){
+                primary.pump(1);
+                replica.pollOnce(1);
+            }
+        };
+        sync(); // snapshot
+        h.raise(*original->teachers[0], 10);
+        original->students.pop_back();
+        original->gradStudents[0]->matrix[2][2] = 9; // bypasses the feed, so it is never shipped
+        live.refresh(*original->gradStudents[0]);
+        sync();
+        cout<<"[Merkle] live digest matches a rebuild: "<<(live.digest().root() == digestOf(*original).root() ? "Yes" : "No")
+            <<", replica verifies: "<<(replica.digest().root() == live.digest().root() ? "Yes" : "No")<<", records to resend:";
+        for(uint64_t k : diff(live.digest(), replica.digest()))
+            cout<<" "<<MerkleTree::keyName(k);
+        cout<<endl;
+        Roster promoted = replica.promote();
+        cout<<"[Merkle] promoted replica keeps every class: "
+            <<(promoted.teachers.size() == original->teachers.size() && promoted.students.size() == original->students.size()
+               && promoted.gradStudents.size() == original->gradStudents.size() && promoted.tas.size() == original->tas.size()
+               ? "Yes" : "No")<<endl;
+    }
+
+    // Delta Check - two days of a 20k roster: the delta is a small fraction of a snapshot, and yesterday + delta
+    // reproduces today's snapshot byte for byte
+    {
+        Student::logLifecycle = false;
+        vector<RosterRow> yesterday = sortedRows(*syntheticRoster(20000));
+        writeSnapshot("day1.snap", yesterday);
+        writeSnapshot("day2.snap", simulateDay(yesterday, 200, 2));
+        DeltaStats found = diffSnapshots("day1.snap", "day2.snap", "day.delta");
+        mergeDelta("day1.snap", "day.delta", "day2-merged.snap");
+        auto slurp = [](const char *path){
+            ifstream in(path, ios::binary);
+            return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        };
+        cout<<"[Delta] "<<found.added<<" added, "<<found.removed<<" removed, "<<found.changed<<" changed, "<<found.unchanged
+            <<" unchanged; delta "<<slurp("day.delta").size() / 1024<<" KB vs snapshot "<<slurp("day2.snap").size() / 1024
+            <<" KB; merge reproduces today: "<<(slurp("day2-merged.snap") == slurp("day2.snap") ? "Yes" : "No")<<endl;
+        for(const char *f : {"day1.snap", "day2.snap", "day.delta", "day2-merged.snap"})
+            remove(f);
+    }
+
+    // External Sort Check - 50k people sorted by salary in a 256 KB budget with fan-in 8 (dozens of runs, more than one
+    // merge pass) must come out exactly as an in-memory sort; a name index then finds rows by seeking into the snapshot
+    {
+        Student::logLifecycle = false;
+        vector<RosterRow> unsorted = rosterRows(*syntheticRoster(50000));
+        writeSnapshot("unsorted.snap", unsorted);
+        SortStats bySalary = sortSnapshot("unsorted.snap", "by-salary.snap", SortKey::Salary, 256 << 10, 8);
+        sort(unsorted.begin(), unsorted.end(), RowOrder{SortKey::Salary});
+        SnapshotReader sorted("by-salary.snap");
+        bool same = true;
+        size_t count = 0;
+        for(RosterRow row; sorted.next(row); ++count)
+            same &= count < unsorted.size() && row.id == unsorted[count].id && row.kind == unsorted[count].kind;
+        cout<<"[ExtSort] "<<bySalary.records<<" rows, "<<bySalary.runs<<" runs, "<<bySalary.mergePasses
+            <<" merge passes; matches in-memory sort: "<<(same && count == unsorted.size() ? "Yes" : "No")<<endl;
+
+        buildSortedIndex("unsorted.snap", "by-name.idx", SortKey::Name, 256 << 10, 8);
+        SortedIndexReader index("by-name.idx");
+        IndexEntry first;
+        index.next(first);
+        RosterRow found = readRowAt("unsorted.snap", first.offset);
+        cout<<"[ExtSort] name index starts at "<<first.name<<" (#"<<first.id<<"), row found by offset: "
+            <<(found.id == first.id && found.name == first.name ? "Yes" : "No")<<endl;
+        for(const char *f : {"unsorted.snap", "by-salary.snap", "by-name.idx"})
+            remove(f);
+    }
+
+    // Metrics Check - scrape the endpoint the way Prometheus would and pick out a few families
+    {
+        string socketPath = "/tmp/oops-metrics-" + to_string(getpid()) + ".sock";
+        MetricsEndpoint endpoint(socketPath);
+        atomic<bool> stop{false};
+        thread loop([&]{ endpoint.run(stop); });
+        string text = scrapeMetrics(socketPath);
+        stop = true;
+        loop.join();
+        istringstream lines(text);
+        size_t series = 0;
+        for(string line; getline(lines, line);){
+            if(line.empty() || line[0] == '#')
+                continue;
+            ++series;
+            if(line.rfind("oops_population", 0) == 0 || line.rfind("oops_live_objects", 0) == 0
+               || line.rfind("oops_mutations_total{op=\"raise\"}", 0) == 0 || line.rfind("oops_matrix_bytes", 0) == 0)
+                cout<<"[Metrics] "<<line<<endl;
+        }
+        writeMetricsFile("oops.prom");
+        ifstream file("oops.prom");
+        string first;
+        getline(file, first);
+        cout<<"[Metrics] "<<series<<" series scraped; oops.prom starts with \""<<first<<"\""<<endl;
+        remove("oops.prom");
+    }
+
+    // Workload Check - a seeded roster with a skewed department mix, rebuilt to show it comes out identical, then a
+    // stream of mutations aimed mostly at a few hot records
+    {
+        WorkloadConfig config;
+        config.seed = 2024;
+        config.targetSkew = 1;
+        Roster generated, again;
+        WorkloadGenerator(config).generate(generated, 20000);
+        WorkloadGenerator(config).generate(again, 20000);
+        map<string, size_t> perDept;
+        size_t nameLetters = 0, bigMatrices = 0;
+        for(Teacher *t : generated.allTeachers())
+            ++perDept[t->dept];
+        for(Student *s : generated.allStudents()){
+            nameLetters += s->name.size() - 1;
+            bigMatrices += s->size > 3;
+        }
+        cout<<"[Workload] "<<generated.teachers.size()<<" teachers, "<<generated.students.size()<<" students, "
+            <<generated.gradStudents.size()<<" grad students, "<<generated.tas.size()<<" TAs; CSE "<<perDept["CSE"]
+            <<" vs ECON "<<perDept["ECON"]<<" teachers"<<endl;
+        cout<<"[Workload] first person: "<<generated.allStudents()[0]->name<<", letters per student name "
+            <<fixed<<setprecision(1)<<(double)nameLetters / generated.allStudents().size()<<defaultfloat<<setprecision(6)
+            <<", bigger matrices "<<bigMatrices<<"; same seed rebuilds it exactly: "
+            <<(digestOf(generated).root() == digestOf(again).root() ? "Yes" : "No")<<endl;
+        bool logged = Student::logLifecycle;
+        Student::logLifecycle = false;
+        vector<Teacher*> teachers = generated.allTeachers();
+        vector<Student*> students = generated.allStudents();
+        MutationStream stream(config, teachers.size(), students.size());
+        MutationCounts counts;
+        size_t hottest = 0;
+        for(int i = 0; i < 10000; ++i){
+            Mutation m = stream.next();
+            hottest += m.target == 0;
+            applyMutation(teachers, students, m, counts);
+        }
+        Student::logLifecycle = logged;
+        cout<<"[Workload] 10000 mutations: "<<counts.raises<<" raises, "<<counts.waivers<<" waivers, "<<counts.copies
+            <<" copies; "<<hottest<<" hit the hottest record"<<endl;
+    }
+
+    // Trace Check - start recording on a generated roster, which the trace snapshots, as it takes mutations while a
+    // second thread copies and assigns its own students; then replay the trace flat out on one thread and at the
+    // recorded pace on two
+    {
+        Student::logLifecycle = false;
+        WorkloadConfig config;
+        config.seed = 99;
+        Roster traced;
+        WorkloadGenerator(config).generate(traced, 2000);
+        TraceRecorder recorder("demo.trace", traced);
+        thread helper([]{
+            Student first(9001, 17, "Copy-Source", 4000), second(9002, 30, "Assigned", 100, 4);
+            for(int i = 0; i < 200; ++i){
+                Student copy(first);
+                second = copy;
+                second.isVoteEligible(i % 2 == 0);
+            }
+        });
+        vector<Teacher*> teachers = traced.allTeachers();
+        vector<Student*> students = traced.allStudents();
+        MutationStream stream(config, teachers.size(), students.size());
+        MutationCounts counts;
+        for(int i = 0; i < 5000; ++i)
+            applyMutation(teachers, students, stream.next(), counts);
+        helper.join();
+        size_t events = recorder.stop();
+        double payroll = 0;
+        for(Teacher *t : teachers)
+            payroll += t->getSalary();
+        struct stat info{};
+        ::stat("demo.trace", &info);
+
+        TraceReplayer replayer("demo.trace");
+        ReplayStats fast = replayer.run(false, false);
+        cout<<"[Trace] "<<events<<" events from "<<replayer.recordedThreads()<<" threads in "<<info.st_size / 1024
+            <<" KB; replayed flat out in "<<fixed<<setprecision(1)<<fast.seconds * 1e3<<" ms"<<defaultfloat<<setprecision(6)
+            <<", unresolved: "<<fast.unresolved<<endl;
+        cout<<"[Trace] replay left "<<replayer.alive()<<" people (recorded run: "<<traced.size()<<"), payroll matches: "
+            <<(fabs(replayer.payroll() - payroll) < 1e-6 * payroll ? "Yes" : "No")<<endl;
+        replayer.clear();
+        ReplayStats paced = replayer.run(true, true);
+        cout<<"[Trace] paced replay on "<<replayer.recordedThreads()<<" threads took at least the recorded span: "
+            <<(paced.seconds >= replayer.recordedSeconds() ? "Yes" : "No")<<", unresolved: "<<paced.unresolved<<endl;
+        remove("demo.trace");
+    }
+
+    // Footprint Check - one TA field by field, then a generated roster, timed to show it scales to big rosters
+    {
+        Student::logLifecycle = false;
+        TA probe(501, 24, "A TA with a name too long for the small-string buffer", 3000, "CSE", 40000, true);
+        cout<<"[Footprint] ";
+        probe.footprint().print(cout);
+        WorkloadConfig config;
+        config.seed = 5;
+        Roster generated;
+        WorkloadGenerator(config).generate(generated, 200000);
+        auto start = chrono::steady_clock::now();
+        RosterFootprint report = rosterFootprint(generated);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout<<"[Footprint] ";
+        report.print(cout);
+        cout<<"[Footprint] report over "<<generated.size()<<" people took "<<fixed<<setprecision(1)<<ms<<" ms"
+            <<defaultfloat<<setprecision(6)<<endl;
+    }
+
+#ifdef OOPS_INSTRUMENT
+    // Latency Check - everything above was timed; percentiles merged across the threads that did the work
+    cout<<"[Latency]"<<endl;
+    latencyReport(cout);
+#endif
+    Student::logLifecycle = true;
+
     return 0;
 }
\ No newline at end of file
@@ -5,10 +5,83 @@ using namespace std;
 // ======= FRIEND FUNCTION DEMO FORWARD DECLARATION =======
 class Teacher;
 
+// ======= MEMORY FOOTPRINT =======
+// What an object really costs: sizeof split into fields, vptrs and padding, plus the heap its fields own and the
+// malloc overhead on top (glibc: 8-byte header, rounded up to 16 bytes, 32 bytes minimum).
+size_t allocatorBytes(size_t requested) {
+    return max<size_t>(32, (requested + 8 + 15) & ~(size_t)15);
+}
+
+// Heap a string owns - none while it fits the buffer inside the string object itself
+size_t stringHeap(const string& s) {
+    const char* inside = (const char*)&s;
+    return (s.data() >= inside && s.data() < inside + sizeof s) ? 0 : s.capacity() + 1;
+}
+
+struct FootprintField {
+    string name;
+    size_t offset, inlineBytes, heapBytes, overheadBytes;
+};
+
+struct Footprint {
+    string type;
+    size_t objectBytes, vptrBytes = 0, paddingBytes = 0;
+    vector<FootprintField> fields;
+    vector<size_t> subobjects;  // offsets of polymorphic subobjects - each starts with a vptr
+
+    Footprint(const string& type, size_t objectBytes) : type(type), objectBytes(objectBytes) {}
+
+    void subobject(const void* object, const void* start) {
+        subobjects.push_back((const char*)start - (const char*)object);
+    }
+
+    // heap > 0 means the field owns one allocation of that many bytes
+    void field(const void* object, const string& name, const void* member, size_t size, size_t heap = 0) {
+        fields.push_back({name, (size_t)((const char*)member - (const char*)object), size, heap,
+                          heap ? allocatorBytes(heap) - heap : 0});
+    }
+
+    // Gaps between fields: a pointer-sized one where a subobject starts is its vptr, anything else is padding
+    void finish() {
+        sort(fields.begin(), fields.end(), [](const FootprintField& a, const FootprintField& b) { return a.offset < b.offset; });
+        size_t at = 0;
+        for (size_t i = 0; i <= fields.size(); ++i) {
+            size_t from = i < fields.size() ? fields[i].offset : objectBytes;
+            if (from > at) {
+                size_t vptr = count(subobjects.begin(), subobjects.end(), at) && from - at >= sizeof(void*) ? sizeof(void*) : 0;
+                vptrBytes += vptr;
+                paddingBytes += from - at - vptr;
+            }
+            if (i < fields.size())
+                at = max(at, fields[i].offset + fields[i].inlineBytes);
+        }
+    }
+
+    size_t heapBytes() const {
+        size_t total = 0;
+        for (const FootprintField& f : fields)
+            total += f.heapBytes + f.overheadBytes;
+        return total;
+    }
+
+    size_t totalBytes() const {
+        return objectBytes + heapBytes();
+    }
+
+    void print() const {
+        cout << type << ": " << totalBytes() << " bytes = " << objectBytes << " inline (vptrs " << vptrBytes
+             << ", padding " << paddingBytes << ") + " << heapBytes() << " heap incl. allocator overhead\n";
+        for (const FootprintField& f : fields)
+            cout << "    +" << f.offset << " " << f.name << ": " << f.inlineBytes << " inline, " << f.heapBytes
+                 << " heap, " << f.overheadBytes << " overhead\n";
+    }
+};
+
 // ======= ABSTRACT CLASS =======
 class IPerson {
 public:
     virtual void introduce() const = 0;  // pure virtual function
+    virtual Footprint footprint() const = 0;
     virtual ~IPerson() {}               // virtual destructor
 };
 
@@ -60,10 +133,27 @@ public:
         return population;
     }
 
+    Footprint footprint() const override {
+        Footprint f("Person", sizeof(Person));
+        personFields(f, this);
+        f.finish();
+        return f;
+    }
+
     virtual ~Person() {
         cout << "Destructor of Person called for " << name << endl;
         population--;
     }
+
+protected:
+    // object = the most-derived object, so offsets come out relative to its start
+    void personFields(Footprint& f, const void* object) const {
+        f.subobject(object, this);
+        f.subobject(object, static_cast<const IPerson*>(this));
+        f.field(object, "Person::id", &id, sizeof id);
+        f.field(object, "Person::age", &age, sizeof age);
+        f.field(object, "Person::name", &name, sizeof name, stringHeap(name));
+    }
 };
 
 // This is the definition and initialization of a static data member outside the class. It is shared among all instances of the Person class.
@@ -106,11 +196,25 @@ public:
         cout << "I'm Student " << name << ", age " << age << ", ID " << id << ".\n";
     }
 
+    Footprint footprint() const override {
+        Footprint f("Student", sizeof(Student));
+        personFields(f, this);
+        studentFields(f, this);
+        f.finish();
+        return f;
+    }
+
     ~Student() {
         delete[] marks;
         marks = nullptr;
         cout << "Student destructor called\n";
     }
+
+protected:
+    void studentFields(Footprint& f, const void* object) const {
+        f.subobject(object, this);
+        f.field(object, "Student::marks", &marks, sizeof marks, marks ? 3 * sizeof(int) : 0);
+    }
 };
 
 // ======= TEACHER CLASS =======
@@ -134,6 +238,21 @@ public:
         cout << "I'm Teacher " << name << ", teaching with salary $" << salary << endl;
     }
 
+    Footprint footprint() const override {
+        Footprint f("Teacher", sizeof(Teacher));
+        personFields(f, this);
+        teacherFields(f, this);
+        f.finish();
+        return f;
+    }
+
+protected:
+    void teacherFields(Footprint& f, const void* object) const {
+        f.subobject(object, this);
+        f.field(object, "Teacher::salary", &salary, sizeof salary);
+    }
+
+public:
     friend class TA;                    // Friend class
     friend void revealSalary(const Teacher& t);  // Friend function
 };
@@ -158,8 +277,32 @@ public:
     void showTeacherSalary() {
         cout << "[Friend Class] Teacher salary accessed by TA: $" << Teacher::getSalary() << endl;
     }
+
+    Footprint footprint() const override {
+        Footprint f("TA", sizeof(TA));
+        personFields(f, this);
+        studentFields(f, this);
+        teacherFields(f, this);
+        f.finish();
+        return f;
+    }
 };
 
+// ======= FOOTPRINT REPORT =======
+void footprintReport(const vector<const IPerson*>& people) {
+    map<string, pair<size_t, size_t>> byType;  // objects, bytes
+    size_t total = 0;
+    for (const IPerson* p : people) {
+        Footprint f = p->footprint();
+        byType[f.type].first++;
+        byType[f.type].second += f.totalBytes();
+        total += f.totalBytes();
+    }
+    for (auto& [type, counts] : byType)
+        cout << type << ": " << counts.first << " object(s), " << counts.second << " bytes\n";
+    cout << "All " << people.size() << " objects: " << total << " bytes\n";
+}
+
 // ======= STATIC OBJECT DEMO =======
 void staticObjectDemo() {
     static Person staticPerson(99, "StaticUser", 999);
@@ -202,6 +345,10 @@ int main() {
     cout << "\n--- Vote Eligibility ---\n";
     cout << "Is " << p2.name << " eligible to vote? " << (p2.isVoteEligible(true) ? "Yes" : "No") << endl;
 
+    cout << "\n--- Memory Footprint ---\n";
+    ta1.footprint().print();
+    footprintReport({&p1, &p2, &p3, &s1, &s2, &t1, &ta1});
+
     cout << "\nTotal Person objects: " << Person::getPopulation() << endl;
 
     return 0;